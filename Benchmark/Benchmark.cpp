@@ -0,0 +1,804 @@
+/*
+________________________________________________________________________________
+
+Benchmark
+
+Renders fixed scenes from fixed cameras with the reference renderer, encodes
+the frames as the HTTP views do, and checks the results against the golden
+images and the performance baselines stored with the sources:
+- images must match their golden image within a tolerance,
+- the median frame time (render and encode) and post processing time of the
+  runs must not exceed the median of their baseline by more than the given
+  number of deviations, combining the deviation recorded with the baseline
+  and the deviation of the runs. Runs are timed relative to a calibration
+  loop, so that a machine whose speed changes between the baseline and the
+  check is not taken for a regression,
+- encoded frames must not grow by more than 2%,
+- a frame must not allocate more memory blocks than its baseline.
+Scenes are either generated by the benchmark or read from the PDB files of
+the data directory, which are stored with the sources: a missing file is a
+failure.
+
+Usage: Benchmark [--scene name] [--data directory] [--golden directory]
+                 [--baselines file] [--work directory] [--iterations n]
+                 [--time-sigmas n] [--update]
+
+--update records the golden images and baselines of the scenes that ran
+instead of checking them. The exit code is 0 when all checks pass and 1 on
+any failure.
+________________________________________________________________________________
+*/
+
+// System
+#ifdef WIN32
+#include <windows.h>
+#else
+#include <time.h>
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <float.h>
+#include <new>
+#include <algorithm>
+#include <map>
+#include <string>
+#include <vector>
+
+// Project
+#include "CameraModel.h"
+#include "DepthEstimator.h"
+#include "TileMask.h"
+#include "JpegEncoder.h"
+#include "PostProcessor.h"
+#include "PdbReader.h"
+#include "ReferenceRenderer.h"
+
+// --------------------------------------------------------------------------------
+// Allocations
+// --------------------------------------------------------------------------------
+// Every allocation of the process is counted, so that a frame that starts
+// allocating shows up in the baselines
+volatile long gAllocations(0);
+
+// Results of the calibration loop, kept so that it is not optimized away
+volatile float gCalibrationSink(0.f);
+
+void* operator new( size_t size )
+{
+#ifdef WIN32
+   InterlockedIncrement( &gAllocations );
+#else
+   __sync_fetch_and_add( &gAllocations, 1 );
+#endif
+   void* block = malloc( size ? size : 1 );
+   if( !block ) throw std::bad_alloc();
+   return block;
+}
+
+void* operator new[]( size_t size )
+{
+   return operator new( size );
+}
+
+// Every replaced operator new allocates with malloc, so every operator delete
+// frees. GCC does not know that the replaced operators pair this way, and
+// warns when it inlines a delete into a caller of operator new.
+#if defined(__GNUC__) && !defined(__clang__) && __GNUC__ >= 11
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+#endif
+
+void operator delete( void* block ) throw()
+{
+   free( block );
+}
+
+void operator delete[]( void* block ) throw()
+{
+   free( block );
+}
+
+// Sized forms, used by compilers that pass the size of the block
+void operator delete( void* block, size_t ) throw()
+{
+   free( block );
+}
+
+void operator delete[]( void* block, size_t ) throw()
+{
+   free( block );
+}
+
+#if defined(__GNUC__) && !defined(__clang__) && __GNUC__ >= 11
+#pragma GCC diagnostic pop
+#endif
+
+namespace
+{
+   // Same molecule scaling as the server
+   const float ATOM_SIZE     = 100.f;
+   const float SCALE         = 50.f;
+   const float CARBON_RADIUS = 1.70f;
+
+   // Frames are small so that golden images stay small, with a large pixel
+   // pitch to keep the molecules in view
+   const int   WIDTH          = 192;
+   const int   HEIGHT         = 128;
+   const float PIXEL_PITCH    = 16.f;
+   const float PLANE_DISTANCE = 5000.f;
+   const int   TILE_SIZE      = 16;
+   const int   QUALITY        = 75;
+   const float BACKGROUND[3]  = { 0.1f, 0.1f, 0.2f };
+
+   // Golden image tolerance: pixels whose channels differ by more than
+   // PIXEL_TOLERANCE, on at most MAX_DIFFERENT_PIXELS of the image
+   const int    PIXEL_TOLERANCE      = 16;
+   const double MAX_DIFFERENT_PIXELS = 0.005;
+
+   // The deviation of timings is estimated from the median absolute
+   // deviation of the runs, scaled to match a normal distribution, and is
+   // at least MIN_RELATIVE_DEVIATION of the median
+   const double MAD_TO_DEVIATION       = 1.4826;
+   const double MIN_RELATIVE_DEVIATION = 0.03;
+
+   // Each run is followed by a calibration loop of CALIBRATION_PASSES over
+   // CALIBRATION_SIZE values, more than the caches hold, since large scenes
+   // are slowed down by the memory traffic of other processes as well
+   const int CALIBRATION_SIZE   = 1<<20;
+   const int CALIBRATION_PASSES = 2;
+
+   // Encoded frames may grow by 2% before it is a regression
+   const double BYTES_TOLERANCE = 0.02;
+
+   /*
+   * @brief Scene of the benchmark: a PDB file of the data directory, or
+   * helices generated on a square grid of the given size
+   */
+   struct Scene
+   {
+      const char* name;
+      const char* fileName;
+      int         helices;
+      float       distance; // from the eye to the center, front camera
+   };
+
+   // solvated.pdb is a helix with waters and ions in HETATM records, some
+   // of them without element column; lattice is the largest scene, with
+   // about 100000 atoms
+   const Scene SCENES[] =
+   {
+      { "helix",    0,              1,  7000.f },
+      { "bundle",   0,              7, 22000.f },
+      { "solvated", "solvated.pdb", 0,  9000.f },
+      { "lattice",  0,             10, 30000.f }
+   };
+   const int NB_SCENES = sizeof(SCENES)/sizeof(SCENES[0]);
+
+   /*
+   * @brief Camera relative to the scene distance
+   */
+   struct Camera
+   {
+      const char* name;
+      float distance;
+      float angleX;
+      float angleY;
+   };
+
+   const Camera CAMERAS[] =
+   {
+      { "front", 1.0f, 0.0f, 0.0f },
+      { "close", 0.5f, 0.3f, 0.6f },
+      { "far",   3.0f, 0.0f, 0.8f }
+   };
+   const int NB_CAMERAS = sizeof(CAMERAS)/sizeof(CAMERAS[0]);
+
+   /*
+   * @brief Measures of one camera of a scene. Times are the median of the
+   * runs, with their deviation, in ms. Runs are timed relative to the
+   * calibration loop that follows them, and converted back to ms with the
+   * median time of the loop.
+   */
+   struct Measures
+   {
+      double calibration;
+      double frameTime;
+      double frameDeviation;
+      double postTime;
+      double postDeviation;
+      double bytes;
+      double allocations;
+   };
+
+   typedef std::map<std::string, Measures> Baselines;
+
+   struct Options
+   {
+      std::string scene;
+      std::string dataDirectory;
+      std::string goldenDirectory;
+      std::string baselinesFile;
+      std::string workDirectory;
+      int iterations;
+      double timeSigmas;
+      bool update;
+   };
+
+   double getTime()
+   {
+#ifdef WIN32
+      LARGE_INTEGER counter, frequency;
+      QueryPerformanceCounter( &counter );
+      QueryPerformanceFrequency( &frequency );
+      return 1000.0*counter.QuadPart/frequency.QuadPart;
+#else
+      struct timespec now;
+      clock_gettime( CLOCK_MONOTONIC, &now );
+      return now.tv_sec*1000.0+now.tv_nsec/1000000.0;
+#endif
+   }
+
+   /*
+   * @brief Median and deviation of the given times. The times are sorted.
+   */
+   void getStatistics( std::vector<double>& times, std::vector<double>& deviations, double& median, double& deviation )
+   {
+      std::sort( times.begin(), times.end() );
+      size_t n = times.size();
+      median = (n%2) ? times[n/2] : (times[n/2-1]+times[n/2])*0.5;
+      deviations.resize( n );
+      for( size_t i(0); i<n; ++i ) deviations[i] = fabs(times[i]-median);
+      std::sort( deviations.begin(), deviations.end() );
+      deviation = MAD_TO_DEVIATION*((n%2) ? deviations[n/2] : (deviations[n/2-1]+deviations[n/2])*0.5);
+      deviation = std::max(deviation, median*MIN_RELATIVE_DEVIATION);
+   }
+
+   // --------------------------------------------------------------------------------
+   // Scenes
+   // --------------------------------------------------------------------------------
+
+   /*
+   * @brief Writes a B-DNA like double helix for each cell of the grid, 24
+   * base pairs each. Atoms are placed from a template of a nucleotide in
+   * cylindrical coordinates: radius and angle around the axis, in Angstroms
+   * and degrees, and rise along the axis.
+   */
+   bool writeHelices( const std::string& fileName, int helices )
+   {
+      struct TemplateAtom
+      {
+         const char* name;
+         const char* element;
+         float radius, angle, rise;
+      };
+      static const TemplateAtom NUCLEOTIDE[] =
+      {
+         { "P",   "P", 8.9f,  0.f,  0.0f }, { "OP1", "O", 9.9f, -6.f, -0.8f }, { "OP2", "O", 9.6f,  7.f,  0.9f },
+         { "O5'", "O", 7.9f,  7.f, -0.6f }, { "C5'", "C", 7.7f, 14.f, -0.2f }, { "C4'", "C", 7.8f, 22.f,  0.6f },
+         { "O4'", "O", 6.6f, 25.f,  0.9f }, { "C3'", "C", 8.6f, 27.f,  1.6f }, { "O3'", "O", 8.8f, 33.f,  2.8f },
+         { "C2'", "C", 7.6f, 33.f,  2.0f }, { "C1'", "C", 5.9f, 33.f,  1.3f }, { "N9",  "N", 4.6f, 40.f,  1.2f },
+         { "C8",  "C", 4.9f, 51.f,  1.1f }, { "N7",  "N", 3.9f, 60.f,  1.0f }, { "C5",  "C", 2.6f, 55.f,  1.1f },
+         { "C6",  "C", 1.3f, 70.f,  1.0f }, { "N6",  "N", 1.9f, 95.f,  0.9f }, { "N1",  "N", 0.4f, 40.f,  1.1f },
+         { "C2",  "C", 1.3f, 10.f,  1.2f }, { "N3",  "N", 2.5f, 20.f,  1.2f }, { "C4",  "C", 3.2f, 38.f,  1.2f }
+      };
+      static const int NB_TEMPLATE_ATOMS = sizeof(NUCLEOTIDE)/sizeof(NUCLEOTIDE[0]);
+      const int   BASE_PAIRS = 24;
+      const float TWIST      = 36.f;  // degrees per base pair
+      const float RISE       = 3.38f; // Angstroms per base pair
+      const float SPACING    = 24.f;  // between the axes of two helices
+      const float DEGREES    = 3.14159265f/180.f;
+
+      FILE* file = fopen( fileName.c_str(), "w" );
+      if( !file ) return false;
+      int serial(0);
+      int residue(0);
+      for( int cell(0); cell<helices*helices; ++cell )
+      {
+         float axisX = (cell%helices-(helices-1)*0.5f)*SPACING;
+         float axisY = (cell/helices-(helices-1)*0.5f)*SPACING;
+         float phase = 47.f*cell;
+         for( int strand(0); strand<2; ++strand )
+         {
+            // Strands are antiparallel, the second one shifted by the minor
+            // groove
+            char chain = static_cast<char>('A'+(2*cell+strand)%26);
+            for( int pair(0); pair<BASE_PAIRS; ++pair )
+            {
+               ++residue;
+               for( int i(0); i<NB_TEMPLATE_ATOMS; ++i )
+               {
+                  const TemplateAtom& atom = NUCLEOTIDE[i];
+                  float angle = phase+pair*TWIST+(strand ? 180.f+35.f-atom.angle : atom.angle);
+                  float z = pair*RISE+(strand ? -atom.rise : atom.rise)-BASE_PAIRS*RISE*0.5f;
+                  float x = axisX+atom.radius*cosf(angle*DEGREES);
+                  float y = axisY+atom.radius*sinf(angle*DEGREES);
+                  fprintf( file, "ATOM  %5d %-4s  DA %c%4d    %8.3f%8.3f%8.3f  1.00  0.00          %2s\n",
+                     ++serial%100000, atom.name, chain, residue%10000, x, z, y, atom.element );
+               }
+            }
+         }
+      }
+      fprintf( file, "END\n" );
+      fclose( file );
+      return true;
+   }
+
+   /*
+   * @brief Spheres of a molecule, scaled and centered as by the server
+   */
+   bool loadScene( const Scene& scene, const Options& options, std::vector<ReferenceSphere>& spheres, BoundingBox& bounds )
+   {
+      std::string fileName;
+      if( scene.fileName )
+      {
+         fileName = options.dataDirectory+"/"+scene.fileName;
+         FILE* file = fopen( fileName.c_str(), "r" );
+         if( !file )
+         {
+            printf( "FAILED %s: %s not found in %s\n", scene.name, scene.fileName, options.dataDirectory.c_str() );
+            return false;
+         }
+         fclose( file );
+      }
+      else
+      {
+         // Generated scenes go through the PDB reader as well
+         fileName = options.workDirectory+"/"+scene.name+".pdb";
+         if( !writeHelices( fileName, scene.helices ) )
+         {
+            printf( "FAILED %s: cannot write %s\n", scene.name, fileName.c_str() );
+            return false;
+         }
+      }
+
+      std::vector<PdbAtom> atoms;
+      if( !PdbReader::read( fileName, atoms ) || atoms.empty() )
+      {
+         printf( "FAILED %s: no atoms in %s\n", scene.name, fileName.c_str() );
+         return false;
+      }
+
+      float minimum[3] = {  FLT_MAX,  FLT_MAX,  FLT_MAX };
+      float maximum[3] = { -FLT_MAX, -FLT_MAX, -FLT_MAX };
+      float maxRadius(0.f);
+      spheres.resize( atoms.size() );
+      for( size_t i(0); i<atoms.size(); ++i )
+      {
+         ReferenceSphere& sphere = spheres[i];
+         sphere.x        = atoms[i].x*SCALE;
+         sphere.y        = atoms[i].y*SCALE;
+         sphere.z        = atoms[i].z*SCALE;
+         sphere.radius   = ATOM_SIZE*PdbReader::getRadius(atoms[i].element)/CARBON_RADIUS;
+         sphere.material = PdbReader::getMaterial(atoms[i].element);
+         minimum[0] = std::min(minimum[0], sphere.x); maximum[0] = std::max(maximum[0], sphere.x);
+         minimum[1] = std::min(minimum[1], sphere.y); maximum[1] = std::max(maximum[1], sphere.y);
+         minimum[2] = std::min(minimum[2], sphere.z); maximum[2] = std::max(maximum[2], sphere.z);
+         maxRadius = std::max(maxRadius, sphere.radius);
+      }
+
+      float center[3];
+      for( int axis(0); axis<3; ++axis ) center[axis] = (minimum[axis]+maximum[axis])*0.5f;
+      for( size_t i(0); i<spheres.size(); ++i )
+      {
+         spheres[i].x -= center[0];
+         spheres[i].y -= center[1];
+         spheres[i].z -= center[2];
+      }
+      BoundingBox box = {
+         { minimum[0]-center[0]-maxRadius, minimum[1]-center[1]-maxRadius, minimum[2]-center[2]-maxRadius },
+         { maximum[0]-center[0]+maxRadius, maximum[1]-center[1]+maxRadius, maximum[2]-center[2]+maxRadius } };
+      bounds = box;
+      printf( "%s: %d atoms\n", scene.name, static_cast<int>(spheres.size()) );
+      return true;
+   }
+
+   // --------------------------------------------------------------------------------
+   // Golden images and baselines
+   // --------------------------------------------------------------------------------
+
+   // Images are stored upright: frames start with the bottom right pixel
+   bool writeImage( const std::string& fileName, const std::vector<unsigned char>& frame, int width, int height )
+   {
+      FILE* file = fopen( fileName.c_str(), "wb" );
+      if( !file ) return false;
+      fprintf( file, "P6\n%d %d\n255\n", width, height );
+      int nbPixels = width*height;
+      for( int i(0); i<nbPixels; ++i )
+         fwrite( &frame[(nbPixels-1-i)*3], 1, 3, file );
+      fclose( file );
+      return true;
+   }
+
+   bool readImage( const std::string& fileName, std::vector<unsigned char>& frame, int& width, int& height )
+   {
+      FILE* file = fopen( fileName.c_str(), "rb" );
+      if( !file ) return false;
+      int maximum(0);
+      bool valid = fscanf( file, "P6 %d %d %d", &width, &height, &maximum ) == 3 && maximum == 255 && fgetc( file ) != EOF;
+      int nbPixels = valid ? width*height : 0;
+      frame.resize( nbPixels*3 );
+      for( int i(0); i<nbPixels && valid; ++i )
+         valid = fread( &frame[(nbPixels-1-i)*3], 1, 3, file ) == 3;
+      fclose( file );
+      return valid;
+   }
+
+   bool readBaselines( const std::string& fileName, Baselines& baselines )
+   {
+      FILE* file = fopen( fileName.c_str(), "r" );
+      if( !file ) return false;
+      char line[256];
+      while( fgets( line, sizeof(line), file ) )
+      {
+         char scene[64], camera[64];
+         Measures measures;
+         if( line[0] == '#' ) continue;
+         if( sscanf( line, "%63s %63s %lf %lf %lf %lf %lf %lf %lf", scene, camera, &measures.calibration,
+            &measures.frameTime, &measures.frameDeviation, &measures.postTime, &measures.postDeviation,
+            &measures.bytes, &measures.allocations ) == 9 )
+            baselines[std::string(scene)+" "+camera] = measures;
+      }
+      fclose( file );
+      return true;
+   }
+
+   bool writeBaselines( const std::string& fileName, const Baselines& baselines )
+   {
+      FILE* file = fopen( fileName.c_str(), "w" );
+      if( !file ) return false;
+      fprintf( file, "# Performance baselines of the benchmark, recorded with --update\n" );
+      fprintf( file, "# scene camera calibration(ms) frameTime(ms) frameDeviation(ms) postTime(ms) postDeviation(ms) bytes allocations\n" );
+      for( Baselines::const_iterator it = baselines.begin(); it != baselines.end(); ++it )
+      {
+         const Measures& m = it->second;
+         fprintf( file, "%s %.3f %.3f %.3f %.3f %.3f %.0f %.0f\n", it->first.c_str(), m.calibration,
+            m.frameTime, m.frameDeviation, m.postTime, m.postDeviation, m.bytes, m.allocations );
+      }
+      fclose( file );
+      return true;
+   }
+
+   /*
+   * @brief Returns the number of pixels that differ from the golden image by
+   * more than the tolerance, or -1 when the sizes differ
+   */
+   int compareImages( const std::vector<unsigned char>& image, const std::vector<unsigned char>& golden )
+   {
+      if( image.size() != golden.size() ) return -1;
+      int different(0);
+      for( size_t i(0); i<image.size(); i+=3 )
+      {
+         for( int c(0); c<3; ++c )
+         {
+            if( abs(image[i+c]-golden[i+c]) > PIXEL_TOLERANCE )
+            {
+               ++different;
+               break;
+            }
+         }
+      }
+      return different;
+   }
+
+   // --------------------------------------------------------------------------------
+   // Frames
+   // --------------------------------------------------------------------------------
+
+   /*
+   * @brief Renders and encodes the frame of a camera, as a view of the HTTP
+   * server does: macroblocks of the tiles that cannot show the molecule are
+   * encoded as constant. Post processing is measured separately, on a copy
+   * of the frame, since it would break the constant macroblocks.
+   */
+   class FrameBenchmark
+   {
+
+   public:
+
+      FrameBenchmark( const std::vector<ReferenceSphere>& spheres, const BoundingBox& bounds ) :
+         spheres_(spheres),
+         boxes_(1, bounds),
+         pass_(0)
+      {
+         memset( &settings_, 0, sizeof(settings_) );
+         settings_.denoise      = true;
+         settings_.toneMapping  = true;
+         settings_.antiAliasing = true;
+         settings_.iterations   = 1;
+         settings_.exposure     = 1.f;
+         settings_.whitePoint   = 1.f;
+         memset( &timings_, 0, sizeof(timings_) );
+      }
+
+   public:
+
+      void run( const CameraModel& camera, int iterations, Measures& measures )
+      {
+         // Sized before the runs, so that storing times does not allocate
+         frameTimes_.resize( iterations );
+         postTimes_.resize( iterations );
+         calibrationTimes_.resize( iterations );
+         calibration_.assign( CALIBRATION_SIZE, 1.f );
+
+         // The first frame sizes the buffers, and is not measured
+         for( int i(-1); i<iterations; ++i )
+         {
+            long allocations = gAllocations;
+            double start = getTime();
+            renderer_.render( spheres_, camera, WIDTH, HEIGHT, BACKGROUND, frame_ );
+            encode( camera );
+            double frameTime = getTime()-start;
+
+            post_ = frame_;
+            start = getTime();
+            postProcessor_.process( settings_, &post_[0], WIDTH, HEIGHT, &renderer_.getDepth()[0], timings_ );
+            double postTime = getTime()-start;
+            double calibrationTime = calibrate();
+
+            if( i < 0 ) continue;
+            frameTimes_[i]       = frameTime/calibrationTime;
+            postTimes_[i]        = postTime/calibrationTime;
+            calibrationTimes_[i] = calibrationTime;
+            measures.bytes       = static_cast<double>(jpeg_.size());
+            measures.allocations = static_cast<double>(gAllocations-allocations);
+         }
+         double deviation;
+         getStatistics( calibrationTimes_, deviations_, measures.calibration, deviation );
+         getStatistics( frameTimes_, deviations_, measures.frameTime, measures.frameDeviation );
+         getStatistics( postTimes_, deviations_, measures.postTime, measures.postDeviation );
+         measures.frameTime      *= measures.calibration;
+         measures.frameDeviation *= measures.calibration;
+         measures.postTime       *= measures.calibration;
+         measures.postDeviation  *= measures.calibration;
+      }
+
+      const std::vector<unsigned char>& getFrame() const { return frame_; }
+
+   private:
+
+      /*
+      * @brief Fixed amount of arithmetic and memory accesses: frequency
+      * scaling and other processes slow it down as much as the frame it
+      * follows. Returns its time in ms.
+      */
+      double calibrate()
+      {
+         double start = getTime();
+         for( int pass(0); pass<CALIBRATION_PASSES; ++pass )
+         {
+            for( int i(0); i<CALIBRATION_SIZE; ++i )
+               calibration_[i] = sqrtf(calibration_[i]*0.5f+pass);
+         }
+         double time = getTime()-start;
+         gCalibrationSink += calibration_[pass_++%CALIBRATION_SIZE];
+         return time;
+      }
+
+      void encode( const CameraModel& camera )
+      {
+         mask_.compute( boxes_, camera, WIDTH, HEIGHT, TILE_SIZE );
+
+         // Encoded images are rotated by 180 degrees
+         int macroblocksX = (WIDTH+15)/16;
+         int macroblocksY = (HEIGHT+15)/16;
+         constantMacroblocks_.resize( macroblocksX*macroblocksY );
+         for( int y(0); y<macroblocksY; ++y )
+         {
+            for( int x(0); x<macroblocksX; ++x )
+            {
+               int x0 = WIDTH-std::min(x*16+16, WIDTH);
+               int y0 = HEIGHT-std::min(y*16+16, HEIGHT);
+               constantMacroblocks_[y*macroblocksX+x] = mask_.isEmpty( x0, y0, WIDTH-x*16, HEIGHT-y*16 ) ? 1 : 0;
+            }
+         }
+
+         image_.resize( frame_.size() );
+         int nbPixels = WIDTH*HEIGHT;
+         for( int i(0); i<nbPixels; ++i )
+            memcpy( &image_[i*3], &frame_[(nbPixels-1-i)*3], 3 );
+         encoder_.encode( &image_[0], WIDTH, HEIGHT, QUALITY, jpeg_, &constantMacroblocks_[0] );
+      }
+
+   private:
+
+      const std::vector<ReferenceSphere>& spheres_;
+      std::vector<BoundingBox> boxes_;
+      ReferenceRenderer renderer_;
+      TileMask mask_;
+      JpegEncoder encoder_;
+      PostProcessor postProcessor_;
+      PostProcessorSettings settings_;
+      PostProcessorTimings timings_;
+
+      std::vector<unsigned char> frame_;
+      std::vector<unsigned char> image_;
+      std::vector<unsigned char> post_;
+      std::vector<unsigned char> constantMacroblocks_;
+      std::vector<unsigned char> jpeg_;
+      std::vector<double> frameTimes_;
+      std::vector<double> postTimes_;
+      std::vector<double> deviations_;
+      std::vector<double> calibrationTimes_;
+      std::vector<float> calibration_;
+      int pass_;
+
+   };
+
+   // --------------------------------------------------------------------------------
+   // Checks
+   // --------------------------------------------------------------------------------
+
+   /*
+   * @brief Checks a camera of a scene, or records its golden image and
+   * baselines. Returns the number of failed checks.
+   */
+   int checkCamera(
+      const Scene& scene, const Camera& camera,
+      const std::vector<ReferenceSphere>& spheres, const BoundingBox& bounds,
+      const Options& options, Baselines& baselines )
+   {
+      float distance = scene.distance*camera.distance;
+      CameraVector eye       = { 0.f, 0.f, -distance };
+      CameraVector direction = { 0.f, 0.f, PLANE_DISTANCE-distance };
+      CameraVector angles    = { camera.angleX, camera.angleY, 0.f };
+      CameraModel model( eye, direction, angles, WIDTH, HEIGHT, PIXEL_PITCH );
+
+      FrameBenchmark benchmark( spheres, bounds );
+      Measures measures;
+      benchmark.run( model, options.iterations, measures );
+
+      std::string name = std::string(scene.name)+" "+camera.name;
+      std::string goldenFile = options.goldenDirectory+"/"+scene.name+"_"+camera.name+".ppm";
+      printf( "%-16s calibration %6.3f ms  frame %8.3f +- %6.3f ms  post %7.3f +- %6.3f ms  %6.0f bytes  %2.0f allocations\n",
+         name.c_str(), measures.calibration, measures.frameTime, measures.frameDeviation,
+         measures.postTime, measures.postDeviation, measures.bytes, measures.allocations );
+
+      if( options.update )
+      {
+         baselines[name] = measures;
+         if( writeImage( goldenFile, benchmark.getFrame(), WIDTH, HEIGHT ) ) return 0;
+         printf( "FAILED %s: cannot write %s\n", name.c_str(), goldenFile.c_str() );
+         return 1;
+      }
+
+      int failures(0);
+      std::vector<unsigned char> golden;
+      int goldenWidth, goldenHeight;
+      if( !readImage( goldenFile, golden, goldenWidth, goldenHeight ) )
+      {
+         printf( "FAILED %s: no golden image %s, run with --update to record it\n", name.c_str(), goldenFile.c_str() );
+         ++failures;
+      }
+      else
+      {
+         int different = compareImages( benchmark.getFrame(), golden );
+         if( different < 0 || different > MAX_DIFFERENT_PIXELS*WIDTH*HEIGHT )
+         {
+            printf( "FAILED %s: %d pixels differ from %s\n", name.c_str(), different, goldenFile.c_str() );
+            writeImage( options.workDirectory+"/"+scene.name+"_"+camera.name+".ppm", benchmark.getFrame(), WIDTH, HEIGHT );
+            ++failures;
+         }
+      }
+
+      Baselines::const_iterator it = baselines.find(name);
+      if( it == baselines.end() )
+      {
+         printf( "FAILED %s: no baseline, run with --update to record it\n", name.c_str() );
+         return failures+1;
+      }
+      // Times at the speed the machine had when the baseline was recorded
+      const Measures& baseline = it->second;
+      double speed = baseline.calibration/measures.calibration;
+      double frameTime = measures.frameTime*speed;
+      double frameDeviation = measures.frameDeviation*speed;
+      double frameLimit = baseline.frameTime+options.timeSigmas*
+         sqrt(baseline.frameDeviation*baseline.frameDeviation+frameDeviation*frameDeviation);
+      if( frameTime > frameLimit )
+      {
+         printf( "REGRESSION %s: frame time %.3f ms, baseline %.3f ms, limit %.3f ms\n",
+            name.c_str(), frameTime, baseline.frameTime, frameLimit );
+         ++failures;
+      }
+      double postTime = measures.postTime*speed;
+      double postDeviation = measures.postDeviation*speed;
+      double postLimit = baseline.postTime+options.timeSigmas*
+         sqrt(baseline.postDeviation*baseline.postDeviation+postDeviation*postDeviation);
+      if( postTime > postLimit )
+      {
+         printf( "REGRESSION %s: post processing time %.3f ms, baseline %.3f ms, limit %.3f ms\n",
+            name.c_str(), postTime, baseline.postTime, postLimit );
+         ++failures;
+      }
+      if( measures.bytes > baseline.bytes*(1.0+BYTES_TOLERANCE) )
+      {
+         printf( "REGRESSION %s: %.0f bytes per frame, baseline %.0f\n", name.c_str(), measures.bytes, baseline.bytes );
+         ++failures;
+      }
+      if( measures.allocations > baseline.allocations )
+      {
+         printf( "REGRESSION %s: %.0f allocations per frame, baseline %.0f\n", name.c_str(), measures.allocations, baseline.allocations );
+         ++failures;
+      }
+      return failures;
+   }
+
+   bool parseOptions( int argc, char* argv[], Options& options )
+   {
+      options.dataDirectory   = "./pdb";
+      options.goldenDirectory = "./Golden";
+      options.baselinesFile   = "./Baselines.txt";
+      options.workDirectory   = ".";
+      options.iterations      = 21;
+      options.timeSigmas      = 3.0;
+      options.update          = false;
+      for( int i(1); i<argc; ++i )
+      {
+         std::string option(argv[i]);
+         bool hasValue = (i+1 < argc);
+         if( option == "--update" ) options.update = true;
+         else if( option == "--scene" && hasValue ) options.scene = argv[++i];
+         else if( option == "--data" && hasValue ) options.dataDirectory = argv[++i];
+         else if( option == "--golden" && hasValue ) options.goldenDirectory = argv[++i];
+         else if( option == "--baselines" && hasValue ) options.baselinesFile = argv[++i];
+         else if( option == "--work" && hasValue ) options.workDirectory = argv[++i];
+         else if( option == "--iterations" && hasValue ) options.iterations = std::max(1, atoi(argv[++i]));
+         else if( option == "--time-sigmas" && hasValue ) options.timeSigmas = atof(argv[++i]);
+         else
+         {
+            printf( "Unknown option %s\n", argv[i] );
+            return false;
+         }
+      }
+      return true;
+   }
+}
+
+int main( int argc, char* argv[] )
+{
+   Options options;
+   if( !parseOptions( argc, argv, options ) ) return 1;
+
+   Baselines baselines;
+   if( !readBaselines( options.baselinesFile, baselines ) && !options.update )
+      printf( "No baselines in %s\n", options.baselinesFile.c_str() );
+
+   int failures(0);
+   int nbScenes(0);
+   for( int s(0); s<NB_SCENES; ++s )
+   {
+      const Scene& scene = SCENES[s];
+      if( !options.scene.empty() && options.scene != scene.name ) continue;
+
+      std::vector<ReferenceSphere> spheres;
+      BoundingBox bounds;
+      if( !loadScene( scene, options, spheres, bounds ) )
+      {
+         ++failures;
+         continue;
+      }
+      ++nbScenes;
+      for( int c(0); c<NB_CAMERAS; ++c )
+         failures += checkCamera( scene, CAMERAS[c], spheres, bounds, options, baselines );
+   }
+
+   if( options.update && nbScenes > 0 && !writeBaselines( options.baselinesFile, baselines ) )
+   {
+      printf( "FAILED: cannot write %s\n", options.baselinesFile.c_str() );
+      ++failures;
+   }
+
+   if( nbScenes == 0 && failures == 0 )
+   {
+      printf( "FAILED: no scene named %s\n", options.scene.c_str() );
+      ++failures;
+   }
+   if( failures > 0 )
+   {
+      printf( "%d check(s) FAILED\n", failures );
+      return 1;
+   }
+   printf( "All checks passed\n" );
+   return 0;
+}
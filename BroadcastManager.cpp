@@ -0,0 +1,411 @@
+// System
+#include <algorithm>
+
+// Project
+#include "Trace.h"
+#include "BroadcastManager.h"
+
+namespace
+{
+   // Coarsest tier, 1/8 of the resolution, like progressive frames
+   const int MAX_TIER = 3;
+
+   // Longest time a viewer request waits for a frame, in ms
+   const int MAX_WAIT = 1000;
+
+   // Tiers that no viewer asked for during that time are no longer encoded,
+   // in ms
+   const int TIER_IDLE_TIME = 5000;
+
+   void throwUnavailable( const std::string& reason )
+   {
+      ::IceStreamer::ChannelUnavailable e;
+      e.reason = reason;
+      throw e;
+   }
+}
+
+BroadcastChannel::BroadcastChannel(
+   const std::string& name, const SessionPtr& presenter, BroadcastSource& source,
+   RenderBackendPool& pool, int frameTime, int presenterTimeout ) :
+   name_(name),
+   id_("broadcast:"+name),
+   presenter_(presenter),
+   source_(source),
+   pool_(pool),
+   frameTime_(frameTime),
+   presenterTimeout_(IceUtil::Time::seconds(presenterTimeout)),
+   stopped_(false),
+   sequence_(0),
+   width_(0),
+   height_(0),
+   tiers_(MAX_TIER+1)
+{
+}
+
+void BroadcastChannel::destroy()
+{
+   Lock lock(*this);
+   stopped_ = true;
+   notifyAll();
+}
+
+bool BroadcastChannel::isStopped()
+{
+   Lock lock(*this);
+   return stopped_;
+}
+
+bool BroadcastChannel::isPresenterExpired() const
+{
+   // Every call of the presenter, input events included, touches its session
+   return IceUtil::Time::now(IceUtil::Time::Monotonic)-presenter_->getLastAccess() > presenterTimeout_;
+}
+
+void BroadcastChannel::getFrame(
+   const ::IceStreamer::AMD_BitmapProvider_getBroadcastFramePtr& cb,
+   int tier, Ice::Long lastSequence )
+{
+   tier = std::max(0, std::min(tier, MAX_TIER));
+   SharedBroadcastFramePtr frame;
+   {
+      Lock lock(*this);
+      if( !stopped_ )
+      {
+         IceUtil::Time now = IceUtil::Time::now(IceUtil::Time::Monotonic);
+         tiers_[tier].lastRequest = now;
+         frame = getFrameLocked( tier, lastSequence );
+         if( !frame )
+         {
+            // Answered by the channel thread
+            Waiter waiter = { cb, tier, lastSequence, now+IceUtil::Time::milliSeconds(MAX_WAIT) };
+            waiters_.push_back( waiter );
+            return;
+         }
+      }
+   }
+
+   if( frame )
+   {
+      cb->ice_response( frame->frame );
+   }
+   else
+   {
+      ::IceStreamer::ChannelUnavailable e;
+      e.reason = "Channel " + name_ + " is closed";
+      cb->ice_exception( e );
+   }
+}
+
+void BroadcastChannel::run()
+{
+   APPL_LOG_INFO("Channel " << name_ << " started");
+   Ice::Long lastKey(0);
+   int lastSceneVersion(-1);
+   ::IceStreamer::bytes frame;
+   while( true )
+   {
+      IceUtil::Time start = IceUtil::Time::now(IceUtil::Time::Monotonic);
+      bool active(false);
+      {
+         Lock lock(*this);
+         if( !stopped_ && isPresenterExpired() )
+         {
+            APPL_LOG_INFO("Presenter of channel " << name_ << " expired");
+            stopped_ = true;
+         }
+         if( stopped_ ) break;
+
+         // Nothing is rendered while nobody watches
+         for( size_t i(0); i<tiers_.size(); ++i )
+         {
+            const IceUtil::Time& lastRequest = tiers_[i].lastRequest;
+            if( lastRequest != IceUtil::Time() && start-lastRequest < IceUtil::Time::milliSeconds(TIER_IDLE_TIME) ) active = true;
+         }
+      }
+
+      if( active )
+      {
+         try
+         {
+            Ice::Long key;
+            int sceneVersion, width, height;
+            source_.renderBroadcast( presenter_, id_, frame, width, height, key, sceneVersion );
+            if( (key != lastKey || sceneVersion != lastSceneVersion) && frame.size() == static_cast<size_t>(width*height*3) )
+            {
+               publish( frame, width, height );
+               lastKey          = key;
+               lastSceneVersion = sceneVersion;
+            }
+         }
+         catch( ... )
+         {
+            APPL_LOG_ERROR("Channel " << name_ << " failed to render");
+         }
+      }
+
+      // Requests that got a frame or waited long enough
+      std::list<Response> responses;
+      {
+         Lock lock(*this);
+         collectResponses( IceUtil::Time::now(IceUtil::Time::Monotonic), responses );
+      }
+      respond( responses );
+
+      // Next frame, unless the channel is stopped in the meantime
+      Lock lock(*this);
+      IceUtil::Time next = start+IceUtil::Time::milliSeconds(frameTime_);
+      IceUtil::Time now = IceUtil::Time::now(IceUtil::Time::Monotonic);
+      while( !stopped_ && now < next )
+      {
+         timedWait(next-now);
+         now = IceUtil::Time::now(IceUtil::Time::Monotonic);
+      }
+   }
+
+   // Viewers still waiting learn that the channel is gone
+   std::list<Waiter> waiters;
+   Ice::Long sequence;
+   {
+      Lock lock(*this);
+      waiters.swap( waiters_ );
+      sequence = sequence_;
+   }
+   for( std::list<Waiter>::const_iterator it = waiters.begin(); it != waiters.end(); ++it )
+   {
+      ::IceStreamer::ChannelUnavailable e;
+      e.reason = "Channel " + name_ + " is closed";
+      it->cb->ice_exception( e );
+   }
+   pool_.releaseSession( id_ );
+   APPL_LOG_INFO("Channel " << name_ << " stopped after " << sequence << " frames");
+}
+
+void BroadcastChannel::publish( ::IceStreamer::bytes& frame, int width, int height )
+{
+   // Tiers are encoded outside the lock, from the frames viewers got last
+   Ice::Long sequence;
+   std::vector<SharedBroadcastFramePtr> previous( tiers_.size() );
+   std::vector<bool> active( tiers_.size(), false );
+   {
+      Lock lock(*this);
+      sequence = sequence_+1;
+      IceUtil::Time now = IceUtil::Time::now(IceUtil::Time::Monotonic);
+      for( size_t i(0); i<tiers_.size(); ++i )
+      {
+         const IceUtil::Time& lastRequest = tiers_[i].lastRequest;
+         active[i] = lastRequest != IceUtil::Time() && now-lastRequest < IceUtil::Time::milliSeconds(TIER_IDLE_TIME);
+         previous[i] = tiers_[i].keyframe;
+      }
+   }
+
+   std::vector<SharedBroadcastFramePtr> keyframes( tiers_.size() );
+   std::vector<SharedBroadcastFramePtr> deltas( tiers_.size() );
+   for( size_t i(0); i<tiers_.size(); ++i )
+   {
+      if( !active[i] ) continue;
+      keyframes[i] = encodeKeyframe( frame, width, height, sequence, static_cast<int>(i) );
+      deltas[i]    = encodeDelta( previous[i], keyframes[i] );
+   }
+
+   // Tiers that were not encoded are sampled on demand
+   Lock lock(*this);
+   sequence_ = sequence;
+   frame_.swap( frame );
+   width_    = width;
+   height_   = height;
+   for( size_t i(0); i<tiers_.size(); ++i )
+   {
+      tiers_[i].keyframe = keyframes[i];
+      tiers_[i].delta    = deltas[i];
+   }
+}
+
+SharedBroadcastFramePtr BroadcastChannel::getFrameLocked( int tier, Ice::Long lastSequence )
+{
+   // Viewers ahead of the channel watched a former channel of the same
+   // name, and get a keyframe like new ones
+   if( sequence_ == 0 || sequence_ == lastSequence ) return 0;
+   Tier& state = tiers_[tier];
+   if( !state.keyframe )
+   {
+      state.keyframe = encodeKeyframe( frame_, width_, height_, sequence_, tier );
+      state.delta    = 0;
+   }
+   if( state.delta && lastSequence == sequence_-1 ) return state.delta;
+   return state.keyframe;
+}
+
+void BroadcastChannel::collectResponses( const IceUtil::Time& now, std::list<Response>& responses )
+{
+   std::list<Waiter>::iterator it = waiters_.begin();
+   while( it != waiters_.end() )
+   {
+      SharedBroadcastFramePtr frame = getFrameLocked( it->tier, it->lastSequence );
+      if( frame || now >= it->deadline )
+      {
+         Response response = { it->cb, frame, it->tier, it->lastSequence };
+         responses.push_back( response );
+         waiters_.erase( it++ );
+      }
+      else
+      {
+         ++it;
+      }
+   }
+}
+
+SharedBroadcastFramePtr BroadcastChannel::encodeKeyframe(
+   const ::IceStreamer::bytes& frame, int width, int height, Ice::Long sequence, int tier )
+{
+   int scale = 1<<tier;
+   SharedBroadcastFramePtr keyframe = new SharedBroadcastFrame();
+   ::IceStreamer::BroadcastFrame& result = keyframe->frame;
+   result.sequence = sequence;
+   result.tier     = tier;
+   result.width    = (width+scale-1)/scale;
+   result.height   = (height+scale-1)/scale;
+   result.keyframe = true;
+   result.pixels.resize( result.width*result.height*3 );
+   for( int y(0); y<result.height; ++y )
+   {
+      const Ice::Byte* row = &frame[y*scale*width*3];
+      Ice::Byte* pixel = &result.pixels[y*result.width*3];
+      for( int x(0); x<result.width; ++x, pixel+=3 )
+      {
+         const Ice::Byte* source = row+x*scale*3;
+         pixel[0] = source[0];
+         pixel[1] = source[1];
+         pixel[2] = source[2];
+      }
+   }
+   return keyframe;
+}
+
+SharedBroadcastFramePtr BroadcastChannel::encodeDelta( const SharedBroadcastFramePtr& previous, const SharedBroadcastFramePtr& keyframe )
+{
+   // Only from the frame right before, of the same size
+   if( !previous ) return 0;
+   const ::IceStreamer::BroadcastFrame& from = previous->frame;
+   const ::IceStreamer::BroadcastFrame& to   = keyframe->frame;
+   if( from.sequence != to.sequence-1 || from.width != to.width || from.height != to.height ) return 0;
+
+   SharedBroadcastFramePtr delta = new SharedBroadcastFrame();
+   ::IceStreamer::BroadcastFrame& result = delta->frame;
+   result          = to;
+   result.keyframe = false;
+   for( size_t i(0); i<result.pixels.size(); ++i )
+      result.pixels[i] = static_cast< ::Ice::Byte>(to.pixels[i]-from.pixels[i]);
+   return delta;
+}
+
+void BroadcastChannel::respond( const std::list<Response>& responses )
+{
+   for( std::list<Response>::const_iterator it = responses.begin(); it != responses.end(); ++it )
+   {
+      if( it->frame )
+      {
+         it->cb->ice_response( it->frame->frame );
+         continue;
+      }
+
+      // No new frame in time, the viewer asks again
+      ::IceStreamer::BroadcastFrame empty;
+      empty.sequence = it->lastSequence;
+      empty.tier     = it->tier;
+      empty.width    = 0;
+      empty.height   = 0;
+      empty.keyframe = false;
+      it->cb->ice_response( empty );
+   }
+}
+
+BroadcastManager::BroadcastManager( RenderBackendPool& pool, int maxChannels, int frameTime, int presenterTimeout ) :
+   pool_(pool),
+   maxChannels_(maxChannels),
+   frameTime_(frameTime),
+   presenterTimeout_(presenterTimeout),
+   destroyed_(false)
+{
+}
+
+void BroadcastManager::present( const std::string& name, const SessionPtr& presenter, BroadcastSource& source )
+{
+   IceUtil::Mutex::Lock lock(mutex_);
+   if( destroyed_ ) throwUnavailable( "Server is shutting down" );
+   removeStoppedChannels();
+
+   std::map<std::string, BroadcastChannelPtr>::iterator it = channels_.find(name);
+   if( it != channels_.end() )
+   {
+      if( it->second->getPresenter().get() == presenter.get() ) return;
+      if( !it->second->isPresenterExpired() ) throwUnavailable( "Channel " + name + " is presented by another session" );
+
+      // Taken over from a presenter that left
+      it->second->destroy();
+      it->second->getThreadControl().join();
+      channels_.erase( it );
+   }
+   if( static_cast<int>(channels_.size()) >= maxChannels_ ) throwUnavailable( "Too many channels" );
+
+   BroadcastChannelPtr channel = new BroadcastChannel( name, presenter, source, pool_, frameTime_, presenterTimeout_ );
+   channel->start();
+   channels_[name] = channel;
+   APPL_LOG_INFO("Channel " << name << " opened (" << channels_.size() << " channels)");
+}
+
+void BroadcastManager::close( const std::string& name, const SessionPtr& presenter )
+{
+   IceUtil::Mutex::Lock lock(mutex_);
+   std::map<std::string, BroadcastChannelPtr>::iterator it = channels_.find(name);
+   if( it == channels_.end() ) return;
+   if( it->second->getPresenter().get() != presenter.get() )
+   {
+      APPL_LOG_WARNING("Channel " << name << " can only be closed by its presenter");
+      return;
+   }
+   it->second->destroy();
+   it->second->getThreadControl().join();
+   channels_.erase( it );
+}
+
+BroadcastChannelPtr BroadcastManager::find( const std::string& name )
+{
+   IceUtil::Mutex::Lock lock(mutex_);
+   std::map<std::string, BroadcastChannelPtr>::iterator it = channels_.find(name);
+   if( it == channels_.end() || it->second->isStopped() ) return 0;
+   return it->second;
+}
+
+void BroadcastManager::destroy()
+{
+   std::map<std::string, BroadcastChannelPtr> channels;
+   {
+      IceUtil::Mutex::Lock lock(mutex_);
+      destroyed_ = true;
+      channels.swap( channels_ );
+   }
+
+   for( std::map<std::string, BroadcastChannelPtr>::iterator it = channels.begin(); it != channels.end(); ++it )
+      it->second->destroy();
+   for( std::map<std::string, BroadcastChannelPtr>::iterator it = channels.begin(); it != channels.end(); ++it )
+      it->second->getThreadControl().join();
+}
+
+void BroadcastManager::removeStoppedChannels()
+{
+   // Channels of expired presenters stop by themselves
+   std::map<std::string, BroadcastChannelPtr>::iterator it = channels_.begin();
+   while( it != channels_.end() )
+   {
+      if( it->second->isStopped() )
+      {
+         it->second->getThreadControl().join();
+         channels_.erase( it++ );
+      }
+      else
+      {
+         ++it;
+      }
+   }
+}
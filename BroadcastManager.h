@@ -0,0 +1,207 @@
+#pragma once
+
+// System
+#include <list>
+#include <map>
+#include <string>
+#include <vector>
+
+// Ice
+#include <IceUtil/Thread.h>
+#include <IceUtil/Monitor.h>
+#include <IceUtil/Shared.h>
+#include <IceUtil/Time.h>
+
+// Project
+#include "IIceStreamer.h"
+#include "RenderBackendPool.h"
+#include "SessionManager.h"
+
+/*
+* @brief Renders the frames of broadcast channels, from the latest camera and
+* settings of the presenter
+*/
+class BroadcastSource
+{
+
+public:
+
+   virtual ~BroadcastSource() {}
+
+   /**
+   * @brief Renders the current view of the presenter. channelId is the
+   * session the backends are assigned to. Frames of the same view and scene
+   * version have the same key.
+   */
+   virtual void renderBroadcast(
+      const SessionPtr& presenter, const std::string& channelId,
+      ::IceStreamer::bytes& frame, int& width, int& height,
+      Ice::Long& key, int& sceneVersion ) = 0;
+
+};
+
+/*
+* @brief Frame of a tier, shared by all the viewers it is sent to. Frames are
+* never modified once published, so they are sent without holding any lock.
+*/
+class SharedBroadcastFrame : public IceUtil::Shared
+{
+
+public:
+
+   ::IceStreamer::BroadcastFrame frame;
+
+};
+
+typedef IceUtil::Handle<SharedBroadcastFrame> SharedBroadcastFramePtr;
+
+/*
+* @brief Renders a presenter's view once for all the viewers of a channel.
+* Each frame is sampled and delta encoded once per tier, for the tiers that
+* viewers asked for recently only. Viewer requests are answered asynchronously:
+* they wait for the next frame without holding a server thread, and viewers
+* that are not at the previous frame get a keyframe, so that a slow viewer
+* skips frames instead of holding the others back.
+* The channel stops when it is closed, or when the session of its presenter
+* has been idle for longer than the presenter timeout.
+*/
+class BroadcastChannel : public IceUtil::Thread, public IceUtil::Monitor<IceUtil::Mutex>
+{
+
+public:
+
+   BroadcastChannel(
+      const std::string& name, const SessionPtr& presenter, BroadcastSource& source,
+      RenderBackendPool& pool, int frameTime, int presenterTimeout );
+
+public:
+
+   virtual void run();
+   void destroy();
+
+public:
+
+   const SessionPtr& getPresenter() const { return presenter_; }
+
+   bool isStopped();
+   bool isPresenterExpired() const;
+
+   /**
+   * @brief Answers the request with the latest frame of the tier once it is
+   * more recent than lastSequence
+   */
+   void getFrame(
+      const ::IceStreamer::AMD_BitmapProvider_getBroadcastFramePtr& cb,
+      int tier, Ice::Long lastSequence );
+
+private:
+
+   struct Waiter
+   {
+      ::IceStreamer::AMD_BitmapProvider_getBroadcastFramePtr cb;
+      int tier;
+      Ice::Long lastSequence;
+      IceUtil::Time deadline;
+   };
+
+   struct Tier
+   {
+      IceUtil::Time lastRequest;
+      SharedBroadcastFramePtr keyframe;
+      SharedBroadcastFramePtr delta;
+   };
+
+   struct Response
+   {
+      ::IceStreamer::AMD_BitmapProvider_getBroadcastFramePtr cb;
+      SharedBroadcastFramePtr frame;
+      int tier;
+      Ice::Long lastSequence;
+   };
+
+private:
+
+   // The frame is swapped with the previous one
+   void publish( ::IceStreamer::bytes& frame, int width, int height );
+
+   // Must be called with the lock held
+   SharedBroadcastFramePtr getFrameLocked( int tier, Ice::Long lastSequence );
+   void collectResponses( const IceUtil::Time& now, std::list<Response>& responses );
+
+   // Tier T samples every 2^T-th pixel of the frame in both directions
+   static SharedBroadcastFramePtr encodeKeyframe(
+      const ::IceStreamer::bytes& frame, int width, int height, Ice::Long sequence, int tier );
+   static SharedBroadcastFramePtr encodeDelta( const SharedBroadcastFramePtr& previous, const SharedBroadcastFramePtr& keyframe );
+   static void respond( const std::list<Response>& responses );
+
+private:
+
+   std::string name_;
+   std::string id_;
+   SessionPtr presenter_;
+   BroadcastSource& source_;
+   RenderBackendPool& pool_;
+   int frameTime_;
+   IceUtil::Time presenterTimeout_;
+
+   bool stopped_;
+   Ice::Long sequence_;
+   ::IceStreamer::bytes frame_;
+   int width_;
+   int height_;
+   std::vector<Tier> tiers_;
+   std::list<Waiter> waiters_;
+
+};
+
+typedef IceUtil::Handle<BroadcastChannel> BroadcastChannelPtr;
+
+/*
+* @brief Broadcast channels of the server, by name. A channel belongs to the
+* session that presents it, and is taken over by another session once the
+* session of its presenter has expired.
+*/
+class BroadcastManager
+{
+
+public:
+
+   BroadcastManager( RenderBackendPool& pool, int maxChannels, int frameTime, int presenterTimeout );
+
+public:
+
+   /**
+   * @brief Opens a channel presented by the given session. Raises
+   * ChannelUnavailable when another session presents it, or when the
+   * maximum number of channels is reached.
+   */
+   void present( const std::string& name, const SessionPtr& presenter, BroadcastSource& source );
+   void close( const std::string& name, const SessionPtr& presenter );
+
+   /**
+   * @brief Returns the running channel with the given name, null if none
+   */
+   BroadcastChannelPtr find( const std::string& name );
+
+   /**
+   * @brief Stops all channels and waits for their threads
+   */
+   void destroy();
+
+private:
+
+   // Must be called with the lock held
+   void removeStoppedChannels();
+
+private:
+
+   RenderBackendPool& pool_;
+   int maxChannels_;
+   int frameTime_;
+   int presenterTimeout_;
+
+   IceUtil::Mutex mutex_;
+   bool destroyed_;
+   std::map<std::string, BroadcastChannelPtr> channels_;
+
+};
@@ -0,0 +1,137 @@
+#pragma once
+
+// System
+#include <math.h>
+
+/*
+* @brief Plain 3D vector, so that the camera model can be shared by the server
+* and the clients without depending on the CUDA vector types
+*/
+struct CameraVector
+{
+   float x, y, z;
+};
+
+/*
+* @brief Pinhole model of the kernel camera, as sent in rendering requests:
+* primary rays start at the eye and go through an image plane perpendicular
+* to the Z axis and centered on the direction point, with a constant pixel
+* pitch. Rays are then rotated around the origin of the scene by the camera
+* angles, first around the X axis, then around the Y axis.
+* Isometric views (isometric3D) are not modelled. The pixel pitch is a
+* property of the kernel that the server cannot query: backends check it
+* with a probe frame before relying on the model.
+*/
+class CameraModel
+{
+
+public:
+
+   CameraModel(
+      const CameraVector& eye, const CameraVector& direction, const CameraVector& angles,
+      int width, int height, float pixelPitch ) :
+      eye_(eye),
+      direction_(direction),
+      width_(width),
+      height_(height),
+      pixelPitch_(pixelPitch)
+   {
+      cosX_ = cosf(angles.x); sinX_ = sinf(angles.x);
+      cosY_ = cosf(angles.y); sinY_ = sinf(angles.y);
+      origin_ = rotate(eye_);
+   }
+
+public:
+
+   /**
+   * @brief Origin of the primary rays, in world space
+   */
+   const CameraVector& getOrigin() const { return origin_; }
+
+   /**
+   * @brief Normalized direction of the primary ray going through the given
+   * pixel, in world space
+   */
+   CameraVector getRay( float x, float y ) const
+   {
+      CameraVector ray;
+      ray.x = direction_.x + pixelPitch_*(x - width_*0.5f) - eye_.x;
+      ray.y = direction_.y - pixelPitch_*(y - height_*0.5f) - eye_.y;
+      ray.z = direction_.z - eye_.z;
+      float length = sqrtf(ray.x*ray.x + ray.y*ray.y + ray.z*ray.z);
+      ray.x /= length; ray.y /= length; ray.z /= length;
+      return rotate(ray);
+   }
+
+   /**
+   * @brief Projects a world space point on the image. Returns false when the
+   * point is behind the eye.
+   */
+   bool project( const CameraVector& point, float& x, float& y, float& distance ) const
+   {
+      CameraVector local = unrotate(point);
+      CameraVector v = { local.x - eye_.x, local.y - eye_.y, local.z - eye_.z };
+      float depth = direction_.z - eye_.z;
+      if( v.z*depth <= 0.f ) return false;
+      float t = depth/v.z;
+      x = (eye_.x + t*v.x - direction_.x)/pixelPitch_ + width_*0.5f;
+      y = (direction_.y - eye_.y - t*v.y)/pixelPitch_ + height_*0.5f;
+      distance = sqrtf(v.x*v.x + v.y*v.y + v.z*v.z);
+      return true;
+   }
+
+   /**
+   * @brief Size in world units covered by a pixel at the given distance
+   * from the eye
+   */
+   float getPixelFootprint( float distance ) const
+   {
+      float depth = fabsf(direction_.z - eye_.z);
+      return (depth > 0.f) ? pixelPitch_*distance/depth : 0.f;
+   }
+
+   /**
+   * @brief Point at the given distance along the primary ray of a pixel
+   */
+   CameraVector getPoint( float x, float y, float distance ) const
+   {
+      CameraVector ray = getRay(x, y);
+      CameraVector point = {
+         origin_.x + distance*ray.x,
+         origin_.y + distance*ray.y,
+         origin_.z + distance*ray.z };
+      return point;
+   }
+
+private:
+
+   CameraVector rotate( const CameraVector& v ) const
+   {
+      // X axis
+      CameraVector r = { v.x, v.y*cosX_ - v.z*sinX_, v.y*sinX_ + v.z*cosX_ };
+      // Y axis
+      CameraVector result = { r.z*sinY_ + r.x*cosY_, r.y, r.z*cosY_ - r.x*sinY_ };
+      return result;
+   }
+
+   CameraVector unrotate( const CameraVector& v ) const
+   {
+      // Y axis
+      CameraVector r = { v.x*cosY_ - v.z*sinY_, v.y, v.x*sinY_ + v.z*cosY_ };
+      // X axis
+      CameraVector result = { r.x, r.y*cosX_ + r.z*sinX_, r.z*cosX_ - r.y*sinX_ };
+      return result;
+   }
+
+private:
+
+   CameraVector eye_;
+   CameraVector direction_;
+   CameraVector origin_;
+   int width_;
+   int height_;
+   float pixelPitch_;
+   float cosX_, sinX_;
+   float cosY_, sinY_;
+
+};
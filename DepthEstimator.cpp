@@ -0,0 +1,76 @@
+// Project
+#include "DepthEstimator.h"
+
+namespace
+{
+   // Slab test, returns the entry distance or a negative value
+   float intersectBox( const BoundingBox& box, const CameraVector& origin, const CameraVector& ray )
+   {
+      const float* o   = &origin.x;
+      const float* r   = &ray.x;
+      const float* min = &box.minimum.x;
+      const float* max = &box.maximum.x;
+      float tNear(-1e30f);
+      float tFar(1e30f);
+      for( int i(0); i<3; ++i )
+      {
+         if( fabs(r[i]) < 1e-12f )
+         {
+            if( o[i] < min[i] || o[i] > max[i] ) return -1.f;
+            continue;
+         }
+         float t1 = (min[i]-o[i])/r[i];
+         float t2 = (max[i]-o[i])/r[i];
+         if( t1 > t2 ) { float t = t1; t1 = t2; t2 = t; }
+         if( t1 > tNear ) tNear = t1;
+         if( t2 < tFar  ) tFar  = t2;
+         if( tNear > tFar || tFar < 0.f ) return -1.f;
+      }
+      // The eye may be inside the box
+      return (tNear < 0.f) ? 0.f : tNear;
+   }
+}
+
+DepthEstimator::DepthEstimator( int tileSize ) :
+   tileSize_(tileSize)
+{
+}
+
+float DepthEstimator::intersect(
+   const std::vector<BoundingBox>& boxes,
+   const CameraVector& origin, const CameraVector& ray )
+{
+   float distance(-1.f);
+   for( size_t i(0); i<boxes.size(); ++i )
+   {
+      float t = intersectBox( boxes[i], origin, ray );
+      if( t >= 0.f && (distance < 0.f || t < distance) ) distance = t;
+   }
+   return distance;
+}
+
+void DepthEstimator::estimate(
+   const std::vector<BoundingBox>& boxes,
+   const CameraModel& camera,
+   int width, int height, float maxDistance,
+   std::vector<unsigned short>& depth,
+   int& depthWidth, int& depthHeight ) const
+{
+   depthWidth  = (width+tileSize_-1)/tileSize_;
+   depthHeight = (height+tileSize_-1)/tileSize_;
+   depth.resize(depthWidth*depthHeight);
+
+   const float scale = (maxDistance > 0.f) ? (BACKGROUND-1)/maxDistance : 0.f;
+   for( int y(0); y<depthHeight; ++y )
+   {
+      for( int x(0); x<depthWidth; ++x )
+      {
+         float px = (x+0.5f)*tileSize_;
+         float py = (y+0.5f)*tileSize_;
+         float t = intersect( boxes, camera.getOrigin(), camera.getRay(px, py) );
+         unsigned short value = BACKGROUND;
+         if( t >= 0.f && t < maxDistance ) value = static_cast<unsigned short>(t*scale);
+         depth[y*depthWidth+x] = value;
+      }
+   }
+}
@@ -0,0 +1,63 @@
+#pragma once
+
+// System
+#include <vector>
+
+// Project
+#include "CameraModel.h"
+
+/*
+* @brief Axis aligned box enclosing part of the scene geometry
+*/
+struct BoundingBox
+{
+   CameraVector minimum;
+   CameraVector maximum;
+};
+
+/*
+* @brief Computes a coarse depth buffer from the bounding boxes of the scene,
+* without any help from the kernel. Each tile of the image gets the distance
+* from the eye to the nearest box hit by the ray going through the center of
+* the tile. This is enough for clients to reproject frames while they wait
+* for the next one.
+*/
+class DepthEstimator
+{
+
+public:
+
+   static const unsigned short BACKGROUND = 0xFFFF;
+
+public:
+
+   DepthEstimator( int tileSize );
+
+public:
+
+   int getTileSize() const { return tileSize_; }
+
+   /**
+   * @brief Fills the depth buffer of an image of the given size. Distances
+   * are scaled to [0, 65534] over maxDistance.
+   */
+   void estimate(
+      const std::vector<BoundingBox>& boxes,
+      const CameraModel& camera,
+      int width, int height, float maxDistance,
+      std::vector<unsigned short>& depth,
+      int& depthWidth, int& depthHeight ) const;
+
+   /**
+   * @brief Distance to the nearest box along a ray, or a negative value when
+   * no box is hit
+   */
+   static float intersect(
+      const std::vector<BoundingBox>& boxes,
+      const CameraVector& origin, const CameraVector& ray );
+
+private:
+
+   int tileSize_;
+
+};
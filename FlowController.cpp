@@ -0,0 +1,148 @@
+// Project
+#include "FlowController.h"
+
+namespace
+{
+   // Gaps longer than this mean that the client was idle, not transferring
+   const double IDLE_TIME = 2000.0; // ms
+
+   // Link estimates are smoothed over the last samples
+   const double THROUGHPUT_SMOOTHING = 0.2;
+   const double ROUND_TRIP_DRIFT     = 0.02;
+   const int    MIN_SAMPLES          = 4;
+
+   const int MIN_QUALITY = 10;
+}
+
+FlowController::FlowController( int maxInFlight, int targetFrameTime ) :
+   maxInFlight_(maxInFlight),
+   targetFrameTime_(targetFrameTime),
+   inFlight_(0),
+   lastTicket_(0),
+   lastFrameSize_(0),
+   nbSamples_(0),
+   throughput_(0.0),
+   roundTripTime_(0.0),
+   accepted_(0),
+   rejected_(0),
+   coalesced_(0)
+{
+}
+
+int FlowController::admit()
+{
+   IceUtil::Mutex::Lock lock(mutex_);
+   IceUtil::Time now = IceUtil::Time::now(IceUtil::Time::Monotonic);
+   double sinceReply = (now-lastReply_).toMilliSecondsDouble();
+
+   // The client waited for its previous frame
+   if( inFlight_ == 0 && lastFrameSize_ > 0 && sinceReply < IDLE_TIME )
+      updateEstimates( sinceReply );
+
+   if( maxInFlight_ > 0 && inFlight_ >= maxInFlight_ )
+      reject( "Too many frames in flight", suggestedInterval() );
+
+   // The link is still busy with the previous frame, a new one would only
+   // wait in the send queue
+   if( inFlight_ > 0 && nbSamples_ >= MIN_SAMPLES && throughput_ > 0.0 )
+   {
+      double transferTime = lastFrameSize_*1000.0/throughput_;
+      if( sinceReply < transferTime )
+         reject( "Paced to the link", transferTime-sinceReply );
+   }
+
+   ++inFlight_;
+   ++accepted_;
+   return ++lastTicket_;
+}
+
+void FlowController::checkSuperseded( int ticket )
+{
+   IceUtil::Mutex::Lock lock(mutex_);
+   if( ticket != lastTicket_ )
+   {
+      ++coalesced_;
+      ::IceStreamer::FrameRejected e;
+      e.reason     = "Superseded by a more recent request";
+      e.retryAfter = 0;
+      throw e;
+   }
+}
+
+void FlowController::release( int ticket, size_t frameSize )
+{
+   IceUtil::Mutex::Lock lock(mutex_);
+   --inFlight_;
+   if( frameSize > 0 )
+   {
+      lastReply_     = IceUtil::Time::now(IceUtil::Time::Monotonic);
+      lastFrameSize_ = frameSize;
+   }
+}
+
+::IceStreamer::FlowStatistics FlowController::getStatistics()
+{
+   IceUtil::Mutex::Lock lock(mutex_);
+   ::IceStreamer::FlowStatistics statistics;
+   statistics.inFlight          = inFlight_;
+   statistics.accepted          = accepted_;
+   statistics.rejected          = rejected_;
+   statistics.coalesced         = coalesced_;
+   statistics.throughput        = static_cast<float>(throughput_);
+   statistics.roundTripTime     = static_cast<float>(roundTripTime_);
+   statistics.suggestedInterval = suggestedInterval();
+   statistics.suggestedQuality  = suggestedQuality();
+   return statistics;
+}
+
+int FlowController::getSuggestedQuality()
+{
+   IceUtil::Mutex::Lock lock(mutex_);
+   return suggestedQuality();
+}
+
+void FlowController::updateEstimates( double gap )
+{
+   // The shortest gap is the best estimate of the round trip time. It is
+   // allowed to drift up slowly to follow route changes.
+   if( nbSamples_ == 0 || gap < roundTripTime_ )
+      roundTripTime_ = gap;
+   else
+      roundTripTime_ += ROUND_TRIP_DRIFT*(gap-roundTripTime_);
+
+   double transferTime = gap-roundTripTime_;
+   if( transferTime < 1.0 ) transferTime = 1.0;
+   double sample = lastFrameSize_*1000.0/transferTime;
+   throughput_ = (nbSamples_ == 0) ? sample : throughput_+THROUGHPUT_SMOOTHING*(sample-throughput_);
+   ++nbSamples_;
+}
+
+void FlowController::reject( const std::string& reason, double retryAfter )
+{
+   ++rejected_;
+   ::IceStreamer::FrameRejected e;
+   e.reason     = reason;
+   e.retryAfter = static_cast<int>(retryAfter+0.5);
+   throw e;
+}
+
+int FlowController::suggestedInterval() const
+{
+   double interval = targetFrameTime_;
+   if( nbSamples_ >= MIN_SAMPLES && throughput_ > 0.0 )
+   {
+      double linkTime = roundTripTime_+lastFrameSize_*1000.0/throughput_;
+      if( linkTime > interval ) interval = linkTime;
+   }
+   return static_cast<int>(interval+0.5);
+}
+
+int FlowController::suggestedQuality() const
+{
+   // Share of the frame that the link carries within the target frame time
+   if( nbSamples_ < MIN_SAMPLES || lastFrameSize_ == 0 || targetFrameTime_ <= 0 ) return 100;
+   double quality = 100.0*throughput_*targetFrameTime_/(1000.0*lastFrameSize_);
+   if( quality > 100.0 ) return 100;
+   if( quality < MIN_QUALITY ) return MIN_QUALITY;
+   return static_cast<int>(quality);
+}
@@ -0,0 +1,115 @@
+#pragma once
+
+// Ice
+#include <IceUtil/Mutex.h>
+#include <IceUtil/Time.h>
+
+// Project
+#include "IIceStreamer.h"
+
+/*
+* @brief Admission control of the frame requests of one session.
+* The number of requests in flight is capped, and requests coming faster than
+* the link of the client can carry the frames are rejected, so that a slow
+* viewer does not keep backends busy with frames it cannot receive. Requests
+* waiting for a backend are dropped when a more recent one comes in from the
+* same session.
+* The link is estimated passively: when a client waits for its frame before
+* sending the next request, the time between the reply and the next request
+* is the transfer time of the frame plus the round trip time.
+*/
+class FlowController
+{
+
+public:
+
+   FlowController( int maxInFlight, int targetFrameTime );
+
+public:
+
+   /**
+   * @brief Admits a new request and returns its ticket. Throws FrameRejected
+   * when the request must not be served.
+   */
+   int admit();
+
+   /**
+   * @brief Throws FrameRejected when a more recent request of the session
+   * has been admitted since the given one
+   */
+   void checkSuperseded( int ticket );
+
+   /**
+   * @brief Ends a request. frameSize is the size of the reply, 0 when no
+   * frame was sent.
+   */
+   void release( int ticket, size_t frameSize );
+
+   ::IceStreamer::FlowStatistics getStatistics();
+
+   /**
+   * @brief Quality that lossy encodings should use for the link, from 1 to 100
+   */
+   int getSuggestedQuality();
+
+private:
+
+   void updateEstimates( double gap );
+   void reject( const std::string& reason, double retryAfter );
+   int suggestedInterval() const;
+   int suggestedQuality() const;
+
+private:
+
+   IceUtil::Mutex mutex_;
+   int maxInFlight_;
+   int targetFrameTime_;
+
+   int inFlight_;
+   int lastTicket_;
+   IceUtil::Time lastReply_;
+   size_t lastFrameSize_;
+
+   // Link estimates
+   int    nbSamples_;
+   double throughput_;    // bytes per second
+   double roundTripTime_; // ms
+
+   Ice::Long accepted_;
+   Ice::Long rejected_;
+   Ice::Long coalesced_;
+
+};
+
+/*
+* @brief Admits a request for its lifetime
+*/
+class FlowTicket
+{
+
+public:
+
+   FlowTicket( FlowController& controller ) :
+      controller_(controller),
+      ticket_(controller.admit()),
+      frameSize_(0)
+   {
+   }
+
+   ~FlowTicket()
+   {
+      controller_.release( ticket_, frameSize_ );
+   }
+
+public:
+
+   void checkSuperseded() const { controller_.checkSuperseded( ticket_ ); }
+   void setFrameSize( size_t frameSize ) { frameSize_ = frameSize; }
+
+private:
+
+   FlowController& controller_;
+   int ticket_;
+   size_t frameSize_;
+
+};
@@ -0,0 +1,215 @@
+// System
+#include <math.h>
+
+// Project
+#include "Trace.h"
+#include "FrameCache.h"
+
+namespace
+{
+   // FNV-1a, 64 bits
+   class Hash
+   {
+   public:
+      Hash() : value_(14695981039346656037ULL) {}
+
+      void add( const void* data, size_t size )
+      {
+         const unsigned char* bytes = static_cast<const unsigned char*>(data);
+         for( size_t i(0); i<size; ++i )
+         {
+            value_ ^= bytes[i];
+            value_ *= 1099511628211ULL;
+         }
+      }
+
+      template<class T> void add( const T& value ) { add( &value, sizeof(T) ); }
+
+      Ice::Long value() const { return static_cast<Ice::Long>(value_); }
+
+   private:
+      unsigned long long value_;
+   };
+
+   float snap( float value, float step )
+   {
+      return floorf(value/step+0.5f)*step;
+   }
+
+   void snap( float4& value, float step )
+   {
+      value.x = snap(value.x, step);
+      value.y = snap(value.y, step);
+      value.z = snap(value.z, step);
+   }
+}
+
+FrameCache::FrameCache( size_t budget, float positionStep, float angleStep ) :
+   budget_(budget),
+   positionStep_(positionStep),
+   angleStep_(angleStep),
+   sceneVersion_(0),
+   size_(0),
+   hits_(0),
+   misses_(0),
+   evictions_(0),
+   speculativeFrames_(0),
+   speculativeHits_(0)
+{
+}
+
+void FrameCache::quantize( FrameRequest& request ) const
+{
+   if( !isEnabled() ) return;
+   if( positionStep_ > 0.f )
+   {
+      snap( request.eye, positionStep_ );
+      snap( request.direction, positionStep_ );
+   }
+   if( angleStep_ > 0.f )
+   {
+      snap( request.angles, angleStep_ );
+   }
+}
+
+Ice::Long FrameCache::computeKey( const FrameRequest& request, int sceneVersion ) const
+{
+   Hash hash;
+   hash.add( sceneVersion );
+   hash.add( request.eye.x ); hash.add( request.eye.y ); hash.add( request.eye.z );
+   hash.add( request.direction.x ); hash.add( request.direction.y ); hash.add( request.direction.z );
+   hash.add( request.angles.x ); hash.add( request.angles.y ); hash.add( request.angles.z );
+   hash.add( request.level );
+
+   // Kernel settings, only the lanes that requests set. The other ones are
+   // not part of the view, and may be left uninitialized by the caller.
+   const SceneInfo& si = request.sceneInfo;
+   hash.add( si.width.x ); hash.add( si.height.x ); hash.add( si.shadowsEnabled.x ); hash.add( si.nbRayIterations.x );
+   hash.add( si.transparentColor.x ); hash.add( si.viewDistance.x ); hash.add( si.shadowIntensity.x ); hash.add( si.width3DVision.x );
+   hash.add( si.backgroundColor.x ); hash.add( si.backgroundColor.y ); hash.add( si.backgroundColor.z );
+   hash.add( si.supportFor3DVision.x ); hash.add( si.renderBoxes.x );
+   hash.add( si.pathTracingIteration.x ); hash.add( si.maxPathTracingIterations.x );
+   hash.add( si.misc.x ); hash.add( si.misc.y ); hash.add( si.misc.z ); hash.add( si.misc.w );
+   const PostProcessingInfo& ppi = request.postProcessingInfo;
+   hash.add( ppi.type.x ); hash.add( ppi.param1.x ); hash.add( ppi.param2.x ); hash.add( ppi.param3.x );
+
+   // Server side post processing, field by field as well
+   const PostProcessorSettings& pp = request.postProcessor;
+   hash.add( pp.denoise ); hash.add( pp.depthOfField ); hash.add( pp.toneMapping ); hash.add( pp.antiAliasing );
+   hash.add( pp.iterations ); hash.add( pp.focus ); hash.add( pp.strength ); hash.add( pp.radius );
+   hash.add( pp.exposure ); hash.add( pp.whitePoint );
+   if( request.layer )
+   {
+      // Material overrides of the session. Fields are hashed one by one
+      // since the structure has padding.
+      const std::map<int, MaterialDescription>& materials = request.layer->getMaterials();
+      std::map<int, MaterialDescription>::const_iterator it = materials.begin();
+      for( ; it != materials.end(); ++it )
+      {
+         const MaterialDescription& m = it->second;
+         hash.add( it->first );
+         hash.add( m.r ); hash.add( m.g ); hash.add( m.b );
+         hash.add( m.reflection ); hash.add( m.refraction ); hash.add( m.transparency );
+         hash.add( m.specularValue ); hash.add( m.specularPower ); hash.add( m.innerIllumination );
+      }
+   }
+   return hash.value();
+}
+
+bool FrameCache::find( Ice::Long key, int sceneVersion, ::IceStreamer::bytes& frame )
+{
+   if( !isEnabled() ) return false;
+
+   IceUtil::Mutex::Lock lock(mutex_);
+   invalidate(sceneVersion);
+
+   std::map<Ice::Long, std::list<Entry>::iterator>::iterator it = index_.find(key);
+   if( it == index_.end() )
+   {
+      ++misses_;
+   }
+   else
+   {
+      ++hits_;
+      entries_.splice( entries_.begin(), entries_, it->second );
+      frame = it->second->frame;
+      if( it->second->speculative )
+      {
+         ++speculativeHits_;
+         it->second->speculative = false;
+      }
+   }
+
+   Ice::Long lookups = hits_+misses_;
+   if( lookups%1000 == 0 )
+   {
+      APPL_LOG_INFO("Frame cache: " << (100*hits_/lookups) << "% hits, " <<
+         index_.size() << " frames, " << size_/1024 << " KB");
+   }
+   return it != index_.end();
+}
+
+bool FrameCache::contains( Ice::Long key, int sceneVersion )
+{
+   if( !isEnabled() ) return false;
+
+   IceUtil::Mutex::Lock lock(mutex_);
+   return sceneVersion == sceneVersion_ && index_.find(key) != index_.end();
+}
+
+void FrameCache::insert( Ice::Long key, int sceneVersion, const ::IceStreamer::bytes& frame, bool speculative )
+{
+   if( !isEnabled() || frame.size() > budget_ ) return;
+
+   IceUtil::Mutex::Lock lock(mutex_);
+   invalidate(sceneVersion);
+   if( index_.find(key) != index_.end() ) return;
+
+   Entry entry;
+   entry.key = key;
+   entry.speculative = speculative;
+   entries_.push_front(entry);
+   entries_.front().frame = frame;
+   index_[key] = entries_.begin();
+   size_ += frame.size();
+   if( speculative ) ++speculativeFrames_;
+   evict();
+}
+
+::IceStreamer::FrameCacheStatistics FrameCache::getStatistics()
+{
+   IceUtil::Mutex::Lock lock(mutex_);
+   ::IceStreamer::FrameCacheStatistics statistics;
+   statistics.hits      = hits_;
+   statistics.misses    = misses_;
+   statistics.evictions = evictions_;
+   statistics.size      = size_;
+   statistics.entries   = static_cast<Ice::Int>(index_.size());
+   statistics.speculativeFrames = speculativeFrames_;
+   statistics.speculativeHits   = speculativeHits_;
+   return statistics;
+}
+
+void FrameCache::invalidate( int sceneVersion )
+{
+   if( sceneVersion == sceneVersion_ ) return;
+   if( !entries_.empty() )
+   {
+      APPL_LOG_INFO("Frame cache flushed, scene version " << sceneVersion_ << " -> " << sceneVersion);
+   }
+   entries_.clear();
+   index_.clear();
+   size_ = 0;
+   sceneVersion_ = sceneVersion;
+}
+
+void FrameCache::evict()
+{
+   while( size_ > budget_ && !entries_.empty() )
+   {
+      size_ -= entries_.back().frame.size();
+      index_.erase( entries_.back().key );
+      entries_.pop_back();
+      ++evictions_;
+   }
+}
@@ -0,0 +1,85 @@
+#pragma once
+
+// System
+#include <list>
+#include <map>
+
+// Ice
+#include <IceUtil/Mutex.h>
+
+// Project
+#include "IIceStreamer.h"
+#include "RenderBackend.h"
+
+/*
+* @brief LRU cache of rendered frames. Frames are keyed by a hash of the
+* quantized camera, the scene and post processing settings, the session
+* overrides and the version of the scene snapshot. The cache is flushed as
+* soon as a request refers to a new version of the scene. A null memory budget
+* disables the cache.
+*/
+class FrameCache
+{
+
+public:
+
+   FrameCache( size_t budget, float positionStep, float angleStep );
+
+public:
+
+   bool isEnabled() const { return budget_ != 0; }
+
+   /**
+   * @brief Snaps the camera of a request to the quantization grid, so that
+   * a cached frame is exactly the frame that would be rendered
+   */
+   void quantize( FrameRequest& request ) const;
+
+   Ice::Long computeKey( const FrameRequest& request, int sceneVersion ) const;
+
+public:
+
+   bool find( Ice::Long key, int sceneVersion, ::IceStreamer::bytes& frame );
+   bool contains( Ice::Long key, int sceneVersion );
+
+   /**
+   * @brief Stores a frame. Speculative frames are rendered ahead of the
+   * requests, they are accounted separately in the statistics.
+   */
+   void insert( Ice::Long key, int sceneVersion, const ::IceStreamer::bytes& frame, bool speculative = false );
+
+   ::IceStreamer::FrameCacheStatistics getStatistics();
+
+private:
+
+   void invalidate( int sceneVersion );
+   void evict();
+
+private:
+
+   struct Entry
+   {
+      Ice::Long key;
+      ::IceStreamer::bytes frame;
+      bool speculative;
+   };
+
+   IceUtil::Mutex mutex_;
+   size_t budget_;
+   float positionStep_;
+   float angleStep_;
+
+   // Most recently used entries first
+   std::list<Entry> entries_;
+   std::map<Ice::Long, std::list<Entry>::iterator> index_;
+   int sceneVersion_;
+
+   // Statistics
+   size_t size_;
+   Ice::Long hits_;
+   Ice::Long misses_;
+   Ice::Long evictions_;
+   Ice::Long speculativeFrames_;
+   Ice::Long speculativeHits_;
+
+};
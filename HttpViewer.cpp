@@ -0,0 +1,680 @@
+// System
+#ifdef WIN32
+#include <winsock2.h>
+#pragma comment(lib, "ws2_32.lib")
+typedef int socklen_t;
+#define SHUT_RDWR SD_BOTH
+#define MSG_NOSIGNAL 0
+#define snprintf _snprintf
+#else
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/select.h>
+#include <sys/time.h>
+#include <netinet/in.h>
+#include <unistd.h>
+typedef int SOCKET;
+#define INVALID_SOCKET (-1)
+#define closesocket close
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <ctype.h>
+
+// Project
+#include "Trace.h"
+#include "HttpViewer.h"
+
+namespace
+{
+   const HttpSocket NO_SOCKET = static_cast<HttpSocket>(INVALID_SOCKET);
+
+   const size_t MAX_REQUEST_SIZE = 8192;
+   const size_t MAX_PAGE_QUERY   = 512;
+   const int    MIN_IMAGE_SIZE   = 16;
+
+   // Delay after which a waiting connection checks that its viewer is still
+   // there, and for the first frame of a view
+   const int FRAME_TIMEOUT       = 1000;  // ms
+   const int FIRST_FRAME_TIMEOUT = 10000; // ms
+
+   // Viewers that cannot take a frame within this delay are dropped
+   const int SEND_TIMEOUT = 10; // s
+
+   const char* WEBSOCKET_GUID = "258EAFA5-E914-47DA-95CA-C5AB0DC11D5B";
+
+   const char* MJPEG_PAGE =
+      "<!DOCTYPE html><html><head><title>Sol-R</title></head>"
+      "<body style=\"margin:0;background:#000\">"
+      "<img src=\"/stream.mjpeg?%s\">"
+      "</body></html>";
+
+   const char* WEBSOCKET_PAGE =
+      "<!DOCTYPE html><html><head><title>Sol-R</title></head>"
+      "<body style=\"margin:0;background:#000\"><img id=\"view\"><script>"
+      "var view=document.getElementById('view');"
+      "var socket=new WebSocket('ws://'+location.host+'/stream?%s');"
+      "socket.binaryType='blob';"
+      "socket.onmessage=function(e){"
+      "var url=URL.createObjectURL(e.data);"
+      "view.onload=function(){URL.revokeObjectURL(url);};"
+      "view.src=url;};"
+      "</script></body></html>";
+
+   inline SOCKET native( HttpSocket socket )
+   {
+      return static_cast<SOCKET>(socket);
+   }
+
+   // --------------------------------------------------------------------------------
+   // WebSocket handshake: base64 of the SHA-1 of the key and the protocol GUID
+   // --------------------------------------------------------------------------------
+   inline unsigned int rotate( unsigned int value, int bits )
+   {
+      return (value<<bits)|(value>>(32-bits));
+   }
+
+   void sha1( const std::string& message, unsigned char digest[20] )
+   {
+      unsigned int h[5] = { 0x67452301, 0xEFCDAB89, 0x98BADCFE, 0x10325476, 0xC3D2E1F0 };
+
+      // Padding to a multiple of 64 bytes, ending with the length in bits
+      std::string data(message);
+      unsigned long long length = static_cast<unsigned long long>(message.size())*8;
+      data += static_cast<char>(0x80);
+      while( data.size()%64 != 56 ) data += static_cast<char>(0);
+      for( int i(7); i>=0; --i ) data += static_cast<char>((length>>(i*8))&0xFF);
+
+      for( size_t chunk(0); chunk<data.size(); chunk+=64 )
+      {
+         unsigned int w[80];
+         for( int i(0); i<16; ++i )
+         {
+            const unsigned char* p = reinterpret_cast<const unsigned char*>(data.data()+chunk+i*4);
+            w[i] = (p[0]<<24)|(p[1]<<16)|(p[2]<<8)|p[3];
+         }
+         for( int i(16); i<80; ++i ) w[i] = rotate(w[i-3]^w[i-8]^w[i-14]^w[i-16], 1);
+
+         unsigned int a = h[0], b = h[1], c = h[2], d = h[3], e = h[4];
+         for( int i(0); i<80; ++i )
+         {
+            unsigned int f, k;
+            if( i < 20 )      { f = (b&c)|(~b&d);       k = 0x5A827999; }
+            else if( i < 40 ) { f = b^c^d;              k = 0x6ED9EBA1; }
+            else if( i < 60 ) { f = (b&c)|(b&d)|(c&d);  k = 0x8F1BBCDC; }
+            else              { f = b^c^d;              k = 0xCA62C1D6; }
+            unsigned int t = rotate(a, 5)+f+e+k+w[i];
+            e = d; d = c; c = rotate(b, 30); b = a; a = t;
+         }
+         h[0] += a; h[1] += b; h[2] += c; h[3] += d; h[4] += e;
+      }
+
+      for( int i(0); i<20; ++i ) digest[i] = static_cast<unsigned char>(h[i/4]>>(24-(i%4)*8));
+   }
+
+   std::string base64( const unsigned char* data, size_t size )
+   {
+      static const char* ALPHABET = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+      std::string result;
+      for( size_t i(0); i<size; i+=3 )
+      {
+         unsigned int value = data[i]<<16;
+         if( i+1 < size ) value |= data[i+1]<<8;
+         if( i+2 < size ) value |= data[i+2];
+         result += ALPHABET[(value>>18)&0x3F];
+         result += ALPHABET[(value>>12)&0x3F];
+         result += (i+1 < size) ? ALPHABET[(value>>6)&0x3F] : '=';
+         result += (i+2 < size) ? ALPHABET[value&0x3F] : '=';
+      }
+      return result;
+   }
+
+   // --------------------------------------------------------------------------------
+   // Requests
+   // --------------------------------------------------------------------------------
+   struct HttpRequest
+   {
+      std::string method;
+      std::string path;
+      std::string query;
+      std::map<std::string, std::string> headers; // lower case names
+   };
+
+   bool parseRequest( const std::string& text, HttpRequest& request )
+   {
+      size_t end = text.find("\r\n");
+      std::string line = text.substr(0, end);
+      size_t space1 = line.find(' ');
+      size_t space2 = line.find(' ', space1+1);
+      if( space1 == std::string::npos || space2 == std::string::npos ) return false;
+      request.method = line.substr(0, space1);
+      std::string target = line.substr(space1+1, space2-space1-1);
+      size_t question = target.find('?');
+      request.path  = target.substr(0, question);
+      request.query = (question == std::string::npos) ? "" : target.substr(question+1);
+
+      while( end != std::string::npos )
+      {
+         size_t start = end+2;
+         end = text.find("\r\n", start);
+         line = text.substr(start, end == std::string::npos ? std::string::npos : end-start);
+         size_t colon = line.find(':');
+         if( colon == std::string::npos ) continue;
+         std::string name = line.substr(0, colon);
+         for( size_t i(0); i<name.size(); ++i ) name[i] = static_cast<char>(tolower(name[i]));
+         size_t value = line.find_first_not_of(' ', colon+1);
+         request.headers[name] = (value == std::string::npos) ? "" : line.substr(value);
+      }
+      return true;
+   }
+
+   std::string getHeader( const HttpRequest& request, const std::string& name )
+   {
+      std::map<std::string, std::string>::const_iterator it = request.headers.find(name);
+      return (it == request.headers.end()) ? "" : it->second;
+   }
+
+   bool containsToken( const std::string& value, const std::string& token )
+   {
+      std::string lower(value);
+      for( size_t i(0); i<lower.size(); ++i ) lower[i] = static_cast<char>(tolower(lower[i]));
+      return lower.find(token) != std::string::npos;
+   }
+
+   std::string getQueryValue( const std::string& query, const std::string& name )
+   {
+      size_t start(0);
+      while( start < query.size() )
+      {
+         size_t end = query.find('&', start);
+         if( end == std::string::npos ) end = query.size();
+         size_t equal = query.find('=', start);
+         if( equal != std::string::npos && equal < end && query.compare(start, equal-start, name) == 0 && equal-start == name.size() )
+            return query.substr(equal+1, end-equal-1);
+         start = end+1;
+      }
+      return "";
+   }
+
+   /*
+   * @brief Query string that can be written in a page, both in an attribute
+   * and in a script string: anything but letters, digits and the separators
+   * of the query is percent-encoded
+   */
+   std::string escapeQuery( const std::string& query )
+   {
+      static const char* HEX = "0123456789ABCDEF";
+      std::string result;
+      for( size_t i(0); i<query.size(); ++i )
+      {
+         unsigned char c = static_cast<unsigned char>(query[i]);
+         if( isalnum(c) || (c != 0 && strchr("=&,.-_~%+", c)) )
+         {
+            result += static_cast<char>(c);
+         }
+         else
+         {
+            result += '%';
+            result += HEX[c>>4];
+            result += HEX[c&0x0F];
+         }
+      }
+      return result;
+   }
+
+   void parseVector( const std::string& value, float4& vector )
+   {
+      if( value.empty() ) return;
+      float x, y, z;
+      std::string text(value);
+      for( size_t i(0); i<text.size(); ++i ) if( text[i] == ',' ) text[i] = ' ';
+      if( sscanf(text.c_str(), "%f %f %f", &x, &y, &z) == 3 )
+      {
+         vector.x = x;
+         vector.y = y;
+         vector.z = z;
+      }
+   }
+
+   // Sizes larger than the buffers of the kernels are clamped to them
+   void parseSize( const std::string& value, int maxSize, int& size )
+   {
+      if( value.empty() ) return;
+      int parsed = atoi(value.c_str());
+      if( parsed >= MIN_IMAGE_SIZE ) size = std::min(parsed, maxSize);
+   }
+
+   // --------------------------------------------------------------------------------
+   // Sockets
+   // --------------------------------------------------------------------------------
+   bool sendAll( HttpSocket socket, const char* data, size_t size )
+   {
+      while( size > 0 )
+      {
+         int sent = send( native(socket), data, static_cast<int>(size), MSG_NOSIGNAL );
+         if( sent <= 0 ) return false;
+         data += sent;
+         size -= sent;
+      }
+      return true;
+   }
+
+   bool sendAll( HttpSocket socket, const std::string& data )
+   {
+      return sendAll( socket, data.data(), data.size() );
+   }
+
+   void sendResponse( HttpSocket socket, const char* status, const char* contentType, const std::string& body )
+   {
+      char header[256];
+      snprintf( header, sizeof(header),
+         "HTTP/1.1 %s\r\nContent-Type: %s\r\nContent-Length: %d\r\nCache-Control: no-cache\r\nConnection: close\r\n\r\n",
+         status, contentType, static_cast<int>(body.size()) );
+      if( sendAll( socket, header ) ) sendAll( socket, body );
+   }
+
+   /*
+   * @brief True when the viewer has closed the connection. Incoming data is
+   * discarded: browsers send nothing on an MJPEG stream, and only control
+   * messages on a WebSocket stream.
+   */
+   bool isClosed( HttpSocket socket, bool webSocket )
+   {
+      fd_set readable;
+      FD_ZERO(&readable);
+      FD_SET(native(socket), &readable);
+      timeval timeout = { 0, 0 };
+      if( select( static_cast<int>(native(socket)+1), &readable, 0, 0, &timeout ) <= 0 ) return false;
+
+      char buffer[1024];
+      int received = recv( native(socket), buffer, sizeof(buffer), 0 );
+      if( received <= 0 ) return true;
+
+      // WebSocket close message
+      return webSocket && (buffer[0]&0x0F) == 0x8;
+   }
+}
+
+/*
+* @brief Serves the requests of one connection
+*/
+class HttpConnection : public IceUtil::Thread
+{
+
+public:
+
+   HttpConnection( HttpViewer& viewer, HttpSocket socket ) :
+      viewer_(viewer),
+      socket_(socket)
+   {
+   }
+
+public:
+
+   virtual void run()
+   {
+      try
+      {
+         serve();
+      }
+      catch( ... )
+      {
+         APPL_LOG_ERROR("HTTP connection failed");
+      }
+      // Forgotten before being closed, so that the handle cannot be reused
+      // by a new connection in the meantime
+      viewer_.connectionClosed( socket_ );
+      closesocket( native(socket_) );
+   }
+
+private:
+
+   void serve()
+   {
+      // Request line and headers, bodies are not supported
+      std::string text;
+      char buffer[1024];
+      while( text.find("\r\n\r\n") == std::string::npos )
+      {
+         if( text.size() > MAX_REQUEST_SIZE )
+         {
+            sendResponse( socket_, "413 Request Entity Too Large", "text/plain", "Request too large\n" );
+            return;
+         }
+         int received = recv( native(socket_), buffer, sizeof(buffer), 0 );
+         if( received <= 0 ) return;
+         text.append( buffer, received );
+      }
+
+      HttpRequest request;
+      if( !parseRequest( text, request ) )
+      {
+         sendResponse( socket_, "400 Bad Request", "text/plain", "Bad request\n" );
+         return;
+      }
+      if( request.method != "GET" )
+      {
+         sendResponse( socket_, "405 Method Not Allowed", "text/plain", "Only GET is supported\n" );
+         return;
+      }
+
+      // At most 3 characters per escaped one
+      char page[1024+3*MAX_PAGE_QUERY];
+      std::string query = escapeQuery( request.query.substr(0, MAX_PAGE_QUERY) );
+      if( request.path == "/" )
+      {
+         snprintf( page, sizeof(page), MJPEG_PAGE, query.c_str() );
+         sendResponse( socket_, "200 OK", "text/html", page );
+      }
+      else if( request.path == "/websocket" )
+      {
+         snprintf( page, sizeof(page), WEBSOCKET_PAGE, query.c_str() );
+         sendResponse( socket_, "200 OK", "text/html", page );
+      }
+      else if( request.path == "/frame.jpg" || request.path == "/stream.mjpeg" || request.path == "/stream" )
+      {
+         ViewSettings view = viewer_.getDefaultView();
+         parseVector( getQueryValue(request.query, "eye"), view.eye );
+         parseVector( getQueryValue(request.query, "dir"), view.direction );
+         parseVector( getQueryValue(request.query, "angles"), view.angles );
+         parseSize( getQueryValue(request.query, "width"), viewer_.getMaxWidth(), view.width );
+         parseSize( getQueryValue(request.query, "height"), viewer_.getMaxHeight(), view.height );
+
+         ViewStreamPtr stream = viewer_.subscribe( view );
+         if( !stream )
+         {
+            sendResponse( socket_, "503 Service Unavailable", "text/plain", "Server is shutting down\n" );
+            return;
+         }
+         try
+         {
+            if( request.path == "/frame.jpg" )
+               sendFrame( stream );
+            else if( request.path == "/stream.mjpeg" )
+               sendStream( stream, false );
+            else if( containsToken( getHeader(request, "upgrade"), "websocket" ) && acceptWebSocket( request ) )
+               sendStream( stream, true );
+            else
+               sendResponse( socket_, "400 Bad Request", "text/plain", "WebSocket upgrade expected\n" );
+         }
+         catch( ... )
+         {
+            stream->unsubscribe();
+            throw;
+         }
+         stream->unsubscribe();
+      }
+      else
+      {
+         sendResponse( socket_, "404 Not Found", "text/plain", "Not found\n" );
+      }
+   }
+
+   void sendFrame( const ViewStreamPtr& stream )
+   {
+      EncodedFramePtr frame = stream->waitForFrame( 0, FIRST_FRAME_TIMEOUT );
+      if( !frame )
+      {
+         sendResponse( socket_, "503 Service Unavailable", "text/plain", "No frame available\n" );
+         return;
+      }
+      char header[256];
+      snprintf( header, sizeof(header),
+         "HTTP/1.1 200 OK\r\nContent-Type: image/jpeg\r\nContent-Length: %d\r\nCache-Control: no-cache\r\nConnection: close\r\n\r\n",
+         static_cast<int>(frame->jpeg.size()) );
+      if( sendAll( socket_, header ) )
+         sendAll( socket_, reinterpret_cast<const char*>(&frame->jpeg[0]), frame->jpeg.size() );
+   }
+
+   bool acceptWebSocket( const HttpRequest& request )
+   {
+      std::string key = getHeader(request, "sec-websocket-key");
+      if( key.empty() ) return false;
+      unsigned char digest[20];
+      sha1( key+WEBSOCKET_GUID, digest );
+      return sendAll( socket_,
+         "HTTP/1.1 101 Switching Protocols\r\n"
+         "Upgrade: websocket\r\n"
+         "Connection: Upgrade\r\n"
+         "Sec-WebSocket-Accept: "+base64(digest, sizeof(digest))+"\r\n\r\n" );
+   }
+
+   void sendStream( const ViewStreamPtr& stream, bool webSocket )
+   {
+      if( !webSocket && !sendAll( socket_,
+         "HTTP/1.1 200 OK\r\n"
+         "Content-Type: multipart/x-mixed-replace; boundary=frame\r\n"
+         "Cache-Control: no-cache\r\n"
+         "Connection: close\r\n\r\n" ) ) return;
+
+      Ice::Long sequence(0);
+      while( true )
+      {
+         // Frames published while the previous one was being sent are
+         // skipped, the viewer gets the latest one
+         EncodedFramePtr frame = stream->waitForFrame( sequence, FRAME_TIMEOUT );
+         if( !frame )
+         {
+            if( stream->isStopped() || isClosed( socket_, webSocket ) ) return;
+            continue;
+         }
+         sequence = frame->sequence;
+
+         size_t size = frame->jpeg.size();
+         char header[128];
+         size_t headerSize;
+         if( webSocket )
+         {
+            // Final binary message, not masked
+            unsigned char* h = reinterpret_cast<unsigned char*>(header);
+            h[0] = 0x82;
+            if( size < 126 )
+            {
+               h[1] = static_cast<unsigned char>(size);
+               headerSize = 2;
+            }
+            else if( size < 65536 )
+            {
+               h[1] = 126;
+               h[2] = static_cast<unsigned char>(size>>8);
+               h[3] = static_cast<unsigned char>(size);
+               headerSize = 4;
+            }
+            else
+            {
+               h[1] = 127;
+               for( int i(0); i<8; ++i )
+                  h[2+i] = static_cast<unsigned char>(static_cast<unsigned long long>(size)>>((7-i)*8));
+               headerSize = 10;
+            }
+         }
+         else
+         {
+            headerSize = snprintf( header, sizeof(header),
+               "--frame\r\nContent-Type: image/jpeg\r\nContent-Length: %d\r\n\r\n",
+               static_cast<int>(size) );
+         }
+
+         if( !sendAll( socket_, header, headerSize ) ||
+             !sendAll( socket_, reinterpret_cast<const char*>(&frame->jpeg[0]), size ) ||
+             (!webSocket && !sendAll( socket_, "\r\n", 2 )) ) return;
+      }
+   }
+
+private:
+
+   HttpViewer& viewer_;
+   HttpSocket socket_;
+
+};
+
+HttpViewer::HttpViewer(
+   int port, int maxConnections,
+   const ViewSettings& defaultView, int maxWidth, int maxHeight,
+   RenderBackendPool& pool, SessionManager& sessions, FrameCache& frameCache,
+   int quality, int frameTime,
+   float pixelPitch, int cullingTileSize ) :
+   port_(port),
+   maxConnections_(maxConnections),
+   defaultView_(defaultView),
+   maxWidth_(maxWidth),
+   maxHeight_(maxHeight),
+   pool_(pool),
+   sessions_(sessions),
+   frameCache_(frameCache),
+   quality_(quality),
+   frameTime_(frameTime),
+   pixelPitch_(pixelPitch),
+   cullingTileSize_(cullingTileSize),
+   socket_(NO_SOCKET),
+   destroyed_(false)
+{
+}
+
+bool HttpViewer::listen()
+{
+#ifdef WIN32
+   WSADATA data;
+   WSAStartup( MAKEWORD(2, 2), &data );
+#endif
+   SOCKET s = socket( AF_INET, SOCK_STREAM, 0 );
+   if( s != INVALID_SOCKET )
+   {
+      int reuse(1);
+      setsockopt( s, SOL_SOCKET, SO_REUSEADDR, reinterpret_cast<const char*>(&reuse), sizeof(reuse) );
+
+      sockaddr_in address;
+      memset( &address, 0, sizeof(address) );
+      address.sin_family      = AF_INET;
+      address.sin_addr.s_addr = htonl(INADDR_ANY);
+      address.sin_port        = htons(static_cast<unsigned short>(port_));
+      if( bind( s, reinterpret_cast<sockaddr*>(&address), sizeof(address) ) == 0 && ::listen( s, 16 ) == 0 )
+      {
+         socket_ = static_cast<HttpSocket>(s);
+         APPL_LOG_INFO("HTTP viewer listening on port " << port_);
+         return true;
+      }
+      closesocket( s );
+   }
+
+   APPL_LOG_ERROR("HTTP viewer cannot listen on port " << port_);
+#ifdef WIN32
+   WSACleanup();
+#endif
+   return false;
+}
+
+void HttpViewer::run()
+{
+   while( true )
+   {
+      {
+         Lock lock(*this);
+         if( destroyed_ ) break;
+      }
+
+      // Accept is polled so that destroy does not depend on closing the
+      // socket to unblock it
+      fd_set readable;
+      FD_ZERO(&readable);
+      FD_SET(native(socket_), &readable);
+      timeval timeout = { 0, 200000 };
+      if( select( static_cast<int>(native(socket_)+1), &readable, 0, 0, &timeout ) <= 0 ) continue;
+
+      SOCKET s = accept( native(socket_), 0, 0 );
+      if( s == INVALID_SOCKET ) continue;
+      HttpSocket connection = static_cast<HttpSocket>(s);
+
+#ifdef WIN32
+      DWORD sendTimeout = SEND_TIMEOUT*1000;
+#else
+      timeval sendTimeout = { SEND_TIMEOUT, 0 };
+#endif
+      setsockopt( s, SOL_SOCKET, SO_SNDTIMEO, reinterpret_cast<const char*>(&sendTimeout), sizeof(sendTimeout) );
+
+      {
+         Lock lock(*this);
+         if( !destroyed_ && static_cast<int>(connections_.size()) < maxConnections_ )
+         {
+            connections_.insert( connection );
+            IceUtil::ThreadPtr thread = new HttpConnection( *this, connection );
+            thread->start().detach();
+            continue;
+         }
+      }
+      sendResponse( connection, "503 Service Unavailable", "text/plain", "Too many viewers\n" );
+      closesocket( s );
+   }
+
+   closesocket( native(socket_) );
+#ifdef WIN32
+   WSACleanup();
+#endif
+}
+
+void HttpViewer::destroy()
+{
+   std::map<std::string, ViewStreamPtr> views;
+   {
+      Lock lock(*this);
+      destroyed_ = true;
+
+      // Blocked sends and receives return, and connections end
+      for( std::map<std::string, ViewStreamPtr>::iterator it = views_.begin(); it != views_.end(); ++it )
+         it->second->destroy();
+      for( std::set<HttpSocket>::iterator it = connections_.begin(); it != connections_.end(); ++it )
+         shutdown( native(*it), SHUT_RDWR );
+      while( !connections_.empty() ) wait();
+      views.swap( views_ );
+   }
+
+   for( std::map<std::string, ViewStreamPtr>::iterator it = views.begin(); it != views.end(); ++it )
+      it->second->getThreadControl().join();
+}
+
+ViewStreamPtr HttpViewer::subscribe( const ViewSettings& view )
+{
+   char id[256];
+   snprintf( id, sizeof(id), "http:%g,%g,%g:%g,%g,%g:%g,%g,%g:%dx%d",
+      view.eye.x, view.eye.y, view.eye.z,
+      view.direction.x, view.direction.y, view.direction.z,
+      view.angles.x, view.angles.y, view.angles.z,
+      view.width, view.height );
+
+   Lock lock(*this);
+   if( destroyed_ ) return 0;
+
+   std::map<std::string, ViewStreamPtr>::iterator it = views_.find(id);
+   if( it != views_.end() && it->second->subscribe() ) return it->second;
+
+   // Streams stop when their last viewer leaves
+   it = views_.begin();
+   while( it != views_.end() )
+   {
+      if( it->second->isStopped() )
+      {
+         it->second->getThreadControl().join();
+         views_.erase( it++ );
+      }
+      else
+      {
+         ++it;
+      }
+   }
+
+   ViewStreamPtr stream = new ViewStream( id, view, pool_, sessions_, frameCache_, quality_, frameTime_,
+      pixelPitch_, cullingTileSize_ );
+   stream->subscribe();
+   stream->start();
+   views_[id] = stream;
+   return stream;
+}
+
+void HttpViewer::connectionClosed( HttpSocket socket )
+{
+   Lock lock(*this);
+   connections_.erase( socket );
+   notifyAll();
+}
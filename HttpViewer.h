@@ -0,0 +1,96 @@
+#pragma once
+
+// System
+#include <map>
+#include <set>
+#include <string>
+
+// Ice
+#include <IceUtil/Thread.h>
+#include <IceUtil/Monitor.h>
+
+// Project
+#include "ViewStream.h"
+
+// Native socket handle: SOCKET on Windows, file descriptor elsewhere
+typedef size_t HttpSocket;
+
+/*
+* @brief Embedded HTTP server letting browsers watch renders without a
+* client application. Each connection is served by its own thread:
+*   GET /             page showing the MJPEG stream
+*   GET /websocket    page showing the WebSocket stream
+*   GET /stream.mjpeg multipart JPEG stream
+*   GET /stream       WebSocket stream, one binary message per JPEG frame
+*   GET /frame.jpg    latest frame
+* The view is given by the query string, e.g.
+* eye=0,0,-5000&dir=0,0,0&angles=0,0,0&width=768&height=512, missing values
+* keeping the defaults of the server. Kernel buffers are sized for the scene
+* of the server, so larger sizes are clamped to maxWidth x maxHeight. Viewers of the same view share the
+* same ViewStream, and therefore the same encoded frames.
+*/
+class HttpViewer : public IceUtil::Thread, public IceUtil::Monitor<IceUtil::Mutex>
+{
+
+public:
+
+   HttpViewer(
+      int port, int maxConnections,
+      const ViewSettings& defaultView, int maxWidth, int maxHeight,
+      RenderBackendPool& pool, SessionManager& sessions, FrameCache& frameCache,
+      int quality, int frameTime,
+      float pixelPitch, int cullingTileSize );
+
+public:
+
+   /**
+   * @brief Opens the listening socket, returns false when the port cannot
+   * be bound
+   */
+   bool listen();
+
+   virtual void run();
+
+   /**
+   * @brief Closes all connections and stops all views. The caller must then
+   * join the thread.
+   */
+   void destroy();
+
+public:
+
+   const ViewSettings& getDefaultView() const { return defaultView_; }
+   int getMaxWidth() const { return maxWidth_; }
+   int getMaxHeight() const { return maxHeight_; }
+
+   /**
+   * @brief Returns the running stream of a view, started if needed, with a
+   * new viewer registered. Returns null when the server is being destroyed.
+   */
+   ViewStreamPtr subscribe( const ViewSettings& view );
+
+   void connectionClosed( HttpSocket socket );
+
+private:
+
+   int port_;
+   int maxConnections_;
+   ViewSettings defaultView_;
+   int maxWidth_;
+   int maxHeight_;
+   RenderBackendPool& pool_;
+   SessionManager& sessions_;
+   FrameCache& frameCache_;
+   int quality_;
+   int frameTime_;
+   float pixelPitch_;
+   int cullingTileSize_;
+
+   HttpSocket socket_;
+   bool destroyed_;
+   std::set<HttpSocket> connections_;
+   std::map<std::string, ViewStreamPtr> views_;
+
+};
+
+typedef IceUtil::Handle<HttpViewer> HttpViewerPtr;
@@ -1,10 +1,81 @@
+// System
+#include <string.h>
+#include <algorithm>
+
+// Project
 #include "Trace.h"
 #include "IIceStreamerImpl.h"
 
-IIceStreamerImpl::IIceStreamerImpl( CudaKernel* cudaKernel ) :
-   cudaKernel_(cudaKernel)
+namespace
+{
+   // Coarsest level of progressive frames, 1/8 of the resolution
+   const int MAX_FRAME_LEVEL = 3;
+
+   // Tile size of the frames served while the scene loads
+   const int PLACEHOLDER_TILE_SIZE = 16;
+
+   // Layer updates of the calls of a session
+   class SceneInfoUpdate : public LayerUpdate
+   {
+   public:
+      SceneInfoUpdate( const ::IceStreamer::SceneInfo& sceneInfo ) : sceneInfo_(sceneInfo) {}
+      virtual SceneLayerPtr apply( const SceneLayerPtr& layer ) const
+      {
+         if( layer->hasSceneInfo() && layer->getSceneInfo() == sceneInfo_ ) return layer;
+         return layer->withSceneInfo(sceneInfo_);
+      }
+   private:
+      const ::IceStreamer::SceneInfo& sceneInfo_;
+   };
+
+   class MaterialUpdate : public LayerUpdate
+   {
+   public:
+      MaterialUpdate( int index, const MaterialDescription& material ) : index_(index), material_(material) {}
+      virtual SceneLayerPtr apply( const SceneLayerPtr& layer ) const
+      {
+         return layer->withMaterial(index_, material_);
+      }
+   private:
+      int index_;
+      const MaterialDescription& material_;
+   };
+
+   class MaterialsReset : public LayerUpdate
+   {
+   public:
+      virtual SceneLayerPtr apply( const SceneLayerPtr& layer ) const
+      {
+         return layer->withoutMaterials();
+      }
+   };
+
+   class PostProcessingStagesUpdate : public LayerUpdate
+   {
+   public:
+      PostProcessingStagesUpdate( const ::IceStreamer::PostProcessingStages& stages ) : stages_(stages) {}
+      virtual SceneLayerPtr apply( const SceneLayerPtr& layer ) const
+      {
+         return layer->withPostProcessingStages(stages_);
+      }
+   private:
+      const ::IceStreamer::PostProcessingStages& stages_;
+   };
+}
+
+IIceStreamerImpl::IIceStreamerImpl(
+   RenderBackendPool& pool, SessionManager& sessions,
+   FrameCache& frameCache, const SpeculatorPtr& speculator,
+   float pixelPitch, const DepthEstimator& depthEstimator,
+   BroadcastManager& broadcasts ) :
+   pool_(pool),
+   sessions_(sessions),
+   frameCache_(frameCache),
+   speculator_(speculator),
+   pixelPitch_(pixelPitch),
+   depthEstimator_(depthEstimator),
+   broadcasts_(broadcasts)
 {
-   SceneInfo sceneInfo = cudaKernel_->getSceneInfo();
 }
 
 
@@ -18,79 +89,631 @@ IIceStreamerImpl::~IIceStreamerImpl(void)
    ::Ice::Float ax, ::Ice::Float ay, ::Ice::Float az,
    const ::IceStreamer::SceneInfo& scInfo,
    const ::IceStreamer::PostProcessingInfo& ppInfo, 
-   const Ice::Current & )
+   const Ice::Current& current )
 {
 	::IceStreamer::bytes result;
 	try 
    {
-      int colorDepth;
-      switch( scInfo.outputType )
+      SessionPtr session = sessions_.getSession(getSessionId(current));
+      FlowTicket ticket(session->getFlowController());
+      FrameRequest request;
+      buildRequest( ex, ey, ez, dx, dy, dz, ax, ay, az, scInfo, ppInfo, session, request );
+      renderRequest( request, session, ticket, result );
+      ticket.setFrameSize( result.size() );
+	}
+   catch( const ::IceStreamer::FrameRejected& )
+   {
+      // Feedback for the client
+      throw;
+   }
+	catch( ... )
+	{
+		std::cout << "*** ERROR *** getBitmap failed" << std::endl;
+	}
+   return result;
+}
+
+::IceStreamer::Frame IIceStreamerImpl::getFrame( 
+   ::Ice::Float ex, ::Ice::Float ey, ::Ice::Float ez, 
+   ::Ice::Float dx, ::Ice::Float dy, ::Ice::Float dz, 
+   ::Ice::Float ax, ::Ice::Float ay, ::Ice::Float az,
+   const ::IceStreamer::SceneInfo& scInfo,
+   const ::IceStreamer::PostProcessingInfo& ppInfo, 
+   bool withDepth,
+   const Ice::Current& current )
+{
+   ::IceStreamer::Frame frame;
+   frame.depthTileSize = 0;
+   frame.depthWidth    = 0;
+   frame.depthHeight   = 0;
+	try 
+   {
+      SessionPtr session = sessions_.getSession(getSessionId(current));
+      FlowTicket ticket(session->getFlowController());
+      FrameRequest request;
+      buildRequest( ex, ey, ez, dx, dy, dz, ax, ay, az, scInfo, ppInfo, session, request );
+      renderRequest( request, session, ticket, frame.color );
+      if( withDepth ) estimateDepth( request, scInfo, frame );
+      ticket.setFrameSize( frame.color.size()+frame.depth.size()*sizeof(Ice::Short) );
+	}
+   catch( const ::IceStreamer::FrameRejected& )
+   {
+      // Feedback for the client
+      throw;
+   }
+	catch( ... )
+	{
+		std::cout << "*** ERROR *** getFrame failed" << std::endl;
+	}
+   return frame;
+}
+
+::IceStreamer::FrameLevel IIceStreamerImpl::getFrameLevel( 
+   ::Ice::Float ex, ::Ice::Float ey, ::Ice::Float ez, 
+   ::Ice::Float dx, ::Ice::Float dy, ::Ice::Float dz, 
+   ::Ice::Float ax, ::Ice::Float ay, ::Ice::Float az,
+   const ::IceStreamer::SceneInfo& scInfo,
+   const ::IceStreamer::PostProcessingInfo& ppInfo, 
+   ::Ice::Int level,
+   bool refinement,
+   bool withDepth,
+   const Ice::Current& current )
+{
+   ::IceStreamer::FrameLevel result;
+   result.level      = std::max(0, std::min(static_cast<int>(level), MAX_FRAME_LEVEL));
+   result.refinement = refinement;
+   int scale = 1<<result.level;
+   result.width  = (scInfo.width+scale-1)/scale;
+   result.height = (scInfo.height+scale-1)/scale;
+   ::IceStreamer::Frame& frame = result.frame;
+   frame.depthTileSize = 0;
+   frame.depthWidth    = 0;
+   frame.depthHeight   = 0;
+	try 
+   {
+      SessionPtr session = sessions_.getSession(getSessionId(current));
+      FlowTicket ticket(session->getFlowController());
+      FrameRequest request;
+      buildRequest( ex, ey, ez, dx, dy, dz, ax, ay, az, scInfo, ppInfo, session, request );
+      request.level = result.level;
+      if( refinement )
       {
-      case ::IceStreamer::otOpenGL:
-      case ::IceStreamer::otJPEG:
-         colorDepth = 4;
-      default:
-         colorDepth = 3;
+         ::IceStreamer::bytes pixels;
+         renderRequest( request, session, ticket, pixels );
+         extractRefinement( pixels, result.width, result.height, frame.color );
       }
-      int imageSize = scInfo.width*scInfo.height*colorDepth;
-      char* bitmap = new char[imageSize];
-
-	   float4 eye = {ex, ey, ez, 0.f};
-	   float4 direction = {dx, dy, dz, 0.f};
-	   float4 angle = {ax, ay, az, 0.f};
-
-      // Scene Information
-      SceneInfo sceneInfo;
-      sceneInfo.width.x              = scInfo.width;
-      sceneInfo.height.x             = scInfo.height;
-      sceneInfo.shadowsEnabled.x     = scInfo.shadowsEnabled;
-      sceneInfo.nbRayIterations.x    = scInfo.nbRayIterations;
-      sceneInfo.transparentColor.x   = scInfo.transparentColor;
-      sceneInfo.viewDistance.x       = scInfo.viewDistance;
-      sceneInfo.shadowIntensity.x    = scInfo.shadowIntensity;
-      sceneInfo.width3DVision.x      = scInfo.width3DVision;
-      sceneInfo.backgroundColor.x    = scInfo.backgroundColorR;
-      sceneInfo.backgroundColor.y    = scInfo.backgroundColorG;
-      sceneInfo.backgroundColor.z    = scInfo.backgroundColorB;
-      sceneInfo.supportFor3DVision.x = scInfo.supportFor3DVision;
-      sceneInfo.renderBoxes.x        = scInfo.renderBoxes;
-      sceneInfo.pathTracingIteration.x = 0;//scInfo.pathTracingIteration;
-      sceneInfo.maxPathTracingIterations.x = scInfo.maxPathTracingIterations;
-      sceneInfo.misc.x               = scInfo.outputType;
-      sceneInfo.misc.y               = scInfo.timer;
-      sceneInfo.misc.z               = scInfo.fog;
-      sceneInfo.misc.w               = scInfo.isometric3D;
-      cudaKernel_->setSceneInfo(sceneInfo);
-
-      // PostProcessing effect
-      PostProcessingInfo postProcessingInfo;
-      postProcessingInfo.type.x   = ppInfo.type;
-      postProcessingInfo.param1.x = ppInfo.param1;
-      postProcessingInfo.param2.x = ppInfo.param2;
-      postProcessingInfo.param3.x = ppInfo.param3;
-      cudaKernel_->setPostProcessingInfo(postProcessingInfo);
-
-      cudaKernel_->setCamera(eye, direction, angle);
-      cudaKernel_->render_begin( 0 );
-      cudaKernel_->render_end( bitmap );
-
-	   for( int i(0); i<imageSize; ++i) 
-         result.push_back( bitmap[i]);
-
-      delete [] bitmap;
+      else
+      {
+         renderRequest( request, session, ticket, frame.color );
+      }
+      if( withDepth ) estimateDepth( request, scInfo, frame );
+      ticket.setFrameSize( frame.color.size()+frame.depth.size()*sizeof(Ice::Short) );
 	}
+   catch( const ::IceStreamer::FrameRejected& )
+   {
+      // Feedback for the client
+      throw;
+   }
 	catch( ... )
 	{
-		std::cout << "*** ERROR *** getBitmap failed" << std::endl;
+		std::cout << "*** ERROR *** getFrameLevel failed" << std::endl;
 	}
    return result;
 }
 
+::IceStreamer::StereoFrame IIceStreamerImpl::getStereoFrame( 
+   ::Ice::Float ex, ::Ice::Float ey, ::Ice::Float ez, 
+   ::Ice::Float dx, ::Ice::Float dy, ::Ice::Float dz, 
+   ::Ice::Float ax, ::Ice::Float ay, ::Ice::Float az,
+   const ::IceStreamer::SceneInfo& scInfo,
+   const ::IceStreamer::PostProcessingInfo& ppInfo, 
+   bool deltaEncoded,
+   const Ice::Current& current )
+{
+   ::IceStreamer::StereoFrame frame;
+   frame.width      = scInfo.width;
+   frame.height     = scInfo.height;
+   frame.colorDepth = 0;
+   frame.rightDelta = deltaEncoded;
+	try 
+   {
+      SessionPtr session = sessions_.getSession(getSessionId(current));
+      FlowTicket ticket(session->getFlowController());
+      FrameRequest request;
+      buildRequest( ex, ey, ez, dx, dy, dz, ax, ay, az, scInfo, ppInfo, session, request );
+      ::IceStreamer::bytes left, right;
+      renderStereoRequest( request, session, ticket, left, right );
+
+      size_t nbPixels = scInfo.width*scInfo.height;
+      if( nbPixels != 0 ) frame.colorDepth = static_cast<int>(left.size()/nbPixels);
+
+      // Left eye, then right eye
+      size_t size = left.size();
+      frame.pixels.resize( 2*size );
+      std::copy( left.begin(), left.end(), frame.pixels.begin() );
+      if( deltaEncoded )
+      {
+         for( size_t i(0); i<size; ++i )
+            frame.pixels[size+i] = static_cast< ::Ice::Byte>(right[i]-left[i]);
+      }
+      else
+      {
+         std::copy( right.begin(), right.end(), frame.pixels.begin()+size );
+      }
+      ticket.setFrameSize( frame.pixels.size() );
+	}
+   catch( const ::IceStreamer::FrameRejected& )
+   {
+      // Feedback for the client
+      throw;
+   }
+	catch( ... )
+	{
+		std::cout << "*** ERROR *** getStereoFrame failed" << std::endl;
+	}
+   return frame;
+}
+
+void IIceStreamerImpl::updateCamera(
+   const ::IceStreamer::CameraEvent& event,
+   const ::Ice::Current& current )
+{
+   SessionPtr session = sessions_.getSession(getSessionId(current));
+   session->getInput().updateCamera( event );
+}
+
+void IIceStreamerImpl::updateSettings(
+   ::Ice::Long sequence,
+   const ::IceStreamer::SceneInfo& scInfo,
+   const ::IceStreamer::PostProcessingInfo& ppInfo,
+   const ::Ice::Current& current )
+{
+   SessionPtr session = sessions_.getSession(getSessionId(current));
+   session->getInput().updateSettings( sequence, scInfo, ppInfo );
+}
+
+::IceStreamer::InputFrame IIceStreamerImpl::getLatestFrame(
+   bool withDepth,
+   const ::Ice::Current& current )
+{
+   SessionPtr session = sessions_.getSession(getSessionId(current));
+   ::IceStreamer::InputFrame result;
+   bool hasCamera;
+   bool hasSettings;
+   ::IceStreamer::SceneInfo scInfo;
+   ::IceStreamer::PostProcessingInfo ppInfo;
+   result.sequence = session->getInput().getState( result.camera, hasCamera, hasSettings, scInfo, ppInfo );
+   result.reset    = !hasCamera;
+   if( result.reset )
+   {
+      // Nothing worth rendering until the client sends its camera again
+      result.frame.depthTileSize = 0;
+      result.frame.depthWidth    = 0;
+      result.frame.depthHeight   = 0;
+      return result;
+   }
+   if( !hasSettings )
+   {
+      // Scene defaults until the client sends its settings
+      SceneSnapshotPtr snapshot = sessions_.getSnapshot();
+      scInfo = toIceSceneInfo(snapshot->getSceneInfo());
+      ppInfo = toIcePostProcessingInfo(snapshot->getPostProcessingInfo());
+   }
+
+   const ::IceStreamer::CameraState& c = result.camera;
+   result.frame = getFrame(
+      c.ex, c.ey, c.ez, c.dx, c.dy, c.dz, c.ax, c.ay, c.az,
+      scInfo, ppInfo, withDepth, current );
+   return result;
+}
+
 ::IceStreamer::SceneInfo IIceStreamerImpl::getSceneInfo(
-  const ::Ice::Current& )
+  const ::Ice::Current& current )
+{
+   // A session gets its own settings back, new sessions get the defaults
+   // of the scene
+   SessionPtr session = sessions_.getSession(getSessionId(current));
+   SceneLayerPtr layer = session->getLayer();
+   if( layer->hasSceneInfo() ) return layer->getSceneInfo();
+   return toIceSceneInfo(sessions_.getSnapshot()->getSceneInfo());
+}
+
+void IIceStreamerImpl::setMaterial(
+   ::Ice::Int index,
+   const ::IceStreamer::MaterialInfo& material,
+   const ::Ice::Current& current )
 {
+   SceneSnapshotPtr snapshot = sessions_.getSnapshot();
+   if( index < 0 || index >= static_cast<int>(snapshot->getMaterials().size()) )
+   {
+      APPL_LOG_WARNING("Invalid material index " << index);
+      return;
+   }
+
+   // Properties that are not exposed keep the value of the scene
+   MaterialDescription description = snapshot->getMaterials()[index];
+   description.r                 = material.r;
+   description.g                 = material.g;
+   description.b                 = material.b;
+   description.reflection        = material.reflection;
+   description.refraction        = material.refraction;
+   description.transparency      = material.transparency;
+   description.specularValue     = material.specularValue;
+   description.specularPower     = material.specularPower;
+   description.innerIllumination = material.innerIllumination;
+
+   SessionPtr session = sessions_.getSession(getSessionId(current));
+   session->updateLayer( MaterialUpdate(index, description) );
+}
+
+void IIceStreamerImpl::resetMaterials(
+   const ::Ice::Current& current )
+{
+   SessionPtr session = sessions_.getSession(getSessionId(current));
+   session->updateLayer( MaterialsReset() );
+}
+
+::IceStreamer::FrameCacheStatistics IIceStreamerImpl::getFrameCacheStatistics(
+   const ::Ice::Current& )
+{
+   return frameCache_.getStatistics();
+}
+
+::IceStreamer::FlowStatistics IIceStreamerImpl::getFlowStatistics(
+   const ::Ice::Current& current )
+{
+   SessionPtr session = sessions_.getSession(getSessionId(current));
+   return session->getFlowController().getStatistics();
+}
+
+void IIceStreamerImpl::setPostProcessingStages(
+   const ::IceStreamer::PostProcessingStages& stages,
+   const ::Ice::Current& current )
+{
+   SessionPtr session = sessions_.getSession(getSessionId(current));
+   session->updateLayer( PostProcessingStagesUpdate(stages) );
+}
+
+::IceStreamer::PostProcessingStatistics IIceStreamerImpl::getPostProcessingStatistics(
+   const ::Ice::Current& )
+{
+   PostProcessorTimings timings;
+   memset( &timings, 0, sizeof(timings) );
+   for( size_t i(0); i<pool_.size(); ++i )
+   {
+      RenderBackend* backend = pool_.getBackend(i);
+      IceUtil::Mutex::Lock lock(backend->getMutex());
+      const PostProcessorTimings& backendTimings = backend->getPostProcessorTimings();
+      for( int stage(0); stage<psCount; ++stage )
+      {
+         timings.frames[stage]       += backendTimings.frames[stage];
+         timings.milliseconds[stage] += backendTimings.milliseconds[stage];
+      }
+   }
+
+   ::IceStreamer::PostProcessingStatistics statistics;
+   for( int stage(0); stage<psCount; ++stage )
+   {
+      ::IceStreamer::PostProcessingStageStatistics stageStatistics;
+      stageStatistics.name        = PostProcessor::getStageName(stage);
+      stageStatistics.frames      = timings.frames[stage];
+      stageStatistics.averageTime = timings.frames[stage] ? timings.milliseconds[stage]/timings.frames[stage] : 0.0;
+      statistics.push_back( stageStatistics );
+   }
+   return statistics;
+}
+
+void IIceStreamerImpl::presentChannel(
+   const std::string& name,
+   const ::Ice::Current& current )
+{
+   SessionPtr session = sessions_.getSession(getSessionId(current));
+   broadcasts_.present( name, session, *this );
+}
+
+void IIceStreamerImpl::closeChannel(
+   const std::string& name,
+   const ::Ice::Current& current )
+{
+   SessionPtr session = sessions_.getSession(getSessionId(current));
+   broadcasts_.close( name, session );
+}
+
+void IIceStreamerImpl::getBroadcastFrame_async(
+   const ::IceStreamer::AMD_BitmapProvider_getBroadcastFramePtr& cb,
+   const std::string& name,
+   ::Ice::Int tier,
+   ::Ice::Long lastSequence,
+   const ::Ice::Current& )
+{
+   // Viewers have no session, they never render anything themselves
+   BroadcastChannelPtr channel = broadcasts_.find( name );
+   if( !channel )
+   {
+      ::IceStreamer::ChannelUnavailable e;
+      e.reason = "No channel " + name;
+      cb->ice_exception( e );
+      return;
+   }
+   channel->getFrame( cb, tier, lastSequence );
+}
+
+void IIceStreamerImpl::renderBroadcast(
+   const SessionPtr& presenter, const std::string& channelId,
+   ::IceStreamer::bytes& frame, int& width, int& height,
+   Ice::Long& key, int& sceneVersion )
+{
+   ::IceStreamer::CameraState camera;
+   bool hasCamera;
+   bool hasSettings;
+   ::IceStreamer::SceneInfo scInfo;
+   ::IceStreamer::PostProcessingInfo ppInfo;
+   presenter->getInput().getState( camera, hasCamera, hasSettings, scInfo, ppInfo );
+   SceneSnapshotPtr snapshot = sessions_.getSnapshot();
+   if( !hasSettings )
+   {
+      // Scene defaults until the presenter sends its settings
+      scInfo = toIceSceneInfo(snapshot->getSceneInfo());
+      ppInfo = toIcePostProcessingInfo(snapshot->getPostProcessingInfo());
+   }
+   width  = scInfo.width;
+   height = scInfo.height;
+
+   // Frames of the presenter's own requests are shared through the cache
+   FrameRequest request;
+   buildRequest(
+      camera.ex, camera.ey, camera.ez, camera.dx, camera.dy, camera.dz, camera.ax, camera.ay, camera.az,
+      scInfo, ppInfo, presenter, request );
+   sceneVersion = snapshot->getVersion();
+   frameCache_.quantize( request );
+   key = frameCache_.computeKey( request, sceneVersion );
+   if( frameCache_.find( key, sceneVersion, frame ) ) return;
+   {
+      ScopedBackend backend(pool_, channelId);
+      if( !backend.isValid() )
+      {
+         RenderBackend::renderPlaceholder( request, snapshot->getBounds(), pixelPitch_, PLACEHOLDER_TILE_SIZE, frame );
+         return;
+      }
+      IceUtil::Mutex::Lock lock(backend->getMutex());
+      backend->render( request, frame );
+   }
+   frameCache_.insert( key, sceneVersion, frame );
+}
+
+void IIceStreamerImpl::buildRequest(
+   ::Ice::Float ex, ::Ice::Float ey, ::Ice::Float ez, 
+   ::Ice::Float dx, ::Ice::Float dy, ::Ice::Float dz, 
+   ::Ice::Float ax, ::Ice::Float ay, ::Ice::Float az,
+   const ::IceStreamer::SceneInfo& scInfo,
+   const ::IceStreamer::PostProcessingInfo& ppInfo,
+   const SessionPtr& session,
+   FrameRequest& request )
+{
+	float4 eye = {ex, ey, ez, 0.f};
+	float4 direction = {dx, dy, dz, 0.f};
+	float4 angle = {ax, ay, az, 0.f};
+   request.eye       = eye;
+   request.direction = direction;
+   request.angles    = angle;
+
    // Scene Information
-   SceneInfo scInfo = cudaKernel_->getSceneInfo();
+   request.sceneInfo = toKernelSceneInfo(scInfo);
+
+   // PostProcessing effect
+   PostProcessingInfo& postProcessingInfo = request.postProcessingInfo;
+   postProcessingInfo.type.x   = ppInfo.type;
+   postProcessingInfo.param1.x = ppInfo.param1;
+   postProcessingInfo.param2.x = ppInfo.param2;
+   postProcessingInfo.param3.x = ppInfo.param3;
+
+   // Settings are remembered per session
+   SceneLayerPtr layer = session->updateLayer( SceneInfoUpdate(scInfo) );
+   request.layer = layer;
+
+   // Server side post processing. Parameters of disabled stages are zeroed
+   // so that they do not make otherwise identical frames different.
+   const ::IceStreamer::PostProcessingStages& stages = layer->getPostProcessingStages();
+   PostProcessorSettings& settings = request.postProcessor;
+   memset( &settings, 0, sizeof(settings) );
+   settings.denoise      = stages.denoise;
+   settings.depthOfField = stages.depthOfField;
+   settings.toneMapping  = stages.toneMapping;
+   settings.antiAliasing = stages.antiAliasing;
+   if( stages.denoise ) settings.iterations = scInfo.maxPathTracingIterations;
+   if( stages.depthOfField )
+   {
+      // Replaces the kernel depth of field
+      settings.focus    = ppInfo.param1;
+      settings.strength = ppInfo.param2;
+      settings.radius   = ppInfo.param3;
+      postProcessingInfo.type.x = ppe_none;
+   }
+   if( stages.toneMapping )
+   {
+      settings.exposure   = stages.exposure;
+      settings.whitePoint = stages.whitePoint;
+   }
+}
+
+void IIceStreamerImpl::estimateDepth(
+   const FrameRequest& request,
+   const ::IceStreamer::SceneInfo& scInfo,
+   ::IceStreamer::Frame& frame )
+{
+   // The camera model is perspective only: isometric frames have no depth,
+   // and clients do not reproject them
+   if( scInfo.isometric3D != 0 )
+   {
+      frame.depth.clear();
+      frame.depthWidth    = 0;
+      frame.depthHeight   = 0;
+      frame.depthTileSize = 0;
+      return;
+   }
+
+   // Requests keep the size of the full frame, whatever the level
+   std::vector<unsigned short> depth;
+   depthEstimator_.estimate(
+      sessions_.getSnapshot()->getBounds(),
+      request.getCameraModel(pixelPitch_),
+      scInfo.width, scInfo.height, scInfo.viewDistance,
+      depth, frame.depthWidth, frame.depthHeight );
+   frame.depthTileSize = depthEstimator_.getTileSize();
+   frame.depth.assign( depth.begin(), depth.end() );
+}
+
+void IIceStreamerImpl::renderRequest(
+   FrameRequest& request,
+   const SessionPtr& session,
+   const FlowTicket& ticket,
+   ::IceStreamer::bytes& result )
+{
+   // Identical views are only rendered once
+   int sceneVersion = sessions_.getSnapshot()->getVersion();
+   frameCache_.quantize( request );
+   Ice::Long key = frameCache_.computeKey( request, sceneVersion );
+   if( speculator_ ) speculator_->cancel( session->getId() );
+   if( !frameCache_.find( key, sceneVersion, result ) )
+   {
+      // Levels sample the full frame of the same camera when it is cached
+      FrameRequest full(request);
+      full.level = 0;
+      Ice::Long fullKey = (request.level > 0) ? frameCache_.computeKey( full, sceneVersion ) : key;
+      ::IceStreamer::bytes fullFrame;
+      if( request.level > 0 && frameCache_.find( fullKey, sceneVersion, fullFrame ) )
+      {
+         RenderBackend::sampleLevel( request, fullFrame, result );
+      }
+      else
+      {
+         bool sampled(false);
+         {
+            ScopedBackend backend(pool_, session->getId());
+            if( !backend.isValid() )
+            {
+               // The scene is still loading, placeholders are not cached
+               RenderBackend::renderPlaceholder( request, sessions_.getSnapshot()->getBounds(),
+                  pixelPitch_, PLACEHOLDER_TILE_SIZE, result );
+               return;
+            }
+            IceUtil::Mutex::Lock lock(backend->getMutex());
+
+            // The client is only interested in its latest request
+            ticket.checkSuperseded();
+
+            // A level the backend cannot render as a smaller image costs a
+            // full frame, which is kept for the next levels of the camera
+            sampled = request.level > 0 && !backend->rendersLevelView(request);
+            if( sampled ) backend->render( full, fullFrame );
+            else backend->render( request, result );
+         }
+         if( sampled )
+         {
+            frameCache_.insert( fullKey, sceneVersion, fullFrame );
+            RenderBackend::sampleLevel( request, fullFrame, result );
+         }
+      }
+      frameCache_.insert( key, sceneVersion, result );
+   }
+
+   // Pre-render the next frame of a steady motion
+   FrameRequest prediction;
+   if( speculator_ && session->predict( request, prediction ) )
+   {
+      frameCache_.quantize( prediction );
+      Ice::Long predictedKey = frameCache_.computeKey( prediction, sceneVersion );
+      if( !frameCache_.contains( predictedKey, sceneVersion ) )
+         speculator_->submit( session->getId(), prediction, predictedKey, sceneVersion );
+   }
+}
+
+void IIceStreamerImpl::renderStereoRequest(
+   FrameRequest& request,
+   const SessionPtr& session,
+   const FlowTicket& ticket,
+   ::IceStreamer::bytes& left,
+   ::IceStreamer::bytes& right )
+{
+   int sceneVersion = sessions_.getSnapshot()->getVersion();
+   frameCache_.quantize( request );
+   float offset = 0.5f*request.sceneInfo.width3DVision.x;
+   FrameRequest leftRequest, rightRequest;
+   getEyeRequest( request, -offset, leftRequest );
+   getEyeRequest( request,  offset, rightRequest );
+   Ice::Long leftKey  = frameCache_.computeKey( leftRequest, sceneVersion );
+   Ice::Long rightKey = frameCache_.computeKey( rightRequest, sceneVersion );
+
+   if( speculator_ ) speculator_->cancel( session->getId() );
+   bool hasLeft  = frameCache_.find( leftKey, sceneVersion, left );
+   bool hasRight = frameCache_.find( rightKey, sceneVersion, right );
+   if( !hasLeft || !hasRight )
+   {
+      {
+         ScopedBackend backend(pool_, session->getId());
+         if( !backend.isValid() )
+         {
+            const std::vector<BoundingBox>& bounds = sessions_.getSnapshot()->getBounds();
+            RenderBackend::renderPlaceholder( leftRequest, bounds, pixelPitch_, PLACEHOLDER_TILE_SIZE, left );
+            RenderBackend::renderPlaceholder( rightRequest, bounds, pixelPitch_, PLACEHOLDER_TILE_SIZE, right );
+            return;
+         }
+         IceUtil::Mutex::Lock lock(backend->getMutex());
+
+         // The client is only interested in its latest request
+         ticket.checkSuperseded();
+         backend->renderStereo( leftRequest, rightRequest,
+            hasLeft ? 0 : &left, hasRight ? 0 : &right );
+      }
+      if( !hasLeft ) frameCache_.insert( leftKey, sceneVersion, left );
+      if( !hasRight ) frameCache_.insert( rightKey, sceneVersion, right );
+   }
+}
+
+void IIceStreamerImpl::getEyeRequest( const FrameRequest& request, float offset, FrameRequest& eye )
+{
+   // Parallel cameras: the eye and the image plane are moved together, and
+   // the rotation around the origin applies to both eyes alike
+   eye = request;
+   eye.eye.x       += offset;
+   eye.direction.x += offset;
+   eye.sceneInfo.supportFor3DVision.x = ::IceStreamer::vtStandard;
+}
+
+std::string IIceStreamerImpl::getSessionId( const ::Ice::Current& current )
+{
+   // Collocated calls have no connection
+   return current.con ? current.con->toString() : std::string("local");
+}
+
+SceneInfo IIceStreamerImpl::toKernelSceneInfo( const ::IceStreamer::SceneInfo& scInfo )
+{
+   // Lanes that are not set stay zeroed
+   SceneInfo sceneInfo = SceneInfo();
+   sceneInfo.width.x              = scInfo.width;
+   sceneInfo.height.x             = scInfo.height;
+   sceneInfo.shadowsEnabled.x     = scInfo.shadowsEnabled;
+   sceneInfo.nbRayIterations.x    = scInfo.nbRayIterations;
+   sceneInfo.transparentColor.x   = scInfo.transparentColor;
+   sceneInfo.viewDistance.x       = scInfo.viewDistance;
+   sceneInfo.shadowIntensity.x    = scInfo.shadowIntensity;
+   sceneInfo.width3DVision.x      = scInfo.width3DVision;
+   sceneInfo.backgroundColor.x    = scInfo.backgroundColorR;
+   sceneInfo.backgroundColor.y    = scInfo.backgroundColorG;
+   sceneInfo.backgroundColor.z    = scInfo.backgroundColorB;
+   sceneInfo.supportFor3DVision.x = scInfo.supportFor3DVision;
+   sceneInfo.renderBoxes.x        = scInfo.renderBoxes;
+   sceneInfo.pathTracingIteration.x = 0;//scInfo.pathTracingIteration;
+   sceneInfo.maxPathTracingIterations.x = scInfo.maxPathTracingIterations;
+   sceneInfo.misc.x               = scInfo.outputType;
+   sceneInfo.misc.y               = scInfo.timer;
+   sceneInfo.misc.z               = scInfo.fog;
+   sceneInfo.misc.w               = scInfo.isometric3D;
+   return sceneInfo;
+}
+
+::IceStreamer::SceneInfo IIceStreamerImpl::toIceSceneInfo( const SceneInfo& scInfo )
+{
    ::IceStreamer::SceneInfo sceneInfo;
    sceneInfo.outputType        = scInfo.misc.x;
    sceneInfo.timer             = scInfo.misc.y;
@@ -99,6 +722,7 @@ IIceStreamerImpl::~IIceStreamerImpl(void)
    sceneInfo.backgroundColorR  = scInfo.backgroundColor.x;
    sceneInfo.backgroundColorG  = scInfo.backgroundColor.y;
    sceneInfo.backgroundColorB  = scInfo.backgroundColor.z;
+   sceneInfo.backgroundColorA  = scInfo.backgroundColor.w;
    sceneInfo.height            = scInfo.height.x;
    sceneInfo.width             = scInfo.width.x;
    sceneInfo.nbRayIterations   = scInfo.nbRayIterations.x;
@@ -109,5 +733,35 @@ IIceStreamerImpl::~IIceStreamerImpl(void)
    sceneInfo.transparentColor  = scInfo.transparentColor.x;
    sceneInfo.viewDistance      = scInfo.viewDistance.x;
    sceneInfo.width3DVision     = scInfo.width3DVision.x;
+   sceneInfo.pathTracingIteration     = scInfo.pathTracingIteration.x;
+   sceneInfo.maxPathTracingIterations = scInfo.maxPathTracingIterations.x;
    return sceneInfo;
 }
+
+::IceStreamer::PostProcessingInfo IIceStreamerImpl::toIcePostProcessingInfo( const PostProcessingInfo& ppInfo )
+{
+   ::IceStreamer::PostProcessingInfo postProcessingInfo;
+   postProcessingInfo.type   = ppInfo.type.x;
+   postProcessingInfo.param1 = ppInfo.param1.x;
+   postProcessingInfo.param2 = ppInfo.param2.x;
+   postProcessingInfo.param3 = ppInfo.param3.x;
+   return postProcessingInfo;
+}
+
+void IIceStreamerImpl::extractRefinement( const ::IceStreamer::bytes& pixels, int width, int height, ::IceStreamer::bytes& refinement )
+{
+   refinement.clear();
+   if( pixels.size() < static_cast<size_t>(width*height*3) ) return;
+   refinement.reserve( pixels.size() );
+   for( int y(0); y<height; ++y )
+   {
+      const Ice::Byte* row = &pixels[y*width*3];
+      if( y%2 )
+      {
+         refinement.insert( refinement.end(), row, row+width*3 );
+         continue;
+      }
+      for( int x(1); x<width; x+=2 )
+         refinement.insert( refinement.end(), row+x*3, row+x*3+3 );
+   }
+}
@@ -1,14 +1,23 @@
 #pragma once
 
 #include "IIceStreamer.h"
-#include <Cuda/CudaKernel.h>
+#include "RenderBackendPool.h"
+#include "SessionManager.h"
+#include "FrameCache.h"
+#include "Speculator.h"
+#include "DepthEstimator.h"
+#include "BroadcastManager.h"
 
-class IIceStreamerImpl : public ::IceStreamer::BitmapProvider
+class IIceStreamerImpl : public ::IceStreamer::BitmapProvider, public BroadcastSource
 {
 
 public:
 
-   IIceStreamerImpl( CudaKernel* cudaKernel );
+   IIceStreamerImpl(
+      RenderBackendPool& pool, SessionManager& sessions,
+      FrameCache& frameCache, const SpeculatorPtr& speculator,
+      float pixelPitch, const DepthEstimator& depthEstimator,
+      BroadcastManager& broadcasts );
    ~IIceStreamerImpl(void);
 
 public:
@@ -21,10 +30,157 @@ public:
       const ::IceStreamer::PostProcessingInfo& ppInfo, 
       const ::Ice::Current& );
 
+   ::IceStreamer::Frame getFrame(
+      ::Ice::Float ex, ::Ice::Float ey, ::Ice::Float ez, 
+      ::Ice::Float dx, ::Ice::Float dy, ::Ice::Float dz, 
+      ::Ice::Float ax, ::Ice::Float ay, ::Ice::Float az,
+      const ::IceStreamer::SceneInfo& scInfo,
+      const ::IceStreamer::PostProcessingInfo& ppInfo, 
+      bool withDepth,
+      const ::Ice::Current& );
+
+   ::IceStreamer::StereoFrame getStereoFrame(
+      ::Ice::Float ex, ::Ice::Float ey, ::Ice::Float ez, 
+      ::Ice::Float dx, ::Ice::Float dy, ::Ice::Float dz, 
+      ::Ice::Float ax, ::Ice::Float ay, ::Ice::Float az,
+      const ::IceStreamer::SceneInfo& scInfo,
+      const ::IceStreamer::PostProcessingInfo& ppInfo, 
+      bool deltaEncoded,
+      const ::Ice::Current& );
+
+   ::IceStreamer::FrameLevel getFrameLevel(
+      ::Ice::Float ex, ::Ice::Float ey, ::Ice::Float ez, 
+      ::Ice::Float dx, ::Ice::Float dy, ::Ice::Float dz, 
+      ::Ice::Float ax, ::Ice::Float ay, ::Ice::Float az,
+      const ::IceStreamer::SceneInfo& scInfo,
+      const ::IceStreamer::PostProcessingInfo& ppInfo, 
+      ::Ice::Int level,
+      bool refinement,
+      bool withDepth,
+      const ::Ice::Current& );
+
+   void updateCamera(
+      const ::IceStreamer::CameraEvent& event,
+      const ::Ice::Current& );
+
+   void updateSettings(
+      ::Ice::Long sequence,
+      const ::IceStreamer::SceneInfo& scInfo,
+      const ::IceStreamer::PostProcessingInfo& ppInfo,
+      const ::Ice::Current& );
+
+   ::IceStreamer::InputFrame getLatestFrame(
+      bool withDepth,
+      const ::Ice::Current& );
+
    ::IceStreamer::SceneInfo getSceneInfo(
       const ::Ice::Current& );
 
+   void setMaterial(
+      ::Ice::Int index,
+      const ::IceStreamer::MaterialInfo& material,
+      const ::Ice::Current& );
+
+   void resetMaterials(
+      const ::Ice::Current& );
+
+   ::IceStreamer::FrameCacheStatistics getFrameCacheStatistics(
+      const ::Ice::Current& );
+
+   ::IceStreamer::FlowStatistics getFlowStatistics(
+      const ::Ice::Current& );
+
+   void setPostProcessingStages(
+      const ::IceStreamer::PostProcessingStages& stages,
+      const ::Ice::Current& );
+
+   ::IceStreamer::PostProcessingStatistics getPostProcessingStatistics(
+      const ::Ice::Current& );
+
+   void presentChannel(
+      const std::string& name,
+      const ::Ice::Current& );
+
+   void closeChannel(
+      const std::string& name,
+      const ::Ice::Current& );
+
+   void getBroadcastFrame_async(
+      const ::IceStreamer::AMD_BitmapProvider_getBroadcastFramePtr& cb,
+      const std::string& name,
+      ::Ice::Int tier,
+      ::Ice::Long lastSequence,
+      const ::Ice::Current& );
+
+public:
+
+   // Latest camera and settings of the presenter, through the frame cache
+   virtual void renderBroadcast(
+      const SessionPtr& presenter, const std::string& channelId,
+      ::IceStreamer::bytes& frame, int& width, int& height,
+      Ice::Long& key, int& sceneVersion );
+
+private:
+
+   void buildRequest(
+      ::Ice::Float ex, ::Ice::Float ey, ::Ice::Float ez, 
+      ::Ice::Float dx, ::Ice::Float dy, ::Ice::Float dz, 
+      ::Ice::Float ax, ::Ice::Float ay, ::Ice::Float az,
+      const ::IceStreamer::SceneInfo& scInfo,
+      const ::IceStreamer::PostProcessingInfo& ppInfo,
+      const SessionPtr& session,
+      FrameRequest& request );
+
+   // Serves a request from the frame cache or renders it, and schedules the
+   // speculative rendering of the next one. Levels sample the cached full
+   // frame of their camera when there is one; levels that a backend would
+   // sample anyway cache the full frame they are sampled from, so that a
+   // progression costs one full render.
+   void renderRequest(
+      FrameRequest& request,
+      const SessionPtr& session,
+      const FlowTicket& ticket,
+      ::IceStreamer::bytes& frame );
+
+   // Both eyes are looked up in the frame cache separately, so that a view
+   // is shared with mono requests from the same camera. Missing eyes are
+   // rendered in a single pass on one backend.
+   void renderStereoRequest(
+      FrameRequest& request,
+      const SessionPtr& session,
+      const FlowTicket& ticket,
+      ::IceStreamer::bytes& left,
+      ::IceStreamer::bytes& right );
+
+   // Depth of the frame that was actually rendered, i.e. from the quantized
+   // camera. Isometric frames have none.
+   void estimateDepth(
+      const FrameRequest& request,
+      const ::IceStreamer::SceneInfo& scInfo,
+      ::IceStreamer::Frame& frame );
+
+private:
+
+   // Sessions are identified by the connection they use
+   static std::string getSessionId( const ::Ice::Current& current );
+
+   // Camera translated along its X axis, with the kernel stereo disabled
+   static void getEyeRequest( const FrameRequest& request, float offset, FrameRequest& eye );
+
+   static SceneInfo toKernelSceneInfo( const ::IceStreamer::SceneInfo& scInfo );
+   static ::IceStreamer::SceneInfo toIceSceneInfo( const SceneInfo& scInfo );
+   static ::IceStreamer::PostProcessingInfo toIcePostProcessingInfo( const PostProcessingInfo& ppInfo );
+
+   // Pixels of a level that are not in the next coarser one
+   static void extractRefinement( const ::IceStreamer::bytes& pixels, int width, int height, ::IceStreamer::bytes& refinement );
+
 private:
    
-   CudaKernel* cudaKernel_;
+   RenderBackendPool& pool_;
+   SessionManager& sessions_;
+   FrameCache& frameCache_;
+   SpeculatorPtr speculator_;
+   float pixelPitch_;
+   DepthEstimator depthEstimator_;
+   BroadcastManager& broadcasts_;
 };
@@ -1,8 +1,16 @@
+// System
+#include <stdlib.h>
+#include <sstream>
+#include <algorithm>
+
+// Cuda
+#include <cuda_runtime.h>
+
 // Project
 #include "Trace.h"
 #include "IceStreamProducer.h"
 #include "IIceStreamerImpl.h"
-#include "PDBReader.h"
+#include "MolecularStore.h"
 
 // ------------------------------------------------------------------------------------------
 // Scene
@@ -43,11 +51,9 @@ int gNbMaterials  = 0;
 int gNbTextures   = 0;
 float4 gRotationAngles = { 0.f, 0.f, 0.f, 0.f };
 float gDefaultAtomSize(100.f);
-float gDefaultStickSize(50.f);
+float gMoleculeScale(50.f);
 int   gMaxPathTracingIterations = gTotalPathTracingIterations;
 int   gNbMaxBoxes( 8*8*8 );
-int   gGeometryType(0);
-int   gAtomMaterialType(0);
 float4 gRotationCenter = { 0.f, 0.f, 0.f, 0.f };
 
 // ------------------------------------------------------------------------------------------
@@ -62,67 +68,311 @@ PostProcessingInfo gPostProcessingInfo =
 };
 
 IceStreamProducer::IceStreamProducer() :
-   cudaKernel_(nullptr),
-   producerAdapter_(nullptr),
+   Ice::Application(Ice::NoSignalHandling),
+   pool_(nullptr),
+   sessions_(nullptr),
+   frameCache_(nullptr),
+   broadcasts_(nullptr),
    nbPrimitives_(0), nbLamps_(0), nbMaterials_(0), nbTextures_(0),
-   Ice::Application(Ice::NoSignalHandling)
+   producerAdapter_(nullptr)
 {
 }
 
 IceStreamProducer::~IceStreamProducer()
 {
-   delete cudaKernel_;
+   delete broadcasts_;
+   delete frameCache_;
+   delete sessions_;
+   delete pool_;
 }
 
 int IceStreamProducer::run( int argc, char* argv[] )
 {
    try
    {
-      cudaKernel_ = new CudaKernel(false);
-      gSceneInfo.pathTracingIteration.x = 0;
-      cudaKernel_->setSceneInfo( gSceneInfo );
-      cudaKernel_->initBuffers();
-      cudaKernel_->setPostProcessingInfo(gPostProcessingInfo);
+      IceUtil::Time startTime = IceUtil::Time::now(IceUtil::Time::Monotonic);
 
-      createRandomMaterials();
+      // Render backends
+      Ice::PropertiesPtr properties = communicator()->getProperties();
+      int nbBackends = properties->getPropertyAsIntWithDefault("IceStreamer.Backends", 1);
+      int migrationThreshold = properties->getPropertyAsIntWithDefault("IceStreamer.MigrationThreshold", 2);
+      int sessionTimeout = properties->getPropertyAsIntWithDefault("IceStreamer.SessionTimeout", 60);
 
-      cudaKernel_->setCamera( gViewPos, gViewDir, gViewAngles );
+      // Admission control, per session
+      int maxInFlight = properties->getPropertyAsIntWithDefault("IceStreamer.Admission.MaxInFlight", 2);
+      int targetFrameTime = properties->getPropertyAsIntWithDefault("IceStreamer.Admission.TargetFrameTime", 40);
 
-      // Lamp
-      int nbPrimitives = cudaKernel_->addPrimitive( ptSphere );
-      cudaKernel_->setPrimitive( nbPrimitives, 50000.f, 50000.f, -50000.f, 5000.f, 0.f, 0.f, 99, 1 , 1);
+      // Frame cache, size in MB
+      size_t cacheSize = properties->getPropertyAsIntWithDefault("IceStreamer.FrameCache.Size", 64);
+      float positionStep = static_cast<float>(atof(properties->getPropertyWithDefault("IceStreamer.FrameCache.PositionStep", "1").c_str()));
+      float angleStep = static_cast<float>(atof(properties->getPropertyWithDefault("IceStreamer.FrameCache.AngleStep", "0.001").c_str()));
+      frameCache_ = new FrameCache(cacheSize*1024*1024, positionStep, angleStep);
 
-      // PDB
-      PDBReader prbReader;
-      std::string fileName("./pdb/1BNA.pdb");
-      float4 size = prbReader.loadAtomsFromFile(
-         fileName, *cudaKernel_,
-         static_cast<GeometryType>(gGeometryType), 
-         gDefaultAtomSize, gDefaultStickSize, gAtomMaterialType, 50.f );
-      gNbBoxes = cudaKernel_->compactBoxes(true);
+      // Speculative frames are stored in the cache
+      bool speculation = properties->getPropertyAsIntWithDefault("IceStreamer.Speculation", 1) != 0;
 
-      producerAdapter_ = communicator()->createObjectAdapter("IceStreamerAdaptor");
+      // Camera model used to estimate depth on the server side. Culling and
+      // levels rendered as smaller images also need the kernel to space
+      // pixels by this pitch on the image plane: each backend checks it on
+      // a probe frame, and renders full frames when it does not hold.
+      float pixelPitch = static_cast<float>(atof(properties->getPropertyWithDefault("IceStreamer.Camera.PixelPitch", "4").c_str()));
+      int depthTileSize = properties->getPropertyAsIntWithDefault("IceStreamer.DepthTileSize", 8);
+      int cullingTileSize = properties->getPropertyAsIntWithDefault("IceStreamer.Culling.TileSize", 16);
+
+      // Molecule, loaded once for all backends
+      std::string pdbFile = properties->getPropertyWithDefault("IceStreamer.Molecule.File", "./pdb/1BNA.pdb");
+      float lodThreshold = static_cast<float>(atof(properties->getPropertyWithDefault("IceStreamer.Molecule.LodThreshold", "1").c_str()));
+      int finestDetail = std::max(0, std::min(mdCount-1, properties->getPropertyAsIntWithDefault("IceStreamer.Molecule.FinestDetail", mdAtoms)));
 
-      IceStreamer::BitmapProviderPtr bmp = new IIceStreamerImpl(cudaKernel_);
+      // Warm start image of the scene, disabled when no file is given
+      std::string imageFile = properties->getPropertyWithDefault("IceStreamer.WarmStart.Image", "");
+
+      // Browser viewers, disabled when no port is given
+      int httpPort = properties->getPropertyAsIntWithDefault("IceStreamer.Http.Port", 0);
+      int httpMaxConnections = properties->getPropertyAsIntWithDefault("IceStreamer.Http.MaxConnections", 32);
+      int httpQuality = properties->getPropertyAsIntWithDefault("IceStreamer.Http.Quality", 75);
+      int httpFrameTime = properties->getPropertyAsIntWithDefault("IceStreamer.Http.FrameTime", 40);
+
+      // Broadcast channels, presenters expire with their session
+      int maxChannels = properties->getPropertyAsIntWithDefault("IceStreamer.Broadcast.MaxChannels", 8);
+      int channelFrameTime = properties->getPropertyAsIntWithDefault("IceStreamer.Broadcast.FrameTime", 40);
+
+      // Session defaults, materials and bounds are known as soon as the
+      // image is mapped
+      std::string imageSource = getImageSource( pdbFile );
+      SceneImage image;
+      std::vector<MaterialDescription> materials;
+      std::vector<BoundingBox> bounds;
+      bool warmStart = !imageFile.empty() && image.open( imageFile, imageSource, pdbFile ) && loadDefaults( image ) &&
+         image.getArray( siMaterials, 0, materials ) && image.getArray( siBounds, 0, bounds );
+      if( !warmStart )
+      {
+         materials.clear();
+         bounds.clear();
+      }
+      gSceneInfo.pathTracingIteration.x = 0;
+
+      // The adapter is activated before the scene is loaded. Sessions get
+      // the defaults of the scene and placeholder frames until the first
+      // backend is ready.
+      SceneSnapshotPtr loadingSnapshot = new SceneSnapshot(0, gSceneInfo, gPostProcessingInfo, materials, bounds, 0, -1);
+      pool_ = new RenderBackendPool(migrationThreshold);
+      sessions_ = new SessionManager(*pool_, loadingSnapshot, sessionTimeout, maxInFlight, targetFrameTime);
+      if( speculation && frameCache_->isEnabled() )
+      {
+         speculator_ = new Speculator(*pool_, *frameCache_);
+         speculator_->start();
+      }
+      broadcasts_ = new BroadcastManager(*pool_, maxChannels, channelFrameTime, sessionTimeout);
+
+      producerAdapter_ = communicator()->createObjectAdapter("IceStreamerAdaptor");
+      IceStreamer::BitmapProviderPtr bmp = new IIceStreamerImpl(
+         *pool_, *sessions_, *frameCache_, speculator_,
+         pixelPitch, DepthEstimator(depthTileSize), *broadcasts_);
       producerAdapter_->add( bmp, communicator()->stringToIdentity("icestreamer"));
       producerAdapter_->activate();
+      APPL_LOG_INFO("Adapter active after " << getElapsedTime(startTime) << " ms");
+
+      if( httpPort > 0 )
+      {
+         // Kernels are built for the size of the default scene
+         ViewSettings defaultView = { gViewPos, gViewDir, gViewAngles, gSceneInfo.width.x, gSceneInfo.height.x };
+         httpViewer_ = new HttpViewer(
+            httpPort, httpMaxConnections, defaultView, gSceneInfo.width.x, gSceneInfo.height.x,
+            *pool_, *sessions_, *frameCache_, httpQuality, httpFrameTime,
+            pixelPitch, cullingTileSize );
+         if( httpViewer_->listen() )
+            httpViewer_->start();
+         else
+            httpViewer_ = 0;
+      }
+
+      // Scene
+      MolecularStorePtr molecule = new MolecularStore(lodThreshold, static_cast<MolecularDetail>(finestDetail));
+      if( warmStart && !molecule->load( image ) )
+      {
+         // The image is written again once the molecule is loaded from its file
+         APPL_LOG_WARNING(imageFile << " has no molecule this server can read");
+         warmStart = false;
+      }
+      if( !warmStart )
+      {
+         if( materials.empty() ) createRandomMaterials( materials );
+         if( !molecule->loadFromFile( pdbFile, gDefaultAtomSize, gMoleculeScale ) ) molecule = 0;
+      }
+      gNbMaterials = static_cast<int>(materials.size());
+
+      int nbDevices(0);
+      if( cudaGetDeviceCount(&nbDevices) != cudaSuccess || nbDevices < 1 ) nbDevices = 1;
+
+      // Backends only cull and render levels as smaller images once the
+      // default view shows that the kernel matches the camera model
+      FrameRequest probe;
+      probe.eye                = gViewPos;
+      probe.direction          = gViewDir;
+      probe.angles             = gViewAngles;
+      probe.sceneInfo          = gSceneInfo;
+      probe.postProcessingInfo = gPostProcessingInfo;
+
+      // Culling only applies to perspective views
+      if( cullingTileSize > 0 && gSceneInfo.misc.w != 0 )
+         APPL_LOG_WARNING("Culling is configured but the default view is isometric: its frames are not culled");
+
+      // Each backend serves requests as soon as its kernel is built, while
+      // the kernels of the next ones are being built
+      SceneSnapshotPtr snapshot;
+      for( int i(0); i<nbBackends; ++i )
+      {
+         // Backends are spread over the available devices
+         int device = i%nbDevices;
+         cudaSetDevice(device);
+         int moleculePrimitive(-1);
+         bounds.clear();
+         CudaKernel* kernel = createKernel(materials, molecule, bounds, moleculePrimitive);
+
+         // The scene description is shared by all backends and sessions
+         if( !snapshot ) snapshot = new SceneSnapshot(1, gSceneInfo, gPostProcessingInfo, materials, bounds, molecule, moleculePrimitive);
+
+         RenderBackend* backend = new RenderBackend(i, device, kernel, snapshot,
+            DepthEstimator(depthTileSize), pixelPitch, cullingTileSize);
+         {
+            IceUtil::Mutex::Lock lock(backend->getMutex());
+            backend->validateCulling( probe );
+            backend->validateLevelViews( probe );
+         }
+         pool_->addBackend( backend );
+         APPL_LOG_INFO("Backend " << i << " ready on device " << device << " after " <<
+            getElapsedTime(startTime) << " ms (" << gNbBoxes << " boxes)");
+
+         // New requests get the scene as soon as they can be rendered
+         if( i == 0 ) sessions_->setSnapshot( snapshot );
+      }
+      APPL_LOG_INFO("Full service after " << getElapsedTime(startTime) << " ms (" << (warmStart ? "warm" : "cold") << " start)");
+
+      // The next start is a warm one
+      image.close();
+      if( !imageFile.empty() && !warmStart )
+         saveImage( imageFile, imageSource, pdbFile, materials, bounds, molecule );
 
       communicator()->waitForShutdown();
+      stopServices();
       communicator()->destroy();
    }
    catch( const Ice::NotRegisteredException& e )
    {
       APPL_LOG_ERROR(e);
+      stopServices();
    }
    catch( const Ice::Exception& e )
    {
       APPL_LOG_ERROR(e);
+      stopServices();
+   }
+   catch( const std::exception& e )
+   {
+      APPL_LOG_ERROR(e.what());
+      stopServices();
    }
 
    return 0;
 }
 
-void IceStreamProducer::createRandomMaterials()
+void IceStreamProducer::stopServices()
+{
+   // Threads use the pool and the cache, which are deleted with the producer
+   if( broadcasts_ ) broadcasts_->destroy();
+   if( httpViewer_ )
+   {
+      httpViewer_->destroy();
+      httpViewer_->getThreadControl().join();
+      httpViewer_ = 0;
+   }
+   if( speculator_ )
+   {
+      speculator_->destroy();
+      speculator_->getThreadControl().join();
+      speculator_ = 0;
+   }
+}
+
+std::string IceStreamProducer::getImageSource( const std::string& pdbFile )
+{
+   // Everything the scene is built from, besides the build of the server
+   std::ostringstream source;
+   source << pdbFile << " " << gDefaultAtomSize << " " << gMoleculeScale;
+   return source.str();
+}
+
+bool IceStreamProducer::loadDefaults( const SceneImage& image )
+{
+   SceneDefaults defaults;
+   if( !image.getValue( siDefaults, defaults ) ) return false;
+   gSceneInfo          = defaults.sceneInfo;
+   gPostProcessingInfo = defaults.postProcessingInfo;
+   gViewPos            = defaults.eye;
+   gViewDir            = defaults.direction;
+   gViewAngles         = defaults.angles;
+   return true;
+}
+
+void IceStreamProducer::saveImage(
+   const std::string& fileName, const std::string& source, const std::string& sourceFile,
+   const std::vector<MaterialDescription>& materials,
+   const std::vector<BoundingBox>& bounds,
+   const MolecularStorePtr& molecule )
+{
+   SceneDefaults defaults;
+   defaults.sceneInfo          = gSceneInfo;
+   defaults.postProcessingInfo = gPostProcessingInfo;
+   defaults.eye                = gViewPos;
+   defaults.direction          = gViewDir;
+   defaults.angles             = gViewAngles;
+
+   SceneImageWriter writer;
+   writer.addValue( siDefaults, defaults );
+   writer.addArray( siMaterials, 0, materials );
+   writer.addArray( siBounds, 0, bounds );
+   if( molecule ) molecule->save( writer );
+   writer.write( fileName, source, sourceFile );
+}
+
+int IceStreamProducer::getElapsedTime( const IceUtil::Time& start )
+{
+   return static_cast<int>((IceUtil::Time::now(IceUtil::Time::Monotonic)-start).toMilliSeconds());
+}
+
+CudaKernel* IceStreamProducer::createKernel(
+   const std::vector<MaterialDescription>& materials,
+   const MolecularStorePtr& molecule,
+   std::vector<BoundingBox>& bounds,
+   int& moleculePrimitive )
+{
+   CudaKernel* cudaKernel = new CudaKernel(false);
+   cudaKernel->setSceneInfo( gSceneInfo );
+   cudaKernel->initBuffers();
+   cudaKernel->setPostProcessingInfo( gPostProcessingInfo );
+
+   SceneSnapshot::applyMaterials( *cudaKernel, materials );
+
+   cudaKernel->setCamera( gViewPos, gViewDir, gViewAngles );
+
+   // Lamp
+   int nbPrimitives = cudaKernel->addPrimitive( ptSphere );
+   cudaKernel->setPrimitive( nbPrimitives, 50000.f, 50000.f, -50000.f, 5000.f, 0.f, 0.f, 99, 1 , 1);
+   BoundingBox lamp = { { 45000.f, 45000.f, -55000.f }, { 55000.f, 55000.f, -45000.f } };
+   bounds.push_back(lamp);
+
+   // PDB, centered on the origin. Backends start with the finest level.
+   if( molecule )
+   {
+      moleculePrimitive = molecule->addPrimitives( *cudaKernel );
+      bounds.push_back( molecule->getBounds() );
+   }
+   gNbBoxes = cudaKernel->compactBoxes(true);
+   return cudaKernel;
+}
+
+void IceStreamProducer::createRandomMaterials( std::vector<MaterialDescription>& materials )
 {
    // Materials
    for( int i(0); i<100; ++i ) 
@@ -182,9 +432,7 @@ void IceStreamProducer::createRandomMaterials()
       case 99: r = 1.0f; g = 1.0f; b = 1.0f; innerIllumination = 1.f; break;
       }
 
-      gNbMaterials = cudaKernel_->addMaterial();
-      cudaKernel_->setMaterial( 
-         gNbMaterials,
+      MaterialDescription material = {
          r, g, b, noise,
          reflection, 
          refraction,
@@ -193,6 +441,8 @@ void IceStreamProducer::createRandomMaterials()
          transparency,
          textureId,
          specular.x, specular.y, specular.w, innerIllumination,
-         fastTransparency );
+         fastTransparency };
+      materials.push_back(material);
    }
+   gNbMaterials = static_cast<int>(materials.size());
 }
\ No newline at end of file
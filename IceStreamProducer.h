@@ -1,11 +1,19 @@
 #pragma once
 
 // Ice
-#include <ice/ice.h>
+#include <Ice/Ice.h>
 
 // Project
 #include <Cuda/CudaKernel.h>
 #include "IIceStreamer.h"
+#include "RenderBackendPool.h"
+#include "SessionManager.h"
+#include "FrameCache.h"
+#include "Speculator.h"
+#include "HttpViewer.h"
+#include "BroadcastManager.h"
+#include "MolecularStore.h"
+#include "SceneImage.h"
 
 /*
 * @brief This class implements the ICE application used to produce messages
@@ -30,11 +38,36 @@ public:
 
 private:
 
-   void createRandomMaterials();
+   CudaKernel* createKernel(
+      const std::vector<MaterialDescription>& materials,
+      const MolecularStorePtr& molecule,
+      std::vector<BoundingBox>& bounds,
+      int& moleculePrimitive );
+   void createRandomMaterials( std::vector<MaterialDescription>& materials );
+
+   // Warm start image
+   static std::string getImageSource( const std::string& pdbFile );
+   bool loadDefaults( const SceneImage& image );
+   void saveImage(
+      const std::string& fileName, const std::string& source, const std::string& sourceFile,
+      const std::vector<MaterialDescription>& materials,
+      const std::vector<BoundingBox>& bounds,
+      const MolecularStorePtr& molecule );
+
+   static int getElapsedTime( const IceUtil::Time& start );
+
+   // Stops the threads of the broadcasts, the HTTP viewer and the
+   // speculator, and waits for them
+   void stopServices();
 
 private:
 
-   CudaKernel* cudaKernel_;
+   RenderBackendPool* pool_;
+   SessionManager* sessions_;
+   FrameCache* frameCache_;
+   BroadcastManager* broadcasts_;
+   SpeculatorPtr speculator_;
+   HttpViewerPtr httpViewer_;
 
 private:
    
@@ -36,13 +36,18 @@
 #include <iostream>
 #include <cassert>
 #include <vector>
+#include <map>
+#include <algorithm>
 #include <math.h>
 #include <string.h>
 #include <stdlib.h>
+#include <float.h>
 #include <vector_types.h>
 
 // Project
 #include "IIceStreamer.h"
+#include "CameraModel.h"
+#include "DepthEstimator.h"
 
 // Ice
 ::Ice::CommunicatorPtr gCommunicator;
@@ -69,8 +74,8 @@ int   gTotalPathTracingIterations = 1;
 
 ::IceStreamer::SceneInfo gSceneInfo = 
 { 
-   gWindowWidth,               // width
-   gWindowHeight,              // height
+   static_cast<Ice::Int>(gWindowWidth),  // width
+   static_cast<Ice::Int>(gWindowHeight), // height
    true,                       // shadowsEnabled
    5,                          // nbRayIterations
    3.f,                        // transparentColor
@@ -114,6 +119,86 @@ float4 gSkeletonPosition       = { 0.f, 0.f, 0.f, 0.f };
 
 // Post processing
 ::IceStreamer::PostProcessingInfo gPostProcessingInfo = { 0, 4000.f, 40.f, 100 };
+::IceStreamer::PostProcessingStages gPostProcessingStages = { false, false, false, false, 1.f, 1.f };
+bool gPostProcessingStagesChanged(false);
+
+// --------------------------------------------------------------------------------
+// Reprojection
+// --------------------------------------------------------------------------------
+// Frames are requested asynchronously. Until the next one arrives, the last
+// received frame is reprojected to the current camera using its depth.
+// Only perspective frames are reprojected: the server sends no depth with
+// isometric ones, which are shown as they are until the next frame.
+bool  gReprojection(true);
+float gPixelPitch(4.f);
+Ice::AsyncResultPtr gPendingFrame;
+bool gPendingStereo(false);
+::IceStreamer::Frame gLastFrame;
+bool gFrameUpdated(false);
+int  gNextRequestTime(0); // ms, set when the server asks to slow down
+
+// Camera and settings of the pending and of the last received frames
+float4 gRequestViewPos;
+float4 gRequestViewDir;
+float4 gRequestViewAngles;
+::IceStreamer::SceneInfo gRequestSceneInfo;
+float4 gFrameViewPos;
+float4 gFrameViewDir;
+float4 gFrameViewAngles;
+::IceStreamer::SceneInfo gFrameSceneInfo;
+std::vector<float> gZBuffer;
+
+// --------------------------------------------------------------------------------
+// Input channel
+// --------------------------------------------------------------------------------
+// Camera and settings changes are sent on a oneway proxy, at most once per
+// tick, and frames are rendered from the latest state the server received.
+// Frames are tagged with the last input event they reflect, which gives the
+// input to display latency. The camera is sent as an absolute event first,
+// again whenever the server has lost it, and periodically after moves so
+// that rounding errors of the moves do not add up.
+bool gInputChannel(true);
+::IceStreamer::BitmapProviderPrx gInputProvider;
+Ice::Long gInputSequence(0);
+bool gInputResync(true);
+bool gInputMoved(false);   // moves sent since the last absolute event
+int  gLastAbsoluteInput(0); // ms
+int  gAbsoluteInputInterval(1000); // ms
+std::map<Ice::Long,int> gInputSendTimes; // ms
+float gInputLatency(0.f); // ms, smoothed
+float4 gSentViewPos;
+float4 gSentViewDir;
+float4 gSentViewAngles;
+::IceStreamer::SceneInfo gSentSceneInfo;
+::IceStreamer::PostProcessingInfo gSentPostProcessingInfo;
+
+// --------------------------------------------------------------------------------
+// Progressive transmission
+// --------------------------------------------------------------------------------
+// Mono frames are requested level by level, from 1/2^gProgressiveLevels of
+// the resolution down to the full frame. Every level is displayed as soon as
+// it arrives, each pixel covering the ones that are still missing. A new
+// camera starts again from the coarsest level, and the refinements of the
+// previous one are never requested.
+int  gProgressiveLevels(0);
+int  gNextLevel(-1);    // refinement to request next, -1 when the frame is complete
+int  gPendingLevel(-1); // level of the pending request, -1 when it is not a level
+bool gPendingRefinement(false);
+
+// --------------------------------------------------------------------------------
+// Broadcast channels
+// --------------------------------------------------------------------------------
+// A presenter drives its channel through the input channel, and presents it
+// again from time to time, which keeps its session alive while the camera
+// does not move. A viewer only displays the frames of the channel, at the
+// resolution of its tier, and applies the deltas to the last frame received.
+const int PRESENT_INTERVAL = 10000; // ms
+std::string gPresentedChannel;
+int gNextPresentTime(0);
+std::string gWatchedChannel;
+int gBroadcastTier(0);
+Ice::Long gBroadcastSequence(0);
+::IceStreamer::bytes gBroadcastPixels;
 
 // --------------------------------------------------------------------------------
 // OpenGL
@@ -131,6 +216,7 @@ void keyboard(unsigned char key, int x, int y);
 void mouse(int button, int state, int x, int y);
 void motion( int x, int y );
 void timerEvent( int value );
+void broadcastTimerEvent( int value );
 void createScene( int platform, int device );
 
 // Helpers
@@ -186,6 +272,312 @@ float getRandomValue( int range, int safeZone, bool allowNegativeValues = true )
 /*
 ________________________________________________________________________________
 
+toCameraVector
+________________________________________________________________________________
+*/
+CameraVector toCameraVector( const float4& v )
+{
+   CameraVector result = { v.x, v.y, v.z };
+   return result;
+}
+
+/*
+________________________________________________________________________________
+
+sameCamera
+________________________________________________________________________________
+*/
+bool sameCamera( const float4& a, const float4& b )
+{
+   return a.x==b.x && a.y==b.y && a.z==b.z;
+}
+
+/*
+________________________________________________________________________________
+
+reprojectFrame
+
+Forward warps the last received frame to the current camera. Every pixel is
+moved to the position of its 3D point, as given by the depth of its tile, and
+splatted over 2x2 pixels to cover the holes left by small motions. Pixels of
+background tiles are skipped, as are the holes, where the background color
+shows.
+________________________________________________________________________________
+*/
+void reprojectFrame()
+{
+   const int width  = gWindowWidth;
+   const int height = gWindowHeight;
+   const int tileSize = gLastFrame.depthTileSize;
+   const ::IceStreamer::bytes& color = gLastFrame.color;
+   const ::IceStreamer::shorts& depth = gLastFrame.depth;
+
+   CameraModel source(
+      toCameraVector(gFrameViewPos), toCameraVector(gFrameViewDir), toCameraVector(gFrameViewAngles),
+      width, height, gPixelPitch );
+   CameraModel target(
+      toCameraVector(gViewPos), toCameraVector(gViewDir), toCameraVector(gViewAngles),
+      width, height, gPixelPitch );
+
+   GLubyte background[3] = {
+      static_cast<GLubyte>(gSceneInfo.backgroundColorR*255.f),
+      static_cast<GLubyte>(gSceneInfo.backgroundColorG*255.f),
+      static_cast<GLubyte>(gSceneInfo.backgroundColorB*255.f) };
+   for( int i(0); i<width*height; ++i )
+   {
+      gUbImage[i*3  ] = background[0];
+      gUbImage[i*3+1] = background[1];
+      gUbImage[i*3+2] = background[2];
+   }
+   gZBuffer.assign( width*height, FLT_MAX );
+
+   const float depthScale = gFrameSceneInfo.viewDistance/65534.f;
+   for( int y(0); y<height; ++y )
+   {
+      int ty = y/tileSize;
+      if( ty >= gLastFrame.depthHeight ) break;
+      for( int x(0); x<width; ++x )
+      {
+         int tx = x/tileSize;
+         if( tx >= gLastFrame.depthWidth ) break;
+         unsigned short d = static_cast<unsigned short>(depth[ty*gLastFrame.depthWidth+tx]);
+         if( d == DepthEstimator::BACKGROUND ) continue;
+
+         CameraVector point = source.getPoint( static_cast<float>(x), static_cast<float>(y), d*depthScale );
+         float px, py, distance;
+         if( !target.project( point, px, py, distance ) ) continue;
+
+         int ix = static_cast<int>(floor(px+0.5f));
+         int iy = static_cast<int>(floor(py+0.5f));
+         const GLubyte* src = &color[(y*width+x)*3];
+         for( int sy(iy); sy<iy+2; ++sy )
+         {
+            if( sy<0 || sy>=height ) continue;
+            for( int sx(ix); sx<ix+2; ++sx )
+            {
+               if( sx<0 || sx>=width ) continue;
+               int index = sy*width+sx;
+               if( distance >= gZBuffer[index] ) continue;
+               gZBuffer[index] = distance;
+               gUbImage[index*3  ] = src[0];
+               gUbImage[index*3+1] = src[1];
+               gUbImage[index*3+2] = src[2];
+            }
+         }
+      }
+   }
+}
+
+/*
+________________________________________________________________________________
+
+composeAnaglyph
+
+Red channel from the left eye, green and blue channels from the right eye
+________________________________________________________________________________
+*/
+void composeAnaglyph( const ::IceStreamer::StereoFrame& stereo, ::IceStreamer::bytes& image )
+{
+   size_t size = stereo.width*stereo.height*stereo.colorDepth;
+   if( size == 0 || stereo.pixels.size() < 2*size )
+   {
+      image.clear();
+      return;
+   }
+
+   image.resize( size );
+   const Ice::Byte* left  = &stereo.pixels[0];
+   const Ice::Byte* right = &stereo.pixels[size];
+   for( size_t i(0); i<size; i+=stereo.colorDepth )
+   {
+      image[i] = left[i];
+      for( int c(1); c<3; ++c )
+      {
+         image[i+c] = stereo.rightDelta ? 
+            static_cast<Ice::Byte>(left[i+c]+right[i+c]) : right[i+c];
+      }
+   }
+}
+
+/*
+________________________________________________________________________________
+
+updateImage
+________________________________________________________________________________
+*/
+void sendInput()
+{
+   const int now = glutGet(GLUT_ELAPSED_TIME);
+   bool moved = gInputResync ||
+      !sameCamera(gViewPos, gSentViewPos) || 
+      !sameCamera(gViewDir, gSentViewDir) || 
+      !sameCamera(gViewAngles, gSentViewAngles);
+   bool absolute = gInputResync || 
+      ((moved || gInputMoved) && now-gLastAbsoluteInput >= gAbsoluteInputInterval);
+   if( moved || absolute )
+   {
+      // An absolute event sets the camera, the next ones move it
+      ::IceStreamer::CameraEvent event;
+      event.sequence = ++gInputSequence;
+      event.absolute = absolute;
+      event.camera.ex = gViewPos.x-(absolute ? 0.f : gSentViewPos.x);
+      event.camera.ey = gViewPos.y-(absolute ? 0.f : gSentViewPos.y);
+      event.camera.ez = gViewPos.z-(absolute ? 0.f : gSentViewPos.z);
+      event.camera.dx = gViewDir.x-(absolute ? 0.f : gSentViewDir.x);
+      event.camera.dy = gViewDir.y-(absolute ? 0.f : gSentViewDir.y);
+      event.camera.dz = gViewDir.z-(absolute ? 0.f : gSentViewDir.z);
+      event.camera.ax = gViewAngles.x-(absolute ? 0.f : gSentViewAngles.x);
+      event.camera.ay = gViewAngles.y-(absolute ? 0.f : gSentViewAngles.y);
+      event.camera.az = gViewAngles.z-(absolute ? 0.f : gSentViewAngles.z);
+      gInputProvider->updateCamera( event );
+      gInputSendTimes[gInputSequence] = now;
+      gSentViewPos    = gViewPos;
+      gSentViewDir    = gViewDir;
+      gSentViewAngles = gViewAngles;
+      gInputMoved     = !absolute;
+      if( absolute ) gLastAbsoluteInput = now;
+   }
+
+   if( gInputResync || gSceneInfo != gSentSceneInfo || gPostProcessingInfo != gSentPostProcessingInfo )
+   {
+      gInputProvider->updateSettings( ++gInputSequence, gSceneInfo, gPostProcessingInfo );
+      gInputSendTimes[gInputSequence] = now;
+      gSentSceneInfo          = gSceneInfo;
+      gSentPostProcessingInfo = gPostProcessingInfo;
+   }
+   gInputResync = false;
+}
+
+void collectInputFrame( const ::IceStreamer::InputFrame& frame )
+{
+   if( frame.reset )
+   {
+      // The server lost the state of the session, it gets all of it again
+      gInputResync   = true;
+      gRefreshNeeded = true;
+      return;
+   }
+
+   gLastFrame = frame.frame;
+   gFrameViewPos.x    = frame.camera.ex; gFrameViewPos.y    = frame.camera.ey; gFrameViewPos.z    = frame.camera.ez;
+   gFrameViewDir.x    = frame.camera.dx; gFrameViewDir.y    = frame.camera.dy; gFrameViewDir.z    = frame.camera.dz;
+   gFrameViewAngles.x = frame.camera.ax; gFrameViewAngles.y = frame.camera.ay; gFrameViewAngles.z = frame.camera.az;
+
+   // Latency of the last event that the frame reflects, when it is new
+   std::map<Ice::Long,int>::iterator it = gInputSendTimes.find(frame.sequence);
+   if( it != gInputSendTimes.end() )
+   {
+      float latency = static_cast<float>(glutGet(GLUT_ELAPSED_TIME)-it->second);
+      gInputLatency = (gInputLatency == 0.f) ? latency : gInputLatency+0.1f*(latency-gInputLatency);
+      gInputSendTimes.erase( gInputSendTimes.begin(), ++it );
+   }
+
+   // The request overtook the last events, they need another frame
+   if( frame.sequence < gInputSequence ) gRefreshNeeded = true;
+}
+
+void collectFrameLevel( const ::IceStreamer::FrameLevel& level )
+{
+   const int width  = gWindowWidth;
+   const int height = gWindowHeight;
+   const int scale  = 1<<level.level;
+   if( level.width != (width+scale-1)/scale || level.height != (height+scale-1)/scale ) return;
+
+   if( !level.refinement )
+   {
+      // Depth of the full frame comes with the coarsest level
+      gLastFrame.color.resize( width*height*3 );
+      gLastFrame.depthTileSize = level.frame.depthTileSize;
+      gLastFrame.depthWidth    = level.frame.depthWidth;
+      gLastFrame.depthHeight   = level.frame.depthHeight;
+      gLastFrame.depth         = level.frame.depth;
+   }
+   else if( gLastFrame.color.size() != static_cast<size_t>(width*height*3) )
+   {
+      return;
+   }
+
+   const ::IceStreamer::bytes& pixels = level.frame.color;
+   size_t index(0);
+   for( int y(0); y<level.height; ++y )
+   {
+      int y1 = std::min((y+1)*scale, height);
+      for( int x(0); x<level.width; ++x )
+      {
+         // Refinements skip the pixels of the coarser level
+         if( level.refinement && x%2 == 0 && y%2 == 0 ) continue;
+         if( (index+1)*3 > pixels.size() ) return;
+         const Ice::Byte* src = &pixels[3*index++];
+
+         // Until the next levels arrive, a pixel covers its whole cell
+         int x1 = std::min((x+1)*scale, width);
+         for( int py(y*scale); py<y1; ++py )
+            for( int px(x*scale); px<x1; ++px )
+               memcpy( &gLastFrame.color[(py*width+px)*3], src, 3 );
+      }
+   }
+   if( level.level > 0 ) gNextLevel = level.level-1;
+}
+
+void collectBroadcastFrame( const ::IceStreamer::BroadcastFrame& frame )
+{
+   // No new frame in time
+   size_t size = frame.width*frame.height*3;
+   if( size == 0 || frame.pixels.size() != size ) return;
+   if( frame.keyframe )
+   {
+      gBroadcastPixels = frame.pixels;
+   }
+   else if( gBroadcastPixels.size() == size && frame.sequence == gBroadcastSequence+1 )
+   {
+      for( size_t i(0); i<size; ++i )
+         gBroadcastPixels[i] = static_cast< ::Ice::Byte>(gBroadcastPixels[i]+frame.pixels[i]);
+   }
+   else
+   {
+      // The next request gets a keyframe
+      gBroadcastSequence = 0;
+      return;
+   }
+   gBroadcastSequence = frame.sequence;
+
+   // Each pixel of the tier covers its cell of the window
+   const int width  = gWindowWidth;
+   const int height = gWindowHeight;
+   for( int y(0); y<height; ++y )
+   {
+      const Ice::Byte* row = &gBroadcastPixels[(y*frame.height/height)*frame.width*3];
+      for( int x(0); x<width; ++x )
+         memcpy( &gUbImage[(y*width+x)*3], row+(x*frame.width/width)*3, 3 );
+   }
+}
+
+void updateImage()
+{
+   size_t size = gWindowWidth*gWindowHeight*3;
+   if( gLastFrame.color.size() < size ) return;
+
+   bool moved = 
+      !sameCamera(gViewPos, gFrameViewPos) || 
+      !sameCamera(gViewDir, gFrameViewDir) || 
+      !sameCamera(gViewAngles, gFrameViewAngles);
+   bool reprojectable = 
+      gFrameSceneInfo.isometric3D == 0 &&
+      gLastFrame.depthTileSize > 0 && !gLastFrame.depth.empty();
+   if( gReprojection && moved && reprojectable )
+   {
+      reprojectFrame();
+   }
+   else if( gFrameUpdated || moved )
+   {
+      memcpy( gUbImage, &gLastFrame.color[0], size );
+   }
+   gFrameUpdated = false;
+}
+
+/*
+________________________________________________________________________________
+
 idle
 ________________________________________________________________________________
 */
@@ -224,7 +616,7 @@ void initgl( int argc, char **argv )
 	glutKeyboardFunc(keyboard);
 	glutMouseFunc(mouse);
 	glutMotionFunc(motion);
-	glutTimerFunc(REFRESH_DELAY,timerEvent,1);
+	glutTimerFunc(REFRESH_DELAY,gWatchedChannel.empty() ? timerEvent : broadcastTimerEvent,1);
 
 	return;
 }
@@ -282,18 +674,24 @@ void display()
          gFrame=0;
       }
 
-      char tmp[1024];
+      char tmp[2048];
       strcpy(tmp, "b: Randomly change background color\n");
       strcat(tmp, "B: Reset background color to black\n");
+      strcat(tmp, "a: Enable/Disable server anti-aliasing\n");
       strcat(tmp, "d: Enable/Disable depth of field post processing effect\n");
+      strcat(tmp, "D: Enable/Disable server depth of field\n");
+      strcat(tmp, "e: Enable/Disable server denoiser\n");
       strcat(tmp, "i: Switch Boxes/Primitives\n");
       strcat(tmp, "m: Automatic animation for performance testing\n");
       strcat(tmp, "n: Next protein\n");
       strcat(tmp, "o: Increase number of blocks\n");
       strcat(tmp, "p: Increase shared memory\n");
+      strcat(tmp, "r: Enable/Disable reprojection of frames to the current camera\n");
       strcat(tmp, "s: Enable/Disable shadows\n");
+      strcat(tmp, "t: Enable/Disable server tone mapping\n");
       strcat(tmp, "1: Decrease depth of field post processing effect\n");
       strcat(tmp, "2: Increase depth of field post processing effect\n");
+      strcat(tmp, "3: Enable/Disable anaglyph stereo\n");
       strcat(tmp, "4: Decrease view distance\n");
       strcat(tmp, "5: Increase view distance\n");
       strcat(tmp, "7: Decrease 3DVision distance between eyes\n");
@@ -303,6 +701,12 @@ void display()
       strcat(tmp, "+: Increase number of ray iterations\n");
       strcat(tmp, "h: Help\n");
       strcat(tmp, "Escape: Exit application\n");
+      if( gInputChannel )
+      {
+         char latency[64];
+         sprintf(latency, "Input latency: %d ms\n", static_cast<int>(gInputLatency+0.5f));
+         strcat(tmp, latency);
+      }
       RenderString(-0.9f, 0.9f, GLUT_BITMAP_HELVETICA_10, tmp, textColor );
    }
    RenderString(-0.9f, -0.9f, GLUT_BITMAP_HELVETICA_10, "Copyright(C) Cyrille Favreau - http://cudaopencl.blogspot.com", textColor );
@@ -314,41 +718,193 @@ void display()
 
 void timerEvent(int value)
 {
-   if( gRefreshNeeded )
+   try 
    {
-      try 
+      // Collect the frame requested at a previous tick
+      if( gPendingFrame && gPendingFrame->isCompleted() )
       {
-         IceStreamer::bytes bitmap = gBitmapProvider->getBitmap( 
-            gViewPos.x, gViewPos.y, gViewPos.z, 
-            gViewDir.x, gViewDir.y, gViewDir.z, 
-            gViewAngles.x, gViewAngles.y, gViewAngles.z,
-            gSceneInfo, gPostProcessingInfo );
-         
-         for( unsigned int i(0); i<bitmap.size(); ++i) 
-            gUbImage[i] = bitmap[i];
+         if( gPendingStereo )
+         {
+            // Stereo frames come without depth, and are not reprojected
+            ::IceStreamer::StereoFrame stereo = gBitmapProvider->end_getStereoFrame( gPendingFrame );
+            composeAnaglyph( stereo, gLastFrame.color );
+            gLastFrame.depth.clear();
+         }
+         else if( gPendingLevel >= 0 )
+         {
+            collectFrameLevel( gBitmapProvider->end_getFrameLevel( gPendingFrame ) );
+         }
+         else if( gInputChannel )
+         {
+            collectInputFrame( gBitmapProvider->end_getLatestFrame( gPendingFrame ) );
+         }
+         else
+         {
+            gLastFrame = gBitmapProvider->end_getFrame( gPendingFrame );
+         }
+         if( gPendingStereo || !gInputChannel )
+         {
+            gFrameViewPos    = gRequestViewPos;
+            gFrameViewDir    = gRequestViewDir;
+            gFrameViewAngles = gRequestViewAngles;
+         }
+         gPendingFrame = 0;
+         gPendingLevel = -1;
+         gFrameSceneInfo  = gRequestSceneInfo;
+         gFrameUpdated    = true;
       }
-      catch(const Ice::Exception& e)
+
+      if( gInputChannel ) sendInput();
+
+      if( !gPresentedChannel.empty() && glutGet(GLUT_ELAPSED_TIME) >= gNextPresentTime )
       {
-         std::cout << e.ice_name() << std::endl;
-         std::cout << e.ice_file() << std::endl;
-         std::cout << e.ice_stackTrace() << std::endl;
+         gNextPresentTime = glutGet(GLUT_ELAPSED_TIME)+PRESENT_INTERVAL;
+         gBitmapProvider->presentChannel( gPresentedChannel );
       }
-      catch( ... ) 
+
+      // Refinements of the last camera, as long as it is still the current one
+      if( !gRefreshNeeded && gNextLevel >= 0 && !gPendingFrame && glutGet(GLUT_ELAPSED_TIME) >= gNextRequestTime )
       {
-         std::cout << "Unknown exception" << std::endl;
+         gPendingLevel      = gNextLevel;
+         gPendingRefinement = true;
+         gNextLevel         = -1;
+         gPendingFrame = gBitmapProvider->begin_getFrameLevel( 
+            gRequestViewPos.x, gRequestViewPos.y, gRequestViewPos.z, 
+            gRequestViewDir.x, gRequestViewDir.y, gRequestViewDir.z, 
+            gRequestViewAngles.x, gRequestViewAngles.y, gRequestViewAngles.z,
+            gRequestSceneInfo, gPostProcessingInfo, gPendingLevel, true, false );
       }
 
+      // Only one request at a time, later changes are sent with the next one
+      if( gRefreshNeeded && !gPendingFrame && glutGet(GLUT_ELAPSED_TIME) >= gNextRequestTime )
+      {
+         if( gPostProcessingStagesChanged )
+         {
+            gBitmapProvider->setPostProcessingStages( gPostProcessingStages );
+            gPostProcessingStagesChanged = false;
+         }
+
+         gRequestViewPos    = gViewPos;
+         gRequestViewDir    = gViewDir;
+         gRequestViewAngles = gViewAngles;
+         gRequestSceneInfo  = gSceneInfo;
+         gPendingStereo = (gSceneInfo.supportFor3DVision != ::IceStreamer::vtStandard);
+         gNextLevel = -1;
+         if( gPendingStereo )
+         {
+            gPendingFrame = gBitmapProvider->begin_getStereoFrame( 
+               gViewPos.x, gViewPos.y, gViewPos.z, 
+               gViewDir.x, gViewDir.y, gViewDir.z, 
+               gViewAngles.x, gViewAngles.y, gViewAngles.z,
+               gSceneInfo, gPostProcessingInfo, true );
+         }
+         else if( gProgressiveLevels > 0 )
+         {
+            gPendingLevel      = gProgressiveLevels;
+            gPendingRefinement = false;
+            gPendingFrame = gBitmapProvider->begin_getFrameLevel( 
+               gViewPos.x, gViewPos.y, gViewPos.z, 
+               gViewDir.x, gViewDir.y, gViewDir.z, 
+               gViewAngles.x, gViewAngles.y, gViewAngles.z,
+               gSceneInfo, gPostProcessingInfo, gPendingLevel, false, gReprojection );
+         }
+         else if( gInputChannel )
+         {
+            gPendingFrame = gBitmapProvider->begin_getLatestFrame( gReprojection );
+         }
+         else
+         {
+            gPendingFrame = gBitmapProvider->begin_getFrame( 
+               gViewPos.x, gViewPos.y, gViewPos.z, 
+               gViewDir.x, gViewDir.y, gViewDir.z, 
+               gViewAngles.x, gViewAngles.y, gViewAngles.z,
+               gSceneInfo, gPostProcessingInfo, gReprojection );
+         }
+         gRefreshNeeded = false;
+
 #ifdef WIN32
-      long t = GetTickCount();
-      anim += (t - gTickCount) / 1000.f;
-      gTickCount = t;
+         long t = GetTickCount();
+         anim += (t - gTickCount) / 1000.f;
+         gTickCount = t;
 #else
-      anim += 0.2f;
+         anim += 0.2f;
 #endif
+      }
+   }
+   catch(const ::IceStreamer::FrameRejected& e)
+   {
+      // The request is sent again when the server is ready for it
+      gPendingFrame = 0;
+      if( gPendingLevel >= 0 && gPendingRefinement )
+         gNextLevel = gPendingLevel;
+      else
+         gRefreshNeeded = true;
+      gPendingLevel = -1;
+      gNextRequestTime = glutGet(GLUT_ELAPSED_TIME)+e.retryAfter;
+   }
+   catch(const ::IceStreamer::ChannelUnavailable& e)
+   {
+      // Presented again at the next interval
+      std::cout << e.reason << std::endl;
    }
+   catch(const Ice::Exception& e)
+   {
+      std::cout << e.ice_name() << std::endl;
+      std::cout << e.ice_file() << std::endl;
+      std::cout << e.ice_stackTrace() << std::endl;
+      gPendingFrame = 0;
+      gPendingLevel = -1;
+   }
+   catch( ... ) 
+   {
+      std::cout << "Unknown exception" << std::endl;
+      gPendingFrame = 0;
+      gPendingLevel = -1;
+   }
+
+   updateImage();
    glutPostRedisplay();
    glutTimerFunc(REFRESH_DELAY, timerEvent,0);
-   gRefreshNeeded = false;
+}
+
+void broadcastTimerEvent(int value)
+{
+   try 
+   {
+      if( gPendingFrame && gPendingFrame->isCompleted() )
+      {
+         collectBroadcastFrame( gBitmapProvider->end_getBroadcastFrame( gPendingFrame ) );
+         gPendingFrame = 0;
+      }
+
+      // The server answers once the channel has a frame more recent than
+      // the last one received
+      if( !gPendingFrame && glutGet(GLUT_ELAPSED_TIME) >= gNextRequestTime )
+         gPendingFrame = gBitmapProvider->begin_getBroadcastFrame( gWatchedChannel, gBroadcastTier, gBroadcastSequence );
+   }
+   catch(const ::IceStreamer::ChannelUnavailable& e)
+   {
+      // Until the presenter opens the channel again
+      std::cout << e.reason << std::endl;
+      gPendingFrame      = 0;
+      gBroadcastSequence = 0;
+      gNextRequestTime   = glutGet(GLUT_ELAPSED_TIME)+1000;
+   }
+   catch(const Ice::Exception& e)
+   {
+      std::cout << e.ice_name() << std::endl;
+      std::cout << e.ice_file() << std::endl;
+      std::cout << e.ice_stackTrace() << std::endl;
+      gPendingFrame = 0;
+   }
+   catch( ... ) 
+   {
+      std::cout << "Unknown exception" << std::endl;
+      gPendingFrame = 0;
+   }
+
+   glutPostRedisplay();
+   glutTimerFunc(REFRESH_DELAY, broadcastTimerEvent,0);
 }
 
 // Keyboard events handler
@@ -406,6 +962,35 @@ void keyboard(unsigned char key, int x, int y)
          gHelp = !gHelp;
          break;
       }
+   case 'r':
+      {
+         gReprojection = !gReprojection;
+         break;
+      }
+   case 'a':
+      {
+         gPostProcessingStages.antiAliasing = !gPostProcessingStages.antiAliasing;
+         gPostProcessingStagesChanged = true;
+         break;
+      }
+   case 'D':
+      {
+         gPostProcessingStages.depthOfField = !gPostProcessingStages.depthOfField;
+         gPostProcessingStagesChanged = true;
+         break;
+      }
+   case 'e':
+      {
+         gPostProcessingStages.denoise = !gPostProcessingStages.denoise;
+         gPostProcessingStagesChanged = true;
+         break;
+      }
+   case 't':
+      {
+         gPostProcessingStages.toneMapping = !gPostProcessingStages.toneMapping;
+         gPostProcessingStagesChanged = true;
+         break;
+      }
    case 's':
       {
          gSceneInfo.shadowsEnabled = !gSceneInfo.shadowsEnabled;
@@ -551,6 +1136,27 @@ int main( int argc, char* argv[] )
       gBitmapProvider = ::IceStreamer::BitmapProviderPrx::checkedCast(
          gCommunicator->propertyToProxy("IceStreamerAdaptor.Proxy"));
 
+      Ice::PropertiesPtr properties = gCommunicator->getProperties();
+      gReprojection = properties->getPropertyAsIntWithDefault("IceStreamer.Reprojection", 1) != 0;
+      gInputChannel = properties->getPropertyAsIntWithDefault("IceStreamer.InputChannel", 1) != 0;
+      gAbsoluteInputInterval = properties->getPropertyAsIntWithDefault("IceStreamer.InputChannel.AbsoluteInterval", 1000);
+      gProgressiveLevels = std::max(0, std::min(3, properties->getPropertyAsIntWithDefault("IceStreamer.Progressive.Levels", 0)));
+
+      // Progressive frames carry their camera
+      if( gProgressiveLevels > 0 ) gInputChannel = false;
+
+      // The camera of a presented channel is the one of the input channel
+      gPresentedChannel = properties->getProperty("IceStreamer.Broadcast.Present");
+      gWatchedChannel   = properties->getProperty("IceStreamer.Broadcast.Watch");
+      gBroadcastTier    = std::max(0, std::min(3, properties->getPropertyAsIntWithDefault("IceStreamer.Broadcast.Tier", 0)));
+      if( !gPresentedChannel.empty() )
+      {
+         gInputChannel      = true;
+         gProgressiveLevels = 0;
+      }
+      gInputProvider = ::IceStreamer::BitmapProviderPrx::uncheckedCast(gBitmapProvider->ice_oneway());
+      gPixelPitch = static_cast<float>(atof(properties->getPropertyWithDefault("IceStreamer.Camera.PixelPitch", "4").c_str()));
+
       gSceneInfo = gBitmapProvider->getSceneInfo();
       gWindowWidth  = gSceneInfo.width;
       gWindowHeight = gSceneInfo.height;
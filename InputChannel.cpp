@@ -0,0 +1,122 @@
+// Project
+#include "Trace.h"
+#include "InputChannel.h"
+
+namespace
+{
+   // Events waiting for a missing one. Past this, the missing events are
+   // given up.
+   const size_t MAX_PENDING_EVENTS = 256;
+}
+
+InputChannel::InputChannel() :
+   sequence_(0),
+   hasCamera_(false),
+   hasSettings_(false)
+{
+   ::IceStreamer::CameraState camera = { 0.f, 0.f, 0.f, 0.f, 0.f, 0.f, 0.f, 0.f, 0.f };
+   camera_ = camera;
+}
+
+void InputChannel::updateCamera( const ::IceStreamer::CameraEvent& event )
+{
+   Event e;
+   e.isCamera = true;
+   e.camera   = event;
+   push( event.sequence, e );
+}
+
+void InputChannel::updateSettings(
+   Ice::Long sequence,
+   const ::IceStreamer::SceneInfo& sceneInfo,
+   const ::IceStreamer::PostProcessingInfo& postProcessingInfo )
+{
+   Event e;
+   e.isCamera           = false;
+   e.sceneInfo          = sceneInfo;
+   e.postProcessingInfo = postProcessingInfo;
+   push( sequence, e );
+}
+
+Ice::Long InputChannel::getState(
+   ::IceStreamer::CameraState& camera,
+   bool& hasCamera,
+   bool& hasSettings,
+   ::IceStreamer::SceneInfo& sceneInfo,
+   ::IceStreamer::PostProcessingInfo& postProcessingInfo )
+{
+   IceUtil::Mutex::Lock lock(mutex_);
+   camera             = camera_;
+   hasCamera          = hasCamera_;
+   hasSettings        = hasSettings_;
+   sceneInfo          = sceneInfo_;
+   postProcessingInfo = postProcessingInfo_;
+   return sequence_;
+}
+
+void InputChannel::push( Ice::Long sequence, const Event& event )
+{
+   IceUtil::Mutex::Lock lock(mutex_);
+   if( sequence <= sequence_ ) return;
+
+   pending_[sequence] = event;
+   if( event.isCamera && event.camera.absolute && sequence > sequence_+1 )
+   {
+      // Settings events still missing before it are superseded by the
+      // client's next settings
+      APPL_LOG_INFO("Input resynchronized at event " << sequence);
+      foldUpTo( sequence );
+   }
+   else if( pending_.size() > MAX_PENDING_EVENTS )
+   {
+      APPL_LOG_WARNING("Input events " << sequence_+1 << " to " << pending_.begin()->first-1 << " lost");
+      sequence_ = pending_.begin()->first-1;
+   }
+
+   // Events are folded in order, as soon as there is no gap before them
+   std::map<Ice::Long, Event>::iterator it = pending_.begin();
+   while( it != pending_.end() && it->first == sequence_+1 )
+   {
+      fold( it->second );
+      sequence_ = it->first;
+      pending_.erase( it++ );
+   }
+}
+
+void InputChannel::foldUpTo( Ice::Long sequence )
+{
+   // Camera events before an absolute one are replaced by it, settings
+   // events are folded in order
+   std::map<Ice::Long, Event>::iterator it = pending_.begin();
+   while( it != pending_.end() && it->first < sequence )
+   {
+      if( !it->second.isCamera ) fold( it->second );
+      pending_.erase( it++ );
+   }
+   sequence_ = sequence-1;
+}
+
+void InputChannel::fold( const Event& event )
+{
+   if( !event.isCamera )
+   {
+      hasSettings_        = true;
+      sceneInfo_          = event.sceneInfo;
+      postProcessingInfo_ = event.postProcessingInfo;
+      return;
+   }
+
+   const ::IceStreamer::CameraState& c = event.camera.camera;
+   if( event.camera.absolute )
+   {
+      camera_    = c;
+      hasCamera_ = true;
+   }
+   else if( hasCamera_ )
+   {
+      // Moves of a camera the channel never had are meaningless
+      camera_.ex += c.ex; camera_.ey += c.ey; camera_.ez += c.ez;
+      camera_.dx += c.dx; camera_.dy += c.dy; camera_.dz += c.dz;
+      camera_.ax += c.ax; camera_.ay += c.ay; camera_.az += c.az;
+   }
+}
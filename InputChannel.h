@@ -0,0 +1,78 @@
+#pragma once
+
+// System
+#include <map>
+
+// Ice
+#include <IceUtil/Mutex.h>
+
+// Project
+#include "IIceStreamer.h"
+
+/*
+* @brief Input events of a session, received on the oneway input channel.
+* The Ice thread pool may dispatch oneway requests of a connection
+* concurrently, so events are put back in sequence order before being folded
+* into the camera and settings of the session. Frames are then rendered from
+* the latest state, and tagged with the sequence of the last event it
+* reflects.
+* An absolute camera event does not depend on the events before it: it is
+* folded as soon as it arrives, and missing events before it are given up.
+* This resynchronizes a channel with a client that started its sequence on a
+* previous session, or that lost events.
+*/
+class InputChannel
+{
+
+public:
+
+   InputChannel();
+
+public:
+
+   void updateCamera( const ::IceStreamer::CameraEvent& event );
+   void updateSettings(
+      Ice::Long sequence,
+      const ::IceStreamer::SceneInfo& sceneInfo,
+      const ::IceStreamer::PostProcessingInfo& postProcessingInfo );
+
+   /**
+   * @brief Returns the sequence of the last event folded into the state, 0
+   * when no event has been received. hasCamera is false until the first
+   * absolute camera event, hasSettings until the first settings event.
+   */
+   Ice::Long getState(
+      ::IceStreamer::CameraState& camera,
+      bool& hasCamera,
+      bool& hasSettings,
+      ::IceStreamer::SceneInfo& sceneInfo,
+      ::IceStreamer::PostProcessingInfo& postProcessingInfo );
+
+private:
+
+   struct Event
+   {
+      bool isCamera;
+      ::IceStreamer::CameraEvent camera;
+      ::IceStreamer::SceneInfo sceneInfo;
+      ::IceStreamer::PostProcessingInfo postProcessingInfo;
+   };
+
+   void push( Ice::Long sequence, const Event& event );
+   // Must be called with the lock held
+   void fold( const Event& event );
+   void foldUpTo( Ice::Long sequence );
+
+private:
+
+   IceUtil::Mutex mutex_;
+   Ice::Long sequence_;
+   std::map<Ice::Long, Event> pending_;
+
+   ::IceStreamer::CameraState camera_;
+   bool hasCamera_;
+   bool hasSettings_;
+   ::IceStreamer::SceneInfo sceneInfo_;
+   ::IceStreamer::PostProcessingInfo postProcessingInfo_;
+
+};
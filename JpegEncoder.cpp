@@ -0,0 +1,413 @@
+// System
+#include <math.h>
+
+// Project
+#include "JpegEncoder.h"
+
+namespace
+{
+   const unsigned char ZIGZAG[64] =
+   {
+       0,  1,  8, 16,  9,  2,  3, 10,
+      17, 24, 32, 25, 18, 11,  4,  5,
+      12, 19, 26, 33, 40, 48, 41, 34,
+      27, 20, 13,  6,  7, 14, 21, 28,
+      35, 42, 49, 56, 57, 50, 43, 36,
+      29, 22, 15, 23, 30, 37, 44, 51,
+      58, 59, 52, 45, 38, 31, 39, 46,
+      53, 60, 61, 54, 47, 55, 62, 63
+   };
+
+   // Tables of the JPEG standard, annex K. Quantization tables are in natural
+   // order.
+   const unsigned char LUMA_QUANTIZATION[64] =
+   {
+      16, 11, 10, 16,  24,  40,  51,  61,
+      12, 12, 14, 19,  26,  58,  60,  55,
+      14, 13, 16, 24,  40,  57,  69,  56,
+      14, 17, 22, 29,  51,  87,  80,  62,
+      18, 22, 37, 56,  68, 109, 103,  77,
+      24, 35, 55, 64,  81, 104, 113,  92,
+      49, 64, 78, 87, 103, 121, 120, 101,
+      72, 92, 95, 98, 112, 100, 103,  99
+   };
+
+   const unsigned char CHROMA_QUANTIZATION[64] =
+   {
+      17, 18, 24, 47, 99, 99, 99, 99,
+      18, 21, 26, 66, 99, 99, 99, 99,
+      24, 26, 56, 99, 99, 99, 99, 99,
+      47, 66, 99, 99, 99, 99, 99, 99,
+      99, 99, 99, 99, 99, 99, 99, 99,
+      99, 99, 99, 99, 99, 99, 99, 99,
+      99, 99, 99, 99, 99, 99, 99, 99,
+      99, 99, 99, 99, 99, 99, 99, 99
+   };
+
+   const unsigned char DC_LUMA_BITS[16]   = { 0, 1, 5, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 0, 0, 0 };
+   const unsigned char DC_CHROMA_BITS[16] = { 0, 3, 1, 1, 1, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 0 };
+   const unsigned char DC_VALUES[12]      = { 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11 };
+
+   const unsigned char AC_LUMA_BITS[16] = { 0, 2, 1, 3, 3, 2, 4, 3, 5, 5, 4, 4, 0, 0, 1, 0x7d };
+   const unsigned char AC_LUMA_VALUES[162] =
+   {
+      0x01, 0x02, 0x03, 0x00, 0x04, 0x11, 0x05, 0x12, 0x21, 0x31, 0x41, 0x06, 0x13, 0x51, 0x61, 0x07,
+      0x22, 0x71, 0x14, 0x32, 0x81, 0x91, 0xa1, 0x08, 0x23, 0x42, 0xb1, 0xc1, 0x15, 0x52, 0xd1, 0xf0,
+      0x24, 0x33, 0x62, 0x72, 0x82, 0x09, 0x0a, 0x16, 0x17, 0x18, 0x19, 0x1a, 0x25, 0x26, 0x27, 0x28,
+      0x29, 0x2a, 0x34, 0x35, 0x36, 0x37, 0x38, 0x39, 0x3a, 0x43, 0x44, 0x45, 0x46, 0x47, 0x48, 0x49,
+      0x4a, 0x53, 0x54, 0x55, 0x56, 0x57, 0x58, 0x59, 0x5a, 0x63, 0x64, 0x65, 0x66, 0x67, 0x68, 0x69,
+      0x6a, 0x73, 0x74, 0x75, 0x76, 0x77, 0x78, 0x79, 0x7a, 0x83, 0x84, 0x85, 0x86, 0x87, 0x88, 0x89,
+      0x8a, 0x92, 0x93, 0x94, 0x95, 0x96, 0x97, 0x98, 0x99, 0x9a, 0xa2, 0xa3, 0xa4, 0xa5, 0xa6, 0xa7,
+      0xa8, 0xa9, 0xaa, 0xb2, 0xb3, 0xb4, 0xb5, 0xb6, 0xb7, 0xb8, 0xb9, 0xba, 0xc2, 0xc3, 0xc4, 0xc5,
+      0xc6, 0xc7, 0xc8, 0xc9, 0xca, 0xd2, 0xd3, 0xd4, 0xd5, 0xd6, 0xd7, 0xd8, 0xd9, 0xda, 0xe1, 0xe2,
+      0xe3, 0xe4, 0xe5, 0xe6, 0xe7, 0xe8, 0xe9, 0xea, 0xf1, 0xf2, 0xf3, 0xf4, 0xf5, 0xf6, 0xf7, 0xf8,
+      0xf9, 0xfa
+   };
+
+   const unsigned char AC_CHROMA_BITS[16] = { 0, 2, 1, 2, 4, 4, 3, 4, 7, 5, 4, 4, 0, 1, 2, 0x77 };
+   const unsigned char AC_CHROMA_VALUES[162] =
+   {
+      0x00, 0x01, 0x02, 0x03, 0x11, 0x04, 0x05, 0x21, 0x31, 0x06, 0x12, 0x41, 0x51, 0x07, 0x61, 0x71,
+      0x13, 0x22, 0x32, 0x81, 0x08, 0x14, 0x42, 0x91, 0xa1, 0xb1, 0xc1, 0x09, 0x23, 0x33, 0x52, 0xf0,
+      0x15, 0x62, 0x72, 0xd1, 0x0a, 0x16, 0x24, 0x34, 0xe1, 0x25, 0xf1, 0x17, 0x18, 0x19, 0x1a, 0x26,
+      0x27, 0x28, 0x29, 0x2a, 0x35, 0x36, 0x37, 0x38, 0x39, 0x3a, 0x43, 0x44, 0x45, 0x46, 0x47, 0x48,
+      0x49, 0x4a, 0x53, 0x54, 0x55, 0x56, 0x57, 0x58, 0x59, 0x5a, 0x63, 0x64, 0x65, 0x66, 0x67, 0x68,
+      0x69, 0x6a, 0x73, 0x74, 0x75, 0x76, 0x77, 0x78, 0x79, 0x7a, 0x82, 0x83, 0x84, 0x85, 0x86, 0x87,
+      0x88, 0x89, 0x8a, 0x92, 0x93, 0x94, 0x95, 0x96, 0x97, 0x98, 0x99, 0x9a, 0xa2, 0xa3, 0xa4, 0xa5,
+      0xa6, 0xa7, 0xa8, 0xa9, 0xaa, 0xb2, 0xb3, 0xb4, 0xb5, 0xb6, 0xb7, 0xb8, 0xb9, 0xba, 0xc2, 0xc3,
+      0xc4, 0xc5, 0xc6, 0xc7, 0xc8, 0xc9, 0xca, 0xd2, 0xd3, 0xd4, 0xd5, 0xd6, 0xd7, 0xd8, 0xd9, 0xda,
+      0xe2, 0xe3, 0xe4, 0xe5, 0xe6, 0xe7, 0xe8, 0xe9, 0xea, 0xf2, 0xf3, 0xf4, 0xf5, 0xf6, 0xf7, 0xf8,
+      0xf9, 0xfa
+   };
+
+   /*
+   * @brief Huffman codes indexed by symbol, built from the bit counts and
+   * values of a table
+   */
+   struct HuffmanTable
+   {
+      unsigned short codes[256];
+      unsigned char  lengths[256];
+
+      HuffmanTable( const unsigned char* bits, const unsigned char* values )
+      {
+         for( int i(0); i<256; ++i ) lengths[i] = 0;
+         unsigned short code(0);
+         int k(0);
+         for( int length(1); length<=16; ++length )
+         {
+            for( int i(0); i<bits[length-1]; ++i, ++k )
+            {
+               codes[values[k]]   = code++;
+               lengths[values[k]] = static_cast<unsigned char>(length);
+            }
+            code <<= 1;
+         }
+      }
+   };
+
+   const HuffmanTable DC_LUMA( DC_LUMA_BITS, DC_VALUES );
+   const HuffmanTable DC_CHROMA( DC_CHROMA_BITS, DC_VALUES );
+   const HuffmanTable AC_LUMA( AC_LUMA_BITS, AC_LUMA_VALUES );
+   const HuffmanTable AC_CHROMA( AC_CHROMA_BITS, AC_CHROMA_VALUES );
+
+   // Scale factors of the AAN DCT, folded into the quantization
+   const float AAN_SCALES[8] =
+   {
+      1.0f, 1.387039845f, 1.306562965f, 1.175875602f,
+      1.0f, 0.785694958f, 0.541196100f, 0.275899379f
+   };
+
+   // One dimensional AAN forward DCT of 8 values, stride apart
+   void dct8( float* d, int stride )
+   {
+      float d0 = d[0], d1 = d[stride], d2 = d[2*stride], d3 = d[3*stride];
+      float d4 = d[4*stride], d5 = d[5*stride], d6 = d[6*stride], d7 = d[7*stride];
+
+      float tmp0 = d0+d7, tmp7 = d0-d7;
+      float tmp1 = d1+d6, tmp6 = d1-d6;
+      float tmp2 = d2+d5, tmp5 = d2-d5;
+      float tmp3 = d3+d4, tmp4 = d3-d4;
+
+      // Even part
+      float tmp10 = tmp0+tmp3, tmp13 = tmp0-tmp3;
+      float tmp11 = tmp1+tmp2, tmp12 = tmp1-tmp2;
+      d[0]        = tmp10+tmp11;
+      d[4*stride] = tmp10-tmp11;
+      float z1 = (tmp12+tmp13)*0.707106781f;
+      d[2*stride] = tmp13+z1;
+      d[6*stride] = tmp13-z1;
+
+      // Odd part
+      tmp10 = tmp4+tmp5;
+      tmp11 = tmp5+tmp6;
+      tmp12 = tmp6+tmp7;
+      float z5 = (tmp10-tmp12)*0.382683433f;
+      float z2 = tmp10*0.541196100f+z5;
+      float z4 = tmp12*1.306562965f+z5;
+      float z3 = tmp11*0.707106781f;
+      float z11 = tmp7+z3;
+      float z13 = tmp7-z3;
+      d[5*stride] = z13+z2;
+      d[3*stride] = z13-z2;
+      d[1*stride] = z11+z4;
+      d[7*stride] = z11-z4;
+   }
+
+   inline unsigned char clampByte( int value )
+   {
+      return static_cast<unsigned char>(value < 1 ? 1 : (value > 255 ? 255 : value));
+   }
+
+   inline void writeByte( std::vector<unsigned char>& jpeg, int value )
+   {
+      jpeg.push_back( static_cast<unsigned char>(value) );
+   }
+
+   inline void writeWord( std::vector<unsigned char>& jpeg, int value )
+   {
+      jpeg.push_back( static_cast<unsigned char>(value>>8) );
+      jpeg.push_back( static_cast<unsigned char>(value) );
+   }
+
+   void writeHuffmanTable( std::vector<unsigned char>& jpeg, int tableClass, const unsigned char* bits, const unsigned char* values )
+   {
+      int nbValues(0);
+      for( int i(0); i<16; ++i ) nbValues += bits[i];
+      writeByte( jpeg, tableClass );
+      jpeg.insert( jpeg.end(), bits, bits+16 );
+      jpeg.insert( jpeg.end(), values, values+nbValues );
+   }
+}
+
+JpegEncoder::JpegEncoder() :
+   quality_(0),
+   bitBuffer_(0),
+   bitCount_(0)
+{
+}
+
+void JpegEncoder::encode(
+   const unsigned char* image, int width, int height,
+   int quality,
+   std::vector<unsigned char>& jpeg,
+   const unsigned char* constantMacroblocks )
+{
+   jpeg.clear();
+   if( width <= 0 || height <= 0 ) return;
+   setQuality( quality );
+   writeHeaders( width, height, jpeg );
+
+   bitBuffer_ = 0;
+   bitCount_  = 0;
+   int dc[3] = { 0, 0, 0 };
+   for( int y(0); y<height; y+=16 )
+   {
+      for( int x(0); x<width; x+=16 )
+      {
+         if( constantMacroblocks && *constantMacroblocks++ )
+         {
+            const unsigned char* p = image+(y*width+x)*3;
+            float red = p[0], green = p[1], blue = p[2];
+            float luma = 0.299f*red+0.587f*green+0.114f*blue-128.f;
+            for( int b(0); b<4; ++b )
+               dc[0] = encodeConstantBlock( luma, scaledQuantization_[0], dc[0], 0, jpeg );
+            dc[1] = encodeConstantBlock( -0.168736f*red-0.331264f*green+0.5f*blue, scaledQuantization_[1], dc[1], 1, jpeg );
+            dc[2] = encodeConstantBlock( 0.5f*red-0.418688f*green-0.081312f*blue, scaledQuantization_[1], dc[2], 2, jpeg );
+            continue;
+         }
+         loadBlocks( image, width, height, x, y );
+         for( int b(0); b<4; ++b )
+            dc[0] = encodeBlock( blocks_[b], scaledQuantization_[0], dc[0], 0, jpeg );
+         dc[1] = encodeBlock( blocks_[4], scaledQuantization_[1], dc[1], 1, jpeg );
+         dc[2] = encodeBlock( blocks_[5], scaledQuantization_[1], dc[2], 2, jpeg );
+      }
+   }
+   flushBits( jpeg );
+
+   // EOI
+   writeWord( jpeg, 0xFFD9 );
+}
+
+void JpegEncoder::setQuality( int quality )
+{
+   if( quality < 1 ) quality = 1;
+   if( quality > 100 ) quality = 100;
+   if( quality == quality_ ) return;
+   quality_ = quality;
+
+   // Same scaling as the IJG library
+   int scale = (quality < 50) ? 5000/quality : 200-quality*2;
+   for( int i(0); i<64; ++i )
+   {
+      quantization_[0][i] = clampByte( (LUMA_QUANTIZATION[i]*scale+50)/100 );
+      quantization_[1][i] = clampByte( (CHROMA_QUANTIZATION[i]*scale+50)/100 );
+   }
+
+   // Divisors of the DCT output, including the AAN scale factors
+   for( int t(0); t<2; ++t )
+      for( int v(0); v<8; ++v )
+         for( int u(0); u<8; ++u )
+            scaledQuantization_[t][v*8+u] = 1.f/(quantization_[t][v*8+u]*AAN_SCALES[u]*AAN_SCALES[v]*8.f);
+}
+
+void JpegEncoder::writeHeaders( int width, int height, std::vector<unsigned char>& jpeg )
+{
+   // SOI and JFIF APP0
+   static const unsigned char JFIF[] =
+   {
+      0xFF, 0xD8, 0xFF, 0xE0, 0x00, 0x10, 'J', 'F', 'I', 'F', 0x00,
+      0x01, 0x01, 0x00, 0x00, 0x01, 0x00, 0x01, 0x00, 0x00
+   };
+   jpeg.insert( jpeg.end(), JFIF, JFIF+sizeof(JFIF) );
+
+   // Quantization tables, in zigzag order
+   writeWord( jpeg, 0xFFDB );
+   writeWord( jpeg, 2+2*65 );
+   for( int t(0); t<2; ++t )
+   {
+      writeByte( jpeg, t );
+      for( int i(0); i<64; ++i ) writeByte( jpeg, quantization_[t][ZIGZAG[i]] );
+   }
+
+   // Frame: 3 components, luma sampled 2x2, chroma 1x1
+   writeWord( jpeg, 0xFFC0 );
+   writeWord( jpeg, 17 );
+   writeByte( jpeg, 8 );
+   writeWord( jpeg, height );
+   writeWord( jpeg, width );
+   writeByte( jpeg, 3 );
+   static const unsigned char COMPONENTS[9] = { 1, 0x22, 0, 2, 0x11, 1, 3, 0x11, 1 };
+   jpeg.insert( jpeg.end(), COMPONENTS, COMPONENTS+9 );
+
+   // Huffman tables
+   writeWord( jpeg, 0xFFC4 );
+   writeWord( jpeg, 2+4*17+2*12+2*162 );
+   writeHuffmanTable( jpeg, 0x00, DC_LUMA_BITS, DC_VALUES );
+   writeHuffmanTable( jpeg, 0x10, AC_LUMA_BITS, AC_LUMA_VALUES );
+   writeHuffmanTable( jpeg, 0x01, DC_CHROMA_BITS, DC_VALUES );
+   writeHuffmanTable( jpeg, 0x11, AC_CHROMA_BITS, AC_CHROMA_VALUES );
+
+   // Scan
+   static const unsigned char SCAN[] =
+   {
+      0xFF, 0xDA, 0x00, 0x0C, 0x03, 1, 0x00, 2, 0x11, 3, 0x11, 0x00, 0x3F, 0x00
+   };
+   jpeg.insert( jpeg.end(), SCAN, SCAN+sizeof(SCAN) );
+}
+
+void JpegEncoder::loadBlocks( const unsigned char* image, int width, int height, int x, int y )
+{
+   float cb[16*16];
+   float cr[16*16];
+   for( int j(0); j<16; ++j )
+   {
+      // Pixels outside of the image repeat the last row and column
+      int row = (y+j < height) ? y+j : height-1;
+      for( int i(0); i<16; ++i )
+      {
+         int column = (x+i < width) ? x+i : width-1;
+         const unsigned char* p = image+(row*width+column)*3;
+         float r = p[0], g = p[1], b = p[2];
+         blocks_[(j/8)*2+i/8][(j%8)*8+i%8] = 0.299f*r+0.587f*g+0.114f*b-128.f;
+         cb[j*16+i] = -0.168736f*r-0.331264f*g+0.5f*b;
+         cr[j*16+i] =  0.5f*r-0.418688f*g-0.081312f*b;
+      }
+   }
+
+   for( int j(0); j<8; ++j )
+   {
+      for( int i(0); i<8; ++i )
+      {
+         int k = (2*j)*16+2*i;
+         blocks_[4][j*8+i] = 0.25f*(cb[k]+cb[k+1]+cb[k+16]+cb[k+17]);
+         blocks_[5][j*8+i] = 0.25f*(cr[k]+cr[k+1]+cr[k+16]+cr[k+17]);
+      }
+   }
+}
+
+int JpegEncoder::encodeBlock( float* block, const float* quantization, int dc, int component, std::vector<unsigned char>& jpeg )
+{
+   for( int i(0); i<8; ++i ) dct8( block+i*8, 1 );
+   for( int i(0); i<8; ++i ) dct8( block+i, 8 );
+
+   int coefficients[64];
+   for( int i(0); i<64; ++i )
+   {
+      float value = block[ZIGZAG[i]]*quantization[ZIGZAG[i]];
+      coefficients[i] = static_cast<int>(value < 0.f ? value-0.5f : value+0.5f);
+   }
+   return writeCoefficients( coefficients, dc, component, jpeg );
+}
+
+int JpegEncoder::encodeConstantBlock( float value, const float* quantization, int dc, int component, std::vector<unsigned char>& jpeg )
+{
+   // The DCT of a constant block only has its DC coefficient, 64 times the
+   // value before the AAN scaling
+   int coefficients[64] = { 0 };
+   float coefficient = value*64.f*quantization[0];
+   coefficients[0] = static_cast<int>(coefficient < 0.f ? coefficient-0.5f : coefficient+0.5f);
+   return writeCoefficients( coefficients, dc, component, jpeg );
+}
+
+int JpegEncoder::writeCoefficients( const int* coefficients, int dc, int component, std::vector<unsigned char>& jpeg )
+{
+   const HuffmanTable& dcTable = (component == 0) ? DC_LUMA : DC_CHROMA;
+   const HuffmanTable& acTable = (component == 0) ? AC_LUMA : AC_CHROMA;
+
+   // Coefficients are written as a Huffman coded size (and run of zeros for
+   // AC) followed by the value on that many bits
+   int diff = coefficients[0]-dc;
+   int value = diff < 0 ? -diff : diff;
+   int size(0);
+   while( value ) { ++size; value >>= 1; }
+   writeBits( dcTable.codes[size], dcTable.lengths[size], jpeg );
+   if( size ) writeBits( diff < 0 ? diff+(1<<size)-1 : diff, size, jpeg );
+
+   int run(0);
+   for( int i(1); i<64; ++i )
+   {
+      int coefficient = coefficients[i];
+      if( coefficient == 0 )
+      {
+         ++run;
+         continue;
+      }
+      while( run >= 16 )
+      {
+         // ZRL
+         writeBits( acTable.codes[0xF0], acTable.lengths[0xF0], jpeg );
+         run -= 16;
+      }
+      value = coefficient < 0 ? -coefficient : coefficient;
+      size = 0;
+      while( value ) { ++size; value >>= 1; }
+      int symbol = (run<<4)|size;
+      writeBits( acTable.codes[symbol], acTable.lengths[symbol], jpeg );
+      writeBits( coefficient < 0 ? coefficient+(1<<size)-1 : coefficient, size, jpeg );
+      run = 0;
+   }
+   // EOB
+   if( run > 0 ) writeBits( acTable.codes[0x00], acTable.lengths[0x00], jpeg );
+   return coefficients[0];
+}
+
+void JpegEncoder::writeBits( unsigned int code, int length, std::vector<unsigned char>& jpeg )
+{
+   bitBuffer_ = (bitBuffer_<<length)|(code&((1u<<length)-1));
+   bitCount_ += length;
+   while( bitCount_ >= 8 )
+   {
+      unsigned char byte = static_cast<unsigned char>(bitBuffer_>>(bitCount_-8));
+      jpeg.push_back( byte );
+      // Byte stuffing
+      if( byte == 0xFF ) jpeg.push_back( 0 );
+      bitCount_ -= 8;
+   }
+}
+
+void JpegEncoder::flushBits( std::vector<unsigned char>& jpeg )
+{
+   // Padding with ones
+   if( bitCount_ > 0 ) writeBits( 0x7F, 8-bitCount_, jpeg );
+}
@@ -0,0 +1,58 @@
+#pragma once
+
+// System
+#include <vector>
+
+/*
+* @brief Baseline JPEG encoder for the frames sent to browsers. Chroma is
+* subsampled 2x2 (4:2:0) and the standard Huffman tables are used, so that a
+* frame is encoded in a single pass. Quantization tables only depend on the
+* quality and are built once per encoder.
+* An instance keeps its work buffers, it must not be used by several threads
+* at the same time.
+*/
+class JpegEncoder
+{
+
+public:
+
+   JpegEncoder();
+
+public:
+
+   /**
+   * @brief Encodes an RGB image, rows top down, quality from 1 to 100.
+   * constantMacroblocks optionally flags the 16x16 macroblocks, in raster
+   * order, whose pixels all have the same color. These are written from
+   * their first pixel without going through the DCT.
+   */
+   void encode(
+      const unsigned char* image, int width, int height,
+      int quality,
+      std::vector<unsigned char>& jpeg,
+      const unsigned char* constantMacroblocks = 0 );
+
+private:
+
+   void setQuality( int quality );
+   void writeHeaders( int width, int height, std::vector<unsigned char>& jpeg );
+   void loadBlocks( const unsigned char* image, int width, int height, int x, int y );
+   int  encodeBlock( float* block, const float* quantization, int dc, int component, std::vector<unsigned char>& jpeg );
+   int  encodeConstantBlock( float value, const float* quantization, int dc, int component, std::vector<unsigned char>& jpeg );
+   int  writeCoefficients( const int* coefficients, int dc, int component, std::vector<unsigned char>& jpeg );
+   void writeBits( unsigned int code, int length, std::vector<unsigned char>& jpeg );
+   void flushBits( std::vector<unsigned char>& jpeg );
+
+private:
+
+   int quality_;
+   unsigned char quantization_[2][64];
+   float scaledQuantization_[2][64];
+
+   // 16x16 macroblock: 4 luma blocks, then Cb and Cr
+   float blocks_[6][64];
+
+   unsigned int bitBuffer_;
+   int bitCount_;
+
+};
@@ -0,0 +1,316 @@
+// System
+#include <string.h>
+#include <math.h>
+#include <algorithm>
+
+// Project
+#include "Trace.h"
+#include "MolecularStore.h"
+#include "PdbReader.h"
+
+namespace
+{
+   // Radius of carbon, mapped to the atom size
+   const float CARBON_RADIUS = 1.70f;
+
+   // Ratio between the sphere sizes at which a level is entered and left
+   const float DETAIL_HYSTERESIS = 1.25f;
+
+   /*
+   * @brief Values of a store saved with its arrays
+   */
+   struct StoreInfo
+   {
+      float radiusStep;
+      float typicalRadius[mdCount];
+      BoundingBox bounds;
+      float boundingRadius;
+   };
+
+   float median( std::vector<float>& values )
+   {
+      if( values.empty() ) return 0.f;
+      std::nth_element( values.begin(), values.begin()+values.size()/2, values.end() );
+      return values[values.size()/2];
+   }
+}
+
+MolecularStore::MolecularStore( float threshold, MolecularDetail finestDetail ) :
+   radiusStep_(0.f),
+   boundingRadius_(0.f),
+   threshold_(threshold),
+   finestDetail_(finestDetail)
+{
+   memset( &bounds_, 0, sizeof(bounds_) );
+   for( int i(0); i<mdCount; ++i ) typicalRadius_[i] = 0.f;
+}
+
+bool MolecularStore::loadFromFile( const std::string& fileName, float atomSize, float scale )
+{
+   std::vector<PdbAtom> atoms;
+   if( !PdbReader::read( fileName, atoms ) ) return false;
+
+   size_t nbAtoms = atoms.size();
+   std::vector<float> radii( nbAtoms );
+   std::vector<unsigned int> residues( nbAtoms );
+   std::vector<unsigned int> chains( nbAtoms );
+   x_.resize( nbAtoms );
+   y_.resize( nbAtoms );
+   z_.resize( nbAtoms );
+   elements_.resize( nbAtoms );
+   materials_.resize( nbAtoms );
+   for( size_t i(0); i<nbAtoms; ++i )
+   {
+      const PdbAtom& atom = atoms[i];
+      x_[i]         = atom.x*scale;
+      y_[i]         = atom.y*scale;
+      z_[i]         = atom.z*scale;
+      radii[i]      = atomSize*PdbReader::getRadius(atom.element)/CARBON_RADIUS;
+      elements_[i]  = atom.element;
+      materials_[i] = PdbReader::getMaterial(atom.element);
+      residues[i]   = atom.residue;
+      chains[i]     = atom.chain;
+   }
+
+   // Centered on the origin
+   float minimum[3] = {  1e30f,  1e30f,  1e30f };
+   float maximum[3] = { -1e30f, -1e30f, -1e30f };
+   float maxRadius(0.f);
+   for( size_t i(0); i<nbAtoms; ++i )
+   {
+      minimum[0] = std::min(minimum[0], x_[i]); maximum[0] = std::max(maximum[0], x_[i]);
+      minimum[1] = std::min(minimum[1], y_[i]); maximum[1] = std::max(maximum[1], y_[i]);
+      minimum[2] = std::min(minimum[2], z_[i]); maximum[2] = std::max(maximum[2], z_[i]);
+      maxRadius = std::max(maxRadius, radii[i]);
+   }
+   float center[3] = {
+      (minimum[0]+maximum[0])*0.5f, (minimum[1]+maximum[1])*0.5f, (minimum[2]+maximum[2])*0.5f };
+   for( size_t i(0); i<nbAtoms; ++i )
+   {
+      x_[i] -= center[0];
+      y_[i] -= center[1];
+      z_[i] -= center[2];
+   }
+   float half[3] = {
+      (maximum[0]-minimum[0])*0.5f+maxRadius,
+      (maximum[1]-minimum[1])*0.5f+maxRadius,
+      (maximum[2]-minimum[2])*0.5f+maxRadius };
+   BoundingBox bounds = { { -half[0], -half[1], -half[2] }, { half[0], half[1], half[2] } };
+   bounds_ = bounds;
+   boundingRadius_ = sqrtf(half[0]*half[0]+half[1]*half[1]+half[2]*half[2]);
+
+   // Radii quantized on 8 bits, rounded up so that atoms never shrink
+   radiusStep_ = maxRadius/255.f;
+   radii_.resize( nbAtoms );
+   for( size_t i(0); i<nbAtoms; ++i )
+   {
+      int quantized = static_cast<int>(ceilf(radii[i]/radiusStep_));
+      radii_[i] = static_cast<unsigned char>(std::min(quantized, 255));
+      radii[i] = getRadius(i);
+   }
+   typicalRadius_[mdAtoms] = median(radii);
+
+   buildImpostors( mdResidues, residues );
+   buildImpostors( mdChains, chains );
+
+   APPL_LOG_INFO(fileName << ": " << nbAtoms << " atoms, "
+      << impostors_[mdResidues].x.size() << " residues, "
+      << impostors_[mdChains].x.size() << " chains, "
+      << getMemorySize()/1024 << " KB");
+   return true;
+}
+
+void MolecularStore::save( SceneImageWriter& writer ) const
+{
+   StoreInfo info;
+   info.radiusStep = radiusStep_;
+   for( int i(0); i<mdCount; ++i ) info.typicalRadius[i] = typicalRadius_[i];
+   info.bounds         = bounds_;
+   info.boundingRadius = boundingRadius_;
+   writer.addValue( siMolecule, info );
+
+   writer.addArray( siAtomsX,        0, x_ );
+   writer.addArray( siAtomsY,        0, y_ );
+   writer.addArray( siAtomsZ,        0, z_ );
+   writer.addArray( siAtomRadii,     0, radii_ );
+   writer.addArray( siAtomElements,  0, elements_ );
+   writer.addArray( siAtomMaterials, 0, materials_ );
+   for( int detail(mdResidues); detail<mdCount; ++detail )
+   {
+      const Impostors& impostors = impostors_[detail];
+      writer.addArray( siImpostorsX,        detail, impostors.x );
+      writer.addArray( siImpostorsY,        detail, impostors.y );
+      writer.addArray( siImpostorsZ,        detail, impostors.z );
+      writer.addArray( siImpostorRadii,     detail, impostors.radii );
+      writer.addArray( siImpostorMaterials, detail, impostors.materials );
+   }
+}
+
+bool MolecularStore::load( const SceneImage& image )
+{
+   StoreInfo info;
+   if( !image.getValue( siMolecule, info ) ) return false;
+   bool loaded =
+      image.getArray( siAtomsX,        0, x_ ) &&
+      image.getArray( siAtomsY,        0, y_ ) &&
+      image.getArray( siAtomsZ,        0, z_ ) &&
+      image.getArray( siAtomRadii,     0, radii_ ) &&
+      image.getArray( siAtomElements,  0, elements_ ) &&
+      image.getArray( siAtomMaterials, 0, materials_ );
+   for( int detail(mdResidues); loaded && detail<mdCount; ++detail )
+   {
+      Impostors& impostors = impostors_[detail];
+      loaded =
+         image.getArray( siImpostorsX,        detail, impostors.x ) &&
+         image.getArray( siImpostorsY,        detail, impostors.y ) &&
+         image.getArray( siImpostorsZ,        detail, impostors.z ) &&
+         image.getArray( siImpostorRadii,     detail, impostors.radii ) &&
+         image.getArray( siImpostorMaterials, detail, impostors.materials );
+   }
+   if( !loaded || x_.empty() ) return false;
+
+   radiusStep_ = info.radiusStep;
+   for( int i(0); i<mdCount; ++i ) typicalRadius_[i] = info.typicalRadius[i];
+   bounds_         = info.bounds;
+   boundingRadius_ = info.boundingRadius;
+
+   APPL_LOG_INFO("Image: " << x_.size() << " atoms, "
+      << impostors_[mdResidues].x.size() << " residues, "
+      << impostors_[mdChains].x.size() << " chains, "
+      << getMemorySize()/1024 << " KB");
+   return true;
+}
+
+void MolecularStore::buildImpostors( MolecularDetail detail, const std::vector<unsigned int>& groups )
+{
+   size_t nbGroups = groups.empty() ? 0 : *std::max_element(groups.begin(), groups.end())+1;
+   Impostors& impostors = impostors_[detail];
+   impostors.x.assign( nbGroups, 0.f );
+   impostors.y.assign( nbGroups, 0.f );
+   impostors.z.assign( nbGroups, 0.f );
+   impostors.radii.assign( nbGroups, 0.f );
+   impostors.materials.assign( nbGroups, 0 );
+
+   // Centroids
+   std::vector<unsigned int> counts( nbGroups, 0 );
+   for( size_t i(0); i<groups.size(); ++i )
+   {
+      unsigned int g = groups[i];
+      impostors.x[g] += x_[i];
+      impostors.y[g] += y_[i];
+      impostors.z[g] += z_[i];
+      ++counts[g];
+   }
+   for( size_t g(0); g<nbGroups; ++g )
+   {
+      impostors.x[g] /= counts[g];
+      impostors.y[g] /= counts[g];
+      impostors.z[g] /= counts[g];
+   }
+
+   // Enclosing radius, and most frequent material
+   size_t nbMaterials = *std::max_element(materials_.begin(), materials_.end())+1;
+   std::vector<unsigned int> materialCounts( nbGroups*nbMaterials, 0 );
+   for( size_t i(0); i<groups.size(); ++i )
+   {
+      unsigned int g = groups[i];
+      float dx = x_[i]-impostors.x[g];
+      float dy = y_[i]-impostors.y[g];
+      float dz = z_[i]-impostors.z[g];
+      float radius = sqrtf(dx*dx+dy*dy+dz*dz)+getRadius(i);
+      if( radius > impostors.radii[g] ) impostors.radii[g] = radius;
+
+      unsigned int* count = &materialCounts[g*nbMaterials];
+      if( ++count[materials_[i]] > count[impostors.materials[g]] ) impostors.materials[g] = materials_[i];
+   }
+
+   std::vector<float> radii( impostors.radii );
+   typicalRadius_[detail] = median(radii);
+}
+
+size_t MolecularStore::getMemorySize() const
+{
+   size_t size = x_.size()*(3*sizeof(float)+3*sizeof(unsigned char));
+   for( int detail(mdResidues); detail<mdCount; ++detail )
+      size += impostors_[detail].x.size()*(4*sizeof(float)+sizeof(unsigned char));
+   return size;
+}
+
+size_t MolecularStore::getNbSpheres( MolecularDetail detail ) const
+{
+   return (detail == mdAtoms) ? x_.size() : impostors_[detail].x.size();
+}
+
+MolecularDetail MolecularStore::selectDetail( const CameraModel& camera, MolecularDetail current ) const
+{
+   // Size of a pixel on the closest side of the molecule
+   const CameraVector& origin = camera.getOrigin();
+   float distance = sqrtf(origin.x*origin.x+origin.y*origin.y+origin.z*origin.z)-boundingRadius_;
+   if( distance <= 0.f ) return finestDetail_;
+   float pixel = camera.getPixelFootprint(distance)*threshold_;
+
+   for( int detail(finestDetail_); detail<mdChains; ++detail )
+   {
+      float factor(1.f);
+      if( detail < current ) factor = DETAIL_HYSTERESIS;
+      else if( detail == current ) factor = 1.f/DETAIL_HYSTERESIS;
+      if( 2.f*typicalRadius_[detail] >= pixel*factor ) return static_cast<MolecularDetail>(detail);
+   }
+   return mdChains;
+}
+
+int MolecularStore::addPrimitives( CudaKernel& cudaKernel ) const
+{
+   int first(-1);
+   size_t nbPrimitives = getNbSpheres(finestDetail_);
+   for( size_t i(0); i<nbPrimitives; ++i )
+   {
+      int index = cudaKernel.addPrimitive( ptSphere );
+      if( first < 0 ) first = index;
+   }
+   uploadDetail( cudaKernel, first, finestDetail_ );
+   return first;
+}
+
+void MolecularStore::uploadDetail( CudaKernel& cudaKernel, int firstPrimitive, MolecularDetail detail ) const
+{
+   if( detail < finestDetail_ ) detail = finestDetail_;
+   size_t nbSpheres(0);
+   if( detail == mdAtoms )
+   {
+      nbSpheres = x_.size();
+      for( size_t i(0); i<nbSpheres; ++i )
+         cudaKernel.setPrimitive( firstPrimitive+static_cast<int>(i),
+            x_[i], y_[i], z_[i], getRadius(i), 0.f, 0.f, materials_[i], 1, 1 );
+   }
+   else
+   {
+      const Impostors& impostors = impostors_[detail];
+      nbSpheres = impostors.x.size();
+      for( size_t i(0); i<nbSpheres; ++i )
+         cudaKernel.setPrimitive( firstPrimitive+static_cast<int>(i),
+            impostors.x[i], impostors.y[i], impostors.z[i], impostors.radii[i], 0.f, 0.f,
+            impostors.materials[i], 1, 1 );
+   }
+
+   // Primitives that the level does not use are parked with no radius
+   // outside the bounds, in the corner opposite to the lamp, so that the box
+   // gathering them is away from the rays going through the molecule
+   float parkX = bounds_.minimum.x-boundingRadius_;
+   float parkY = bounds_.minimum.y-boundingRadius_;
+   float parkZ = bounds_.maximum.z+boundingRadius_;
+   size_t nbPrimitives = getNbSpheres(finestDetail_);
+   for( size_t i(nbSpheres); i<nbPrimitives; ++i )
+      cudaKernel.setPrimitive( firstPrimitive+static_cast<int>(i), parkX, parkY, parkZ, 0.f, 0.f, 0.f, 0, 1, 1 );
+}
+
+const char* MolecularStore::getDetailName( MolecularDetail detail )
+{
+   switch( detail )
+   {
+   case mdAtoms:    return "atoms";
+   case mdResidues: return "residues";
+   case mdChains:   return "chains";
+   default:         return "";
+   }
+}
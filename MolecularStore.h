@@ -0,0 +1,137 @@
+#pragma once
+
+// System
+#include <string>
+#include <vector>
+
+// Ice
+#include <IceUtil/Shared.h>
+#include <IceUtil/Handle.h>
+
+// Project
+#include <Cuda/CudaKernel.h>
+#include "CameraModel.h"
+#include "DepthEstimator.h"
+#include "SceneImage.h"
+
+enum MolecularDetail
+{
+   mdAtoms,
+   mdResidues,
+   mdChains,
+   mdCount
+};
+
+/*
+* @brief Compact host copy of the atoms of a molecule, loaded from a PDB file.
+* Coordinates are stored as separate arrays, radii are quantized on 8 bits
+* relative to the largest one, and elements and materials are 8 bit indices:
+* an atom takes 15 bytes on the host.
+* Atoms are also grouped by residue and by chain, each group being replaced
+* by one impostor sphere enclosing its atoms. The level of detail sent to a
+* kernel is the finest one whose spheres still cover a pixel on screen, but
+* never finer than the finest level the server is configured for.
+* The kernel cannot remove primitives, so a kernel reserves one primitive
+* per sphere of the finest level: device memory is only saved when that
+* level is coarser than the atoms. Coarser levels park the primitives they
+* do not use away from the molecule.
+* Stores are saved in warm start images as they are in memory, so that a
+* restarted server does not parse the file nor build the impostors again.
+*/
+class MolecularStore : public IceUtil::Shared
+{
+
+public:
+
+   /**
+   * @brief threshold is the size in pixels below which spheres are replaced
+   * by the next level of detail, finestDetail the finest level ever rendered
+   */
+   MolecularStore( float threshold, MolecularDetail finestDetail );
+
+public:
+
+   /**
+   * @brief Loads the ATOM and HETATM records of the first model of a PDB
+   * file. Coordinates are scaled and centered on the origin, and radii are
+   * the Van der Waals radii of the elements, scaled so that a carbon atom
+   * is close to atomSize. Returns false when no atom could be read.
+   */
+   bool loadFromFile( const std::string& fileName, float atomSize, float scale );
+
+   /**
+   * @brief Stores the atoms and the impostors in a warm start image, and
+   * restores them without going through the PDB file. load returns false
+   * when the image has no molecule.
+   */
+   void save( SceneImageWriter& writer ) const;
+   bool load( const SceneImage& image );
+
+   size_t getNbAtoms() const { return x_.size(); }
+   size_t getMemorySize() const;
+   const BoundingBox& getBounds() const { return bounds_; }
+
+   MolecularDetail getFinestDetail() const { return finestDetail_; }
+   size_t getNbSpheres( MolecularDetail detail ) const;
+
+   /**
+   * @brief Level of detail to render for a camera. A level finer than the
+   * current one is only selected once its spheres are clearly larger than
+   * the threshold, and the current one is kept until its spheres are
+   * clearly smaller, so that a camera moving around a threshold does not
+   * switch levels back and forth.
+   */
+   MolecularDetail selectDetail( const CameraModel& camera, MolecularDetail current ) const;
+
+   /**
+   * @brief Adds one primitive per sphere of the finest level to a kernel,
+   * with that level of detail, and returns the index of the first one
+   */
+   int addPrimitives( CudaKernel& cudaKernel ) const;
+
+   /**
+   * @brief Replaces the primitives added by addPrimitives with the given
+   * level of detail
+   */
+   void uploadDetail( CudaKernel& cudaKernel, int firstPrimitive, MolecularDetail detail ) const;
+
+   static const char* getDetailName( MolecularDetail detail );
+
+private:
+
+   float getRadius( size_t atom ) const { return radii_[atom]*radiusStep_; }
+   void buildImpostors( MolecularDetail detail, const std::vector<unsigned int>& groups );
+
+private:
+
+   // Atoms
+   std::vector<float> x_;
+   std::vector<float> y_;
+   std::vector<float> z_;
+   std::vector<unsigned char> radii_;
+   std::vector<unsigned char> elements_;
+   std::vector<unsigned char> materials_;
+   float radiusStep_;
+
+   // Impostors of the residues and chains
+   struct Impostors
+   {
+      std::vector<float> x;
+      std::vector<float> y;
+      std::vector<float> z;
+      std::vector<float> radii;
+      std::vector<unsigned char> materials;
+   };
+   Impostors impostors_[mdCount];
+
+   // Typical sphere radius of each level
+   float typicalRadius_[mdCount];
+
+   BoundingBox bounds_;
+   float boundingRadius_;
+   float threshold_;
+   MolecularDetail finestDetail_;
+
+};
+
+typedef IceUtil::Handle<MolecularStore> MolecularStorePtr;
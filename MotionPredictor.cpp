@@ -0,0 +1,65 @@
+// System
+#include <math.h>
+
+// Project
+#include "MotionPredictor.h"
+
+namespace
+{
+   // Relative difference tolerated between two consecutive steps
+   const float STEADY_TOLERANCE = 0.25f;
+   const float MOTION_EPSILON   = 1e-4f;
+   const int   MAX_INTERVAL     = 1000; // ms
+
+   bool extrapolate( const float4& a, const float4& b, const float4& c, float4& result, bool& moving )
+   {
+      // a, b and c are consecutive samples, c being the most recent one
+      const float* pa = &a.x;
+      const float* pb = &b.x;
+      const float* pc = &c.x;
+      float* pr = &result.x;
+      for( int i(0); i<3; ++i )
+      {
+         float previousStep = pb[i]-pa[i];
+         float step         = pc[i]-pb[i];
+         float scale = fabs(step) > fabs(previousStep) ? fabs(step) : fabs(previousStep);
+         if( fabs(step-previousStep) > STEADY_TOLERANCE*scale+MOTION_EPSILON ) return false;
+         if( fabs(step) > MOTION_EPSILON ) moving = true;
+         pr[i] = pc[i]+step;
+      }
+      return true;
+   }
+}
+
+MotionPredictor::MotionPredictor() :
+   nbRecorded_(0),
+   last_(nbSamples_-1)
+{
+}
+
+void MotionPredictor::record( const FrameRequest& request )
+{
+   last_ = (last_+1)%nbSamples_;
+   samples_[last_] = request;
+   times_[last_] = IceUtil::Time::now(IceUtil::Time::Monotonic);
+   if( nbRecorded_ < nbSamples_ ) ++nbRecorded_;
+}
+
+bool MotionPredictor::predict( FrameRequest& request ) const
+{
+   if( nbRecorded_ < nbSamples_ ) return false;
+
+   const int c = last_;
+   const int b = (last_+nbSamples_-1)%nbSamples_;
+   const int a = (last_+nbSamples_-2)%nbSamples_;
+
+   // Interactions stopped for a while, the trajectory is not relevant anymore
+   if( (times_[c]-times_[a]).toMilliSeconds() > 2*MAX_INTERVAL ) return false;
+
+   request = samples_[c];
+   bool moving(false);
+   if( !extrapolate( samples_[a].eye, samples_[b].eye, samples_[c].eye, request.eye, moving ) ) return false;
+   if( !extrapolate( samples_[a].direction, samples_[b].direction, samples_[c].direction, request.direction, moving ) ) return false;
+   if( !extrapolate( samples_[a].angles, samples_[b].angles, samples_[c].angles, request.angles, moving ) ) return false;
+   return moving;
+}
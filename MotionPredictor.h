@@ -0,0 +1,43 @@
+#pragma once
+
+// Ice
+#include <IceUtil/Time.h>
+
+// Project
+#include "RenderBackend.h"
+
+/*
+* @brief Extrapolates the camera trajectory of a session from its most recent
+* requests. Client interactions move the camera by small and regular steps
+* (translations proportional to the mouse motion, rotations by constant
+* angles), so a linear extrapolation of the last steps is a good guess for
+* the next request, as long as the motion is steady.
+*/
+class MotionPredictor
+{
+
+public:
+
+   MotionPredictor();
+
+public:
+
+   void record( const FrameRequest& request );
+
+   /**
+   * @brief Returns the request expected to come next. The scene settings are
+   * the ones of the last request, only the camera is extrapolated. Returns
+   * false when the camera does not move, or does not move steadily.
+   */
+   bool predict( FrameRequest& request ) const;
+
+private:
+
+   static const int nbSamples_ = 3;
+
+   FrameRequest samples_[nbSamples_];
+   IceUtil::Time times_[nbSamples_];
+   int nbRecorded_;
+   int last_;
+
+};
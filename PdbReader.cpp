@@ -0,0 +1,164 @@
+// System
+#include <stdio.h>
+#include <stdlib.h>
+#include <ctype.h>
+#include <map>
+
+// Project
+#include "Trace.h"
+#include "PdbReader.h"
+
+namespace
+{
+   /*
+   * @brief Van der Waals radius, in Angstroms, and material of the elements.
+   * Materials follow the table built by the server.
+   */
+   struct Element
+   {
+      const char* symbol;
+      float radius;
+      unsigned char material;
+   };
+
+   const Element ELEMENTS[] =
+   {
+      { "",   1.80f, 0 }, // Unknown
+      { "C",  1.70f, 1 },
+      { "N",  1.55f, 2 },
+      { "O",  1.52f, 3 },
+      { "H",  1.20f, 4 },
+      { "B",  1.92f, 5 },
+      { "F",  1.47f, 6 },
+      { "P",  1.80f, 7 },
+      { "S",  1.80f, 8 },
+      { "V",  2.07f, 9 },
+      { "Cl", 1.75f, 10 },
+      { "Br", 1.85f, 11 },
+      { "I",  1.98f, 12 },
+      { "Se", 1.90f, 13 },
+      { "Na", 2.27f, 14 },
+      { "K",  2.75f, 15 },
+      { "Mg", 1.73f, 16 },
+      { "Ca", 2.31f, 17 },
+      { "Mn", 2.05f, 18 },
+      { "Fe", 2.04f, 19 },
+      { "Co", 2.00f, 20 },
+      { "Ni", 1.63f, 21 },
+      { "Cu", 1.40f, 22 },
+      { "Zn", 1.39f, 23 }
+   };
+   const int NB_ELEMENTS = sizeof(ELEMENTS)/sizeof(ELEMENTS[0]);
+
+   unsigned char findElement( const std::string& symbol )
+   {
+      for( int i(1); i<NB_ELEMENTS; ++i )
+         if( symbol == ELEMENTS[i].symbol ) return static_cast<unsigned char>(i);
+      return 0;
+   }
+
+   std::string trim( const std::string& text )
+   {
+      size_t start = text.find_first_not_of(' ');
+      if( start == std::string::npos ) return "";
+      size_t end = text.find_last_not_of(' ');
+      return text.substr(start, end-start+1);
+   }
+
+   std::string column( const std::string& line, size_t start, size_t length )
+   {
+      return (line.size() > start) ? line.substr(start, length) : "";
+   }
+
+   // Element symbols are written in upper case in PDB files
+   std::string normalize( const std::string& symbol )
+   {
+      std::string result(symbol);
+      for( size_t i(0); i<result.size(); ++i ) result[i] = static_cast<char>(i ? tolower(result[i]) : toupper(result[i]));
+      return result;
+   }
+}
+
+bool PdbReader::read( const std::string& fileName, std::vector<PdbAtom>& atoms )
+{
+   atoms.clear();
+   FILE* file = fopen( fileName.c_str(), "r" );
+   if( !file )
+   {
+      APPL_LOG_ERROR("Cannot open " << fileName);
+      return false;
+   }
+
+   // Residues and chains are numbered in the order they appear
+   std::map<std::string, unsigned int> residueIds;
+   std::map<std::string, unsigned int> chainIds;
+
+   char buffer[256];
+   while( fgets( buffer, sizeof(buffer), file ) )
+   {
+      std::string line(buffer);
+      std::string record = column(line, 0, 6);
+      if( record == "ENDMDL" ) break;
+      if( record != "ATOM  " && record != "HETATM" ) continue;
+
+      // Element, or atom name for older files. The element is right
+      // justified in the first two columns of the name: only hetero atoms
+      // have two letter elements, such as the metal ions, the other names
+      // start with the letter of their element.
+      std::string symbol = normalize(trim(column(line, 76, 2)));
+      if( symbol.empty() || !isalpha(symbol[0]) )
+      {
+         std::string prefix = normalize(column(line, 12, 2));
+         if( record == "HETATM" && prefix.size() == 2 && isalpha(prefix[0]) && isalpha(prefix[1]) && findElement(prefix) != 0 )
+         {
+            symbol = prefix;
+         }
+         else
+         {
+            std::string name = trim(column(line, 12, 4));
+            size_t letter(0);
+            while( letter < name.size() && !isalpha(name[letter]) ) ++letter;
+            symbol = normalize((letter < name.size()) ? name.substr(letter, 1) : "");
+         }
+      }
+
+      std::string chain   = column(line, 21, 1);
+      std::string residue = chain+column(line, 22, 5);
+      if( chainIds.find(chain) == chainIds.end() )
+      {
+         unsigned int id = static_cast<unsigned int>(chainIds.size());
+         chainIds[chain] = id;
+      }
+      if( residueIds.find(residue) == residueIds.end() )
+      {
+         unsigned int id = static_cast<unsigned int>(residueIds.size());
+         residueIds[residue] = id;
+      }
+
+      PdbAtom atom;
+      atom.x       = static_cast<float>(atof(column(line, 30, 8).c_str()));
+      atom.y       = static_cast<float>(atof(column(line, 38, 8).c_str()));
+      atom.z       = static_cast<float>(atof(column(line, 46, 8).c_str()));
+      atom.element = findElement(symbol);
+      atom.residue = residueIds[residue];
+      atom.chain   = chainIds[chain];
+      atoms.push_back( atom );
+   }
+   fclose( file );
+   return !atoms.empty();
+}
+
+float PdbReader::getRadius( unsigned char element )
+{
+   return ELEMENTS[element < NB_ELEMENTS ? element : 0].radius;
+}
+
+unsigned char PdbReader::getMaterial( unsigned char element )
+{
+   return ELEMENTS[element < NB_ELEMENTS ? element : 0].material;
+}
+
+const char* PdbReader::getSymbol( unsigned char element )
+{
+   return ELEMENTS[element < NB_ELEMENTS ? element : 0].symbol;
+}
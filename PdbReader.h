@@ -0,0 +1,47 @@
+#pragma once
+
+// System
+#include <string>
+#include <vector>
+
+/*
+* @brief Atom of a PDB file. Coordinates are in Angstroms, residues and chains
+* are numbered from 0 in the order they appear in the file.
+*/
+struct PdbAtom
+{
+   float x, y, z;
+   unsigned char element;
+   unsigned int residue;
+   unsigned int chain;
+};
+
+/*
+* @brief Reader of the ATOM and HETATM records of PDB files. It only depends
+* on the standard library, so that the server and the benchmarks read
+* molecules the same way.
+*/
+class PdbReader
+{
+
+public:
+
+   /**
+   * @brief Reads the atoms of the first model of a file. Returns false when
+   * the file cannot be opened or has no atom.
+   */
+   static bool read( const std::string& fileName, std::vector<PdbAtom>& atoms );
+
+   /**
+   * @brief Van der Waals radius of an element, in Angstroms
+   */
+   static float getRadius( unsigned char element );
+
+   /**
+   * @brief Material of an element, in the table built by the server
+   */
+   static unsigned char getMaterial( unsigned char element );
+
+   static const char* getSymbol( unsigned char element );
+
+};
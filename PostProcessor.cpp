@@ -0,0 +1,471 @@
+// System
+#include <math.h>
+#include <float.h>
+#include <time.h>
+#include <algorithm>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+// Project
+#include "PostProcessor.h"
+
+// POSTPROCESSOR_SCALAR forces the plain loops, e.g. to compare results
+#if !defined(POSTPROCESSOR_SCALAR) && \
+   (defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2))
+#include <emmintrin.h>
+#define POSTPROCESSOR_SSE2
+#endif
+
+namespace
+{
+   // Luminance weights
+   const float LUMA_R = 0.299f;
+   const float LUMA_G = 0.587f;
+   const float LUMA_B = 0.114f;
+
+   // Denoiser
+   const int   DENOISE_RADIUS     = 2;
+   const float DENOISE_SIGMA      = 0.2f;
+   const int   DENOISE_ITERATIONS = 64; // Converged frames are left untouched
+
+   // Anti-aliasing
+   const float EDGE_THRESHOLD          = 0.125f;
+   const float EDGE_THRESHOLD_MINIMUM  = 0.0312f;
+   const float SUBPIXEL_BLEND          = 0.75f;
+
+   double now()
+   {
+#ifdef _OPENMP
+      return omp_get_wtime();
+#else
+      return static_cast<double>(clock())/CLOCKS_PER_SEC;
+#endif
+   }
+
+   // ------------------------------------------------------------------------
+   // 4-wide vectors. Every row kernel is written with these, so that the same
+   // code runs with SSE2 or, elsewhere, with plain loops.
+   // ------------------------------------------------------------------------
+#ifdef POSTPROCESSOR_SSE2
+   typedef __m128 vfloat;
+   inline vfloat vload( const float* p ) { return _mm_loadu_ps(p); }
+   inline void   vstore( float* p, vfloat v ) { _mm_storeu_ps(p, v); }
+   inline vfloat vset( float f ) { return _mm_set1_ps(f); }
+   inline vfloat vadd( vfloat a, vfloat b ) { return _mm_add_ps(a, b); }
+   inline vfloat vsub( vfloat a, vfloat b ) { return _mm_sub_ps(a, b); }
+   inline vfloat vmul( vfloat a, vfloat b ) { return _mm_mul_ps(a, b); }
+   inline vfloat vdiv( vfloat a, vfloat b ) { return _mm_div_ps(a, b); }
+   inline vfloat vmin( vfloat a, vfloat b ) { return _mm_min_ps(a, b); }
+   inline vfloat vmax( vfloat a, vfloat b ) { return _mm_max_ps(a, b); }
+   inline vfloat vabs( vfloat a ) { return _mm_andnot_ps(_mm_set1_ps(-0.f), a); }
+   // a >= b ? x : y
+   inline vfloat vselect( vfloat a, vfloat b, vfloat x, vfloat y )
+   {
+      vfloat mask = _mm_cmpge_ps(a, b);
+      return _mm_or_ps(_mm_and_ps(mask, x), _mm_andnot_ps(mask, y));
+   }
+#else
+   struct vfloat { float v[4]; };
+   inline vfloat vload( const float* p ) { vfloat r; for( int i(0); i<4; ++i ) r.v[i] = p[i]; return r; }
+   inline void   vstore( float* p, vfloat a ) { for( int i(0); i<4; ++i ) p[i] = a.v[i]; }
+   inline vfloat vset( float f ) { vfloat r; for( int i(0); i<4; ++i ) r.v[i] = f; return r; }
+   inline vfloat vadd( vfloat a, vfloat b ) { for( int i(0); i<4; ++i ) a.v[i] += b.v[i]; return a; }
+   inline vfloat vsub( vfloat a, vfloat b ) { for( int i(0); i<4; ++i ) a.v[i] -= b.v[i]; return a; }
+   inline vfloat vmul( vfloat a, vfloat b ) { for( int i(0); i<4; ++i ) a.v[i] *= b.v[i]; return a; }
+   inline vfloat vdiv( vfloat a, vfloat b ) { for( int i(0); i<4; ++i ) a.v[i] /= b.v[i]; return a; }
+   inline vfloat vmin( vfloat a, vfloat b ) { for( int i(0); i<4; ++i ) a.v[i] = a.v[i]<b.v[i] ? a.v[i] : b.v[i]; return a; }
+   inline vfloat vmax( vfloat a, vfloat b ) { for( int i(0); i<4; ++i ) a.v[i] = a.v[i]>b.v[i] ? a.v[i] : b.v[i]; return a; }
+   inline vfloat vabs( vfloat a ) { for( int i(0); i<4; ++i ) a.v[i] = fabsf(a.v[i]); return a; }
+   inline vfloat vselect( vfloat a, vfloat b, vfloat x, vfloat y ) { for( int i(0); i<4; ++i ) x.v[i] = a.v[i]>=b.v[i] ? x.v[i] : y.v[i]; return x; }
+#endif
+
+   inline vfloat vlerp( vfloat a, vfloat b, vfloat t ) { return vadd(a, vmul(t, vsub(b, a))); }
+
+   inline int clampRow( int y, int height ) { return y<0 ? 0 : (y>=height ? height-1 : y); }
+}
+
+PostProcessor::PostProcessor() :
+   width_(0),
+   height_(0),
+   paddedWidth_(0),
+   stride_(0)
+{
+}
+
+bool PostProcessor::isEnabled( const PostProcessorSettings& settings )
+{
+   return settings.denoise || settings.depthOfField || settings.toneMapping || settings.antiAliasing;
+}
+
+const char* PostProcessor::getStageName( int stage )
+{
+   switch( stage )
+   {
+   case psDenoise:      return "denoise";
+   case psDepthOfField: return "depthOfField";
+   case psToneMapping:  return "toneMapping";
+   case psAntiAliasing: return "antiAliasing";
+   }
+   return "";
+}
+
+void PostProcessor::process(
+   const PostProcessorSettings& settings,
+   unsigned char* image, int width, int height,
+   const float* depth,
+   PostProcessorTimings& timings )
+{
+   if( !isEnabled(settings) || width <= 0 || height <= 0 ) return;
+
+   resize( width, height );
+   load( image );
+
+   double start = now();
+   if( settings.denoise && settings.iterations < DENOISE_ITERATIONS )
+   {
+      denoise( settings.iterations );
+      double end = now();
+      timings.milliseconds[psDenoise] += 1000.0*(end-start);
+      ++timings.frames[psDenoise];
+      start = end;
+   }
+   if( settings.depthOfField && depth )
+   {
+      depthOfField( settings, depth );
+      double end = now();
+      timings.milliseconds[psDepthOfField] += 1000.0*(end-start);
+      ++timings.frames[psDepthOfField];
+      start = end;
+   }
+   if( settings.toneMapping )
+   {
+      toneMapping( settings.exposure, settings.whitePoint );
+      double end = now();
+      timings.milliseconds[psToneMapping] += 1000.0*(end-start);
+      ++timings.frames[psToneMapping];
+      start = end;
+   }
+   if( settings.antiAliasing )
+   {
+      antiAliasing();
+      double end = now();
+      timings.milliseconds[psAntiAliasing] += 1000.0*(end-start);
+      ++timings.frames[psAntiAliasing];
+   }
+
+   store( image );
+}
+
+void PostProcessor::resize( int width, int height )
+{
+   if( width == width_ && height == height_ ) return;
+
+   width_       = width;
+   height_      = height;
+   paddedWidth_ = (width+3)&~3;
+   stride_      = MARGIN+paddedWidth_+MARGIN;
+
+   size_t size = static_cast<size_t>(stride_)*height_;
+   for( int c(0); c<3; ++c )
+   {
+      color_[c].assign( size, 0.f );
+      work_[c].assign( size, 0.f );
+   }
+   luma_.assign( size, 0.f );
+   coc_.assign( static_cast<size_t>(paddedWidth_)*height_, 0.f );
+}
+
+void PostProcessor::load( const unsigned char* image )
+{
+   const float scale = 1.f/255.f;
+#pragma omp parallel for schedule(static)
+   for( int y=0; y<height_; ++y )
+   {
+      const unsigned char* src = image+y*width_*3;
+      float* r = getRow(color_[0], y);
+      float* g = getRow(color_[1], y);
+      float* b = getRow(color_[2], y);
+      for( int x(0); x<width_; ++x )
+      {
+         r[x] = src[x*3  ]*scale;
+         g[x] = src[x*3+1]*scale;
+         b[x] = src[x*3+2]*scale;
+      }
+   }
+}
+
+void PostProcessor::store( unsigned char* image )
+{
+#pragma omp parallel for schedule(static)
+   for( int y=0; y<height_; ++y )
+   {
+      unsigned char* dst = image+y*width_*3;
+      for( int c(0); c<3; ++c )
+      {
+         const float* src = getRow(color_[c], y);
+         for( int x(0); x<width_; ++x )
+         {
+            float v = src[x];
+            v = v<0.f ? 0.f : (v>1.f ? 1.f : v);
+            dst[x*3+c] = static_cast<unsigned char>(v*255.f+0.5f);
+         }
+      }
+   }
+}
+
+void PostProcessor::replicateBorders( std::vector<float>* planes, int nbPlanes )
+{
+#pragma omp parallel for schedule(static)
+   for( int y=0; y<height_; ++y )
+   {
+      for( int c(0); c<nbPlanes; ++c )
+      {
+         float* row = getRow(planes[c], y);
+         std::fill( row-MARGIN, row, row[0] );
+         std::fill( row+width_, row+paddedWidth_+MARGIN, row[width_-1] );
+      }
+   }
+}
+
+void PostProcessor::computeLuma()
+{
+   // Margins included, colors must have their borders replicated
+   const vfloat wr = vset(LUMA_R);
+   const vfloat wg = vset(LUMA_G);
+   const vfloat wb = vset(LUMA_B);
+#pragma omp parallel for schedule(static)
+   for( int y=0; y<height_; ++y )
+   {
+      const float* r = &color_[0][y*stride_];
+      const float* g = &color_[1][y*stride_];
+      const float* b = &color_[2][y*stride_];
+      float* l = &luma_[y*stride_];
+      for( int x(0); x<stride_; x+=4 )
+         vstore( l+x, vadd(vmul(wr, vload(r+x)), vadd(vmul(wg, vload(g+x)), vmul(wb, vload(b+x)))) );
+   }
+}
+
+void PostProcessor::denoise( int iterations )
+{
+   // Separable cross bilateral filter: neighbors are weighted by how close
+   // their luminance is to the one of the center pixel, so that edges are
+   // preserved while the path tracing noise is smoothed out. The luminance
+   // of the noisy frame guides both passes.
+   const float sigma = DENOISE_SIGMA/sqrtf(static_cast<float>(iterations<1 ? 1 : iterations));
+   const vfloat invSigma2 = vset(1.f/(sigma*sigma));
+   const vfloat one  = vset(1.f);
+   const vfloat zero = vset(0.f);
+
+   replicateBorders( color_, 3 );
+   computeLuma();
+
+   // Horizontal pass, color to work
+#pragma omp parallel for schedule(static)
+   for( int y=0; y<height_; ++y )
+   {
+      const float* l = getRow(luma_, y);
+      const float* r = getRow(color_[0], y);
+      const float* g = getRow(color_[1], y);
+      const float* b = getRow(color_[2], y);
+      float* dr = getRow(work_[0], y);
+      float* dg = getRow(work_[1], y);
+      float* db = getRow(work_[2], y);
+      for( int x(0); x<paddedWidth_; x+=4 )
+      {
+         vfloat center = vload(l+x);
+         vfloat sr = zero, sg = zero, sb = zero, sw = zero;
+         for( int k(-DENOISE_RADIUS); k<=DENOISE_RADIUS; ++k )
+         {
+            vfloat d = vsub(vload(l+x+k), center);
+            vfloat w = vmax(zero, vsub(one, vmul(vmul(d, d), invSigma2)));
+            sr = vadd(sr, vmul(w, vload(r+x+k)));
+            sg = vadd(sg, vmul(w, vload(g+x+k)));
+            sb = vadd(sb, vmul(w, vload(b+x+k)));
+            sw = vadd(sw, w);
+         }
+         vstore( dr+x, vdiv(sr, sw) );
+         vstore( dg+x, vdiv(sg, sw) );
+         vstore( db+x, vdiv(sb, sw) );
+      }
+   }
+
+   // Vertical pass, work to color
+#pragma omp parallel for schedule(static)
+   for( int y=0; y<height_; ++y )
+   {
+      const float* l = getRow(luma_, y);
+      float* dr = getRow(color_[0], y);
+      float* dg = getRow(color_[1], y);
+      float* db = getRow(color_[2], y);
+      for( int x(0); x<paddedWidth_; x+=4 )
+      {
+         vfloat center = vload(l+x);
+         vfloat sr = zero, sg = zero, sb = zero, sw = zero;
+         for( int k(-DENOISE_RADIUS); k<=DENOISE_RADIUS; ++k )
+         {
+            int row = clampRow(y+k, height_);
+            vfloat d = vsub(vload(getRow(luma_, row)+x), center);
+            vfloat w = vmax(zero, vsub(one, vmul(vmul(d, d), invSigma2)));
+            sr = vadd(sr, vmul(w, vload(getRow(work_[0], row)+x)));
+            sg = vadd(sg, vmul(w, vload(getRow(work_[1], row)+x)));
+            sb = vadd(sb, vmul(w, vload(getRow(work_[2], row)+x)));
+            sw = vadd(sw, w);
+         }
+         vstore( dr+x, vdiv(sr, sw) );
+         vstore( dg+x, vdiv(sg, sw) );
+         vstore( db+x, vdiv(sb, sw) );
+      }
+   }
+}
+
+void PostProcessor::depthOfField( const PostProcessorSettings& settings, const float* depth )
+{
+   // The frame is blurred once with the maximum radius, using separable box
+   // filters, and every pixel is blended between the sharp and the blurred
+   // frames according to its circle of confusion
+   int radius = settings.radius;
+   radius = radius<1 ? 1 : (radius>MAX_RADIUS ? MAX_RADIUS : radius);
+   const vfloat norm = vset(1.f/(2*radius+1));
+   const vfloat zero = vset(0.f);
+   const float cocScale = settings.focus>0.f ? settings.strength/(settings.focus*radius) : 0.f;
+
+   // Circles of confusion, as a fraction of the maximum radius
+#pragma omp parallel for schedule(static)
+   for( int y=0; y<height_; ++y )
+   {
+      const float* d = depth+y*width_;
+      float* coc = &coc_[y*paddedWidth_];
+      for( int x(0); x<width_; ++x )
+      {
+         float c = (d[x]==FLT_MAX) ? 1.f : fabsf(d[x]-settings.focus)*cocScale;
+         coc[x] = c>1.f ? 1.f : c;
+      }
+      for( int x(width_); x<paddedWidth_; ++x ) coc[x] = 0.f;
+   }
+
+   replicateBorders( color_, 3 );
+
+   // Horizontal pass, color to work
+#pragma omp parallel for schedule(static)
+   for( int y=0; y<height_; ++y )
+   {
+      for( int c(0); c<3; ++c )
+      {
+         const float* src = getRow(color_[c], y);
+         float* dst = getRow(work_[c], y);
+         for( int x(0); x<paddedWidth_; x+=4 )
+         {
+            vfloat sum = zero;
+            for( int k(-radius); k<=radius; ++k ) sum = vadd(sum, vload(src+x+k));
+            vstore( dst+x, vmul(sum, norm) );
+         }
+      }
+   }
+
+   // Vertical pass on work, blended into color
+#pragma omp parallel for schedule(static)
+   for( int y=0; y<height_; ++y )
+   {
+      const float* coc = &coc_[y*paddedWidth_];
+      for( int c(0); c<3; ++c )
+      {
+         float* dst = getRow(color_[c], y);
+         for( int x(0); x<paddedWidth_; x+=4 )
+         {
+            vfloat sum = zero;
+            for( int k(-radius); k<=radius; ++k )
+               sum = vadd(sum, vload(getRow(work_[c], clampRow(y+k, height_))+x));
+            vstore( dst+x, vlerp(vload(dst+x), vmul(sum, norm), vload(coc+x)) );
+         }
+      }
+   }
+}
+
+void PostProcessor::toneMapping( float exposure, float whitePoint )
+{
+   // Extended Reinhard operator, whitePoint is mapped to 1
+   const vfloat e = vset(exposure);
+   const vfloat invWhite2 = vset(whitePoint>0.f ? 1.f/(whitePoint*whitePoint) : 0.f);
+   const vfloat one = vset(1.f);
+#pragma omp parallel for schedule(static)
+   for( int y=0; y<height_; ++y )
+   {
+      for( int c(0); c<3; ++c )
+      {
+         float* row = getRow(color_[c], y);
+         for( int x(0); x<paddedWidth_; x+=4 )
+         {
+            vfloat v = vmul(vload(row+x), e);
+            vstore( row+x, vdiv(vmul(v, vadd(one, vmul(v, invWhite2))), vadd(one, v)) );
+         }
+      }
+   }
+}
+
+void PostProcessor::antiAliasing()
+{
+   // FXAA-like: pixels on a luminance edge are blended with the neighbor
+   // across the edge, proportionally to how much they differ from the
+   // average of their neighborhood
+   const vfloat zero = vset(0.f);
+   const vfloat one  = vset(1.f);
+   const vfloat two  = vset(2.f);
+   const vfloat quarter   = vset(0.25f);
+   const vfloat epsilon   = vset(1e-6f);
+   const vfloat threshold = vset(EDGE_THRESHOLD);
+   const vfloat minimum   = vset(EDGE_THRESHOLD_MINIMUM);
+   const vfloat subpixel  = vset(SUBPIXEL_BLEND*0.5f);
+
+   replicateBorders( color_, 3 );
+   computeLuma();
+
+#pragma omp parallel for schedule(static)
+   for( int y=0; y<height_; ++y )
+   {
+      int north = clampRow(y-1, height_);
+      int south = clampRow(y+1, height_);
+      const float* lm = getRow(luma_, y);
+      const float* ln = getRow(luma_, north);
+      const float* ls = getRow(luma_, south);
+      for( int x(0); x<paddedWidth_; x+=4 )
+      {
+         vfloat m = vload(lm+x);
+         vfloat n = vload(ln+x);
+         vfloat s = vload(ls+x);
+         vfloat w = vload(lm+x-1);
+         vfloat e = vload(lm+x+1);
+
+         vfloat highest = vmax(m, vmax(vmax(n, s), vmax(w, e)));
+         vfloat lowest  = vmin(m, vmin(vmin(n, s), vmin(w, e)));
+         vfloat range   = vsub(highest, lowest);
+
+         // No blending below the contrast threshold
+         vfloat average = vmul(vadd(vadd(n, s), vadd(w, e)), quarter);
+         vfloat blend = vmin(one, vdiv(vabs(vsub(average, m)), vadd(range, epsilon)));
+         blend = vmul(blend, subpixel);
+         blend = vselect(range, vmax(minimum, vmul(highest, threshold)), blend, zero);
+
+         // Horizontal edges are blended vertically, and the other way round
+         vfloat horizontal = vabs(vsub(vadd(n, s), vmul(two, m)));
+         vfloat vertical   = vabs(vsub(vadd(w, e), vmul(two, m)));
+         vfloat towardsNorth = vabs(vsub(n, m));
+         vfloat towardsSouth = vabs(vsub(s, m));
+         vfloat towardsWest  = vabs(vsub(w, m));
+         vfloat towardsEast  = vabs(vsub(e, m));
+
+         for( int c(0); c<3; ++c )
+         {
+            const float* row = getRow(color_[c], y);
+            vfloat center = vload(row+x);
+            vfloat across = vselect(towardsNorth, towardsSouth,
+               vload(getRow(color_[c], north)+x), vload(getRow(color_[c], south)+x));
+            vfloat along = vselect(towardsWest, towardsEast, vload(row+x-1), vload(row+x+1));
+            vfloat neighbor = vselect(horizontal, vertical, across, along);
+            vstore( getRow(work_[c], y)+x, vlerp(center, neighbor, blend) );
+         }
+      }
+   }
+
+   for( int c(0); c<3; ++c ) color_[c].swap( work_[c] );
+}
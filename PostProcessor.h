@@ -0,0 +1,117 @@
+#pragma once
+
+// System
+#include <vector>
+
+/*
+* @brief Server side post processing stages applied to a rendered frame
+*/
+struct PostProcessorSettings
+{
+   bool  denoise;
+   bool  depthOfField;
+   bool  toneMapping;
+   bool  antiAliasing;
+
+   // Denoiser: path tracing iterations of the frame. The fewer iterations,
+   // the noisier the frame and the stronger the filter.
+   int   iterations;
+
+   // Depth of field: distance of the focal plane, blur radius in pixels at a
+   // distance of focus from the focal plane, and maximum blur radius
+   float focus;
+   float strength;
+   int   radius;
+
+   // Tone mapping: exposure, and intensity mapped to white
+   float exposure;
+   float whitePoint;
+};
+
+enum PostProcessorStage
+{
+   psDenoise,
+   psDepthOfField,
+   psToneMapping,
+   psAntiAliasing,
+   psCount
+};
+
+/*
+* @brief Number of frames processed and time spent by each stage
+*/
+struct PostProcessorTimings
+{
+   long   frames[psCount];
+   double milliseconds[psCount];
+};
+
+/*
+* @brief CPU post processing of RGB frames. Frames are converted to planar
+* floating point buffers so that every stage is a sequence of row kernels
+* working on 4 pixels at a time (SSE2 when available), and rows are spread
+* over the OpenMP threads. Stages run in the following order: denoiser,
+* depth of field, tone mapping and anti-aliasing.
+* Buffers are kept from a frame to another, so an instance must not be used
+* by several threads at the same time.
+*/
+class PostProcessor
+{
+
+public:
+
+   static const int MAX_RADIUS = 16;
+
+public:
+
+   PostProcessor();
+
+public:
+
+   static bool isEnabled( const PostProcessorSettings& settings );
+   static const char* getStageName( int stage );
+
+   /**
+   * @brief Processes an RGB image in place. depth gives the distance from the
+   * eye for every pixel, FLT_MAX for the background. Depth of field is
+   * skipped when there is no depth. The time spent in each stage is added to
+   * the timings.
+   */
+   void process(
+      const PostProcessorSettings& settings,
+      unsigned char* image, int width, int height,
+      const float* depth,
+      PostProcessorTimings& timings );
+
+private:
+
+   void resize( int width, int height );
+   void load( const unsigned char* image );
+   void store( unsigned char* image );
+   void replicateBorders( std::vector<float>* planes, int nbPlanes );
+   void computeLuma();
+
+   void denoise( int iterations );
+   void depthOfField( const PostProcessorSettings& settings, const float* depth );
+   void toneMapping( float exposure, float whitePoint );
+   void antiAliasing();
+
+   float* getRow( std::vector<float>& plane, int y ) { return &plane[y*stride_+MARGIN]; }
+
+private:
+
+   // Rows have a margin on both sides so that horizontal kernels can read
+   // neighbors without testing the borders
+   static const int MARGIN = MAX_RADIUS;
+
+   int width_;
+   int height_;
+   int paddedWidth_;
+   int stride_;
+
+   std::vector<float> color_[3];
+   std::vector<float> work_[3];
+   std::vector<float> luma_;
+   std::vector<float> coc_;
+
+};
@@ -0,0 +1,152 @@
+// System
+#include <math.h>
+#include <float.h>
+#include <algorithm>
+
+// Project
+#include "ReferenceRenderer.h"
+
+namespace
+{
+   // Colors of the element materials built by the server
+   const float MATERIAL_COLORS[10][3] =
+   {
+      { 0.8f,        0.7f,        0.7f        },
+      { 0.7f,        0.7f,        0.7f        }, // C Gray
+      { 174.f/255.f, 174.f/255.f, 233.f/255.f }, // N Blue
+      { 0.9f,        0.4f,        0.4f        }, // O
+      { 0.9f,        0.9f,        0.9f        }, // H White
+      { 0.0f,        0.5f,        0.6f        }, // B
+      { 0.0f,        0.0f,        0.7f        }, // F
+      { 0.8f,        0.6f,        0.3f        }, // P
+      { 241.f/255.f, 196.f/255.f, 107.f/255.f }, // S Yellow
+      { 0.9f,        0.3f,        0.3f        }  // V
+   };
+
+   // Share of the light that does not depend on the orientation
+   const float AMBIENT = 0.2f;
+
+   inline unsigned char toByte( float value )
+   {
+      if( value <= 0.f ) return 0;
+      if( value >= 1.f ) return 255;
+      return static_cast<unsigned char>(value*255.f+0.5f);
+   }
+}
+
+void ReferenceRenderer::render(
+   const std::vector<ReferenceSphere>& spheres,
+   const CameraModel& camera, int width, int height,
+   const float* background,
+   std::vector<unsigned char>& image )
+{
+   size_t nbPixels = width*height;
+   rays_.resize( nbPixels );
+   for( int y(0); y<height; ++y )
+      for( int x(0); x<width; ++x )
+         rays_[y*width+x] = camera.getRay( static_cast<float>(x), static_cast<float>(y) );
+   depth_.assign( nbPixels, FLT_MAX );
+   hits_.assign( nbPixels, -1 );
+
+   // Closest intersection of every pixel
+   const CameraVector& origin = camera.getOrigin();
+   for( size_t i(0); i<spheres.size(); ++i )
+   {
+      const ReferenceSphere& sphere = spheres[i];
+      int x0, y0, x1, y1;
+      if( !getProjection( sphere, camera, width, height, x0, y0, x1, y1 ) ) continue;
+
+      CameraVector oc = { origin.x-sphere.x, origin.y-sphere.y, origin.z-sphere.z };
+      float c = oc.x*oc.x+oc.y*oc.y+oc.z*oc.z-sphere.radius*sphere.radius;
+      for( int y(y0); y<y1; ++y )
+      {
+         for( int x(x0); x<x1; ++x )
+         {
+            size_t index = y*width+x;
+            const CameraVector& ray = rays_[index];
+            float b = oc.x*ray.x+oc.y*ray.y+oc.z*ray.z;
+            float discriminant = b*b-c;
+            if( discriminant < 0.f ) continue;
+            float root = sqrtf(discriminant);
+            float t = -b-root;
+            if( t <= 0.f ) t = -b+root;
+            if( t <= 0.f || t >= depth_[index] ) continue;
+            depth_[index] = t;
+            hits_[index]  = static_cast<int>(i);
+         }
+      }
+   }
+
+   // Diffuse shading, lit from the eye
+   image.resize( nbPixels*3 );
+   unsigned char backgroundColor[3] = { toByte(background[0]), toByte(background[1]), toByte(background[2]) };
+   for( size_t index(0); index<nbPixels; ++index )
+   {
+      unsigned char* pixel = &image[index*3];
+      if( hits_[index] < 0 )
+      {
+         pixel[0] = backgroundColor[0];
+         pixel[1] = backgroundColor[1];
+         pixel[2] = backgroundColor[2];
+         continue;
+      }
+
+      const ReferenceSphere& sphere = spheres[hits_[index]];
+      const CameraVector& ray = rays_[index];
+      float t = depth_[index];
+      float nx = origin.x+t*ray.x-sphere.x;
+      float ny = origin.y+t*ray.y-sphere.y;
+      float nz = origin.z+t*ray.z-sphere.z;
+      float cosine = -(nx*ray.x+ny*ray.y+nz*ray.z)/sphere.radius;
+      float intensity = AMBIENT+(1.f-AMBIENT)*std::max(cosine, 0.f);
+
+      float color[3];
+      getMaterialColor( sphere.material, color );
+      pixel[0] = toByte(color[0]*intensity);
+      pixel[1] = toByte(color[1]*intensity);
+      pixel[2] = toByte(color[2]*intensity);
+   }
+}
+
+void ReferenceRenderer::getMaterialColor( unsigned char material, float* rgb )
+{
+   const float* color = MATERIAL_COLORS[material%10];
+   rgb[0] = color[0];
+   rgb[1] = color[1];
+   rgb[2] = color[2];
+}
+
+bool ReferenceRenderer::getProjection(
+   const ReferenceSphere& sphere, const CameraModel& camera, int width, int height,
+   int& x0, int& y0, int& x1, int& y1 ) const
+{
+   // The sphere is inside the cube around it, whose projection is the
+   // convex hull of its corners. A cube partly behind the eye may cover the
+   // whole image.
+   float minX(FLT_MAX), minY(FLT_MAX), maxX(-FLT_MAX), maxY(-FLT_MAX);
+   for( int corner(0); corner<8; ++corner )
+   {
+      CameraVector point = {
+         sphere.x+((corner&1) ? sphere.radius : -sphere.radius),
+         sphere.y+((corner&2) ? sphere.radius : -sphere.radius),
+         sphere.z+((corner&4) ? sphere.radius : -sphere.radius) };
+      float px, py, distance;
+      if( !camera.project( point, px, py, distance ) )
+      {
+         x0 = 0; y0 = 0; x1 = width; y1 = height;
+         return true;
+      }
+      minX = std::min(minX, px); maxX = std::max(maxX, px);
+      minY = std::min(minY, py); maxY = std::max(maxY, py);
+   }
+
+   // One pixel of margin for rounding, clamped before the conversion since
+   // points close to the eye plane project far away
+   float w = static_cast<float>(width);
+   float h = static_cast<float>(height);
+   x0 = static_cast<int>(floorf(std::min(std::max(minX-1.f, 0.f), w)));
+   y0 = static_cast<int>(floorf(std::min(std::max(minY-1.f, 0.f), h)));
+   x1 = static_cast<int>(ceilf(std::min(std::max(maxX+2.f, 0.f), w)));
+   y1 = static_cast<int>(ceilf(std::min(std::max(maxY+2.f, 0.f), h)));
+   return x0 < x1 && y0 < y1;
+}
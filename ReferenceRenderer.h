@@ -0,0 +1,68 @@
+#pragma once
+
+// System
+#include <vector>
+
+// Project
+#include "CameraModel.h"
+
+/*
+* @brief Sphere of the reference renderer, in world space
+*/
+struct ReferenceSphere
+{
+   float x, y, z;
+   float radius;
+   unsigned char material;
+};
+
+/*
+* @brief CPU ray caster of spheres, used where no kernel is available, e.g.
+* by the benchmarks. Primary rays follow the camera model of the kernel, so
+* that images have the layout of kernel frames: pixel (x, y) of the camera
+* is at index y*width+x. Spheres are shaded with the color of their material
+* and a light at the eye, without shadows nor secondary rays.
+* Each sphere is only intersected with the rays of the pixels covered by its
+* projection.
+* Buffers are kept from a frame to another, an instance must not be used by
+* several threads at the same time.
+*/
+class ReferenceRenderer
+{
+
+public:
+
+   /**
+   * @brief Renders an RGB image. background is the RGB color of the pixels
+   * that hit no sphere, from 0 to 1.
+   */
+   void render(
+      const std::vector<ReferenceSphere>& spheres,
+      const CameraModel& camera, int width, int height,
+      const float* background,
+      std::vector<unsigned char>& image );
+
+   /**
+   * @brief Distance from the eye of every pixel of the last image, FLT_MAX
+   * for the background
+   */
+   const std::vector<float>& getDepth() const { return depth_; }
+
+   /**
+   * @brief Color of a material of the table built by the server, from 0 to 1
+   */
+   static void getMaterialColor( unsigned char material, float* rgb );
+
+private:
+
+   bool getProjection(
+      const ReferenceSphere& sphere, const CameraModel& camera, int width, int height,
+      int& x0, int& y0, int& x1, int& y1 ) const;
+
+private:
+
+   std::vector<CameraVector> rays_;
+   std::vector<float> depth_;
+   std::vector<int> hits_;
+
+};
@@ -0,0 +1,494 @@
+// System
+#include <float.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sstream>
+#include <algorithm>
+
+// Cuda
+#include <cuda_runtime.h>
+
+// Project
+#include "Trace.h"
+#include "RenderBackend.h"
+
+namespace
+{
+   // Post processing timings and culling ratios are logged every
+   // LOG_INTERVAL frames
+   const long LOG_INTERVAL = 1000;
+
+   // Shaded tiles of placeholder frames move the background color towards
+   // mid gray by this ratio
+   const float PLACEHOLDER_CONTRAST = 0.3f;
+
+   // Consecutive requests asking for a coarser level of detail before the
+   // backend switches to it
+   const int DETAIL_SWITCH_REQUESTS = 16;
+
+   // Probe pixels whose channels differ by more than the tolerance, in
+   // frames that should be identical, and ratio of such pixels allowed
+   const int   PROBE_TOLERANCE      = 8;
+   const float PROBE_MISMATCH_RATIO = 0.01f;
+
+   // Probe levels are rendered at 1/2^PROBE_LEVEL of the frame resolution
+   const int PROBE_LEVEL = 2;
+
+   inline char toByte( float value )
+   {
+      if( value <= 0.f ) return 0;
+      if( value >= 1.f ) return static_cast<char>(255);
+      return static_cast<char>(static_cast<unsigned char>(value*255.f+0.5f));
+   }
+
+   // Counts probe pixels showing geometry in the full frame, and those that
+   // differ from it
+   inline void compareProbePixel(
+      const char* expected, const char* actual, const char* background,
+      long& geometry, long& mismatches )
+   {
+      if( memcmp( expected, background, 3 ) != 0 ) ++geometry;
+      for( int c(0); c<3; ++c )
+      {
+         if( abs(static_cast<unsigned char>(expected[c])-static_cast<unsigned char>(actual[c])) > PROBE_TOLERANCE )
+         {
+            ++mismatches;
+            return;
+         }
+      }
+   }
+}
+
+RenderBackend::RenderBackend(
+   int index, int device, CudaKernel* cudaKernel, const SceneSnapshotPtr& snapshot,
+   const DepthEstimator& depthEstimator, float pixelPitch, int cullingTileSize ) :
+   index_(index),
+   device_(device),
+   cudaKernel_(cudaKernel),
+   snapshot_(snapshot),
+   molecularDetail_(snapshot->getMolecule() ? snapshot->getMolecule()->getFinestDetail() : mdAtoms),
+   coarserRequests_(0),
+   nbRenderedFrames_(0),
+   cullingTileSize_(cullingTileSize),
+   cullingValidated_(false),
+   levelViewsValidated_(false),
+   nbCulledFrames_(0),
+   renderedPixels_(0.0),
+   totalPixels_(0.0),
+   depthEstimator_(depthEstimator),
+   pixelPitch_(pixelPitch),
+   nbPostProcessedFrames_(0)
+{
+   memset( &timings_, 0, sizeof(timings_) );
+}
+
+RenderBackend::~RenderBackend()
+{
+   delete cudaKernel_;
+}
+
+void RenderBackend::render( const FrameRequest& request, ::IceStreamer::bytes& frame )
+{
+   prepare( request );
+   if( request.level > 0 && rendersLevelView(request) )
+   {
+      FrameRequest view;
+      getLevelView( request, view );
+      cudaKernel_->setSceneInfo( view.sceneInfo );
+      renderView( view, frame );
+   }
+   else if( request.level > 0 )
+   {
+      // Isometric views keep the pixel size when the image plane moves, and
+      // the kernel may not follow the pixel pitch: the level samples the
+      // full frame instead
+      FrameRequest full(request);
+      full.level = 0;
+      renderView( full, levelFrame_ );
+      sampleLevel( request, levelFrame_, frame );
+   }
+   else
+   {
+      renderView( request, frame );
+   }
+}
+
+void RenderBackend::renderStereo(
+   const FrameRequest& left, const FrameRequest& right,
+   ::IceStreamer::bytes* leftFrame, ::IceStreamer::bytes* rightFrame )
+{
+   prepare( left );
+   if( leftFrame ) renderView( left, *leftFrame );
+   if( rightFrame ) renderView( right, *rightFrame );
+}
+
+void RenderBackend::renderPlaceholder(
+   const FrameRequest& request, const std::vector<BoundingBox>& bounds,
+   float pixelPitch, int tileSize, ::IceStreamer::bytes& frame )
+{
+   int scale  = 1<<request.level;
+   int width  = request.sceneInfo.width.x;
+   int height = request.sceneInfo.height.x;
+   int levelWidth  = (width+scale-1)/scale;
+   int levelHeight = (height+scale-1)/scale;
+   TileMask mask;
+   mask.compute( bounds, request.getCameraModel(pixelPitch), width, height, tileSize );
+
+   const float4& color = request.sceneInfo.backgroundColor;
+   const char background[3] = { toByte(color.x), toByte(color.y), toByte(color.z) };
+   const char shaded[3] = {
+      toByte(color.x+(0.5f-color.x)*PLACEHOLDER_CONTRAST),
+      toByte(color.y+(0.5f-color.y)*PLACEHOLDER_CONTRAST),
+      toByte(color.z+(0.5f-color.z)*PLACEHOLDER_CONTRAST) };
+   frame.resize( levelWidth*levelHeight*3 );
+   for( int y(0); y<levelHeight; ++y )
+   {
+      for( int x(0); x<levelWidth; ++x )
+      {
+         bool covered = mask.isCovered( x*scale/tileSize, y*scale/tileSize );
+         memcpy( &frame[(y*levelWidth+x)*3], covered ? shaded : background, 3 );
+      }
+   }
+}
+
+void RenderBackend::prepare( const FrameRequest& request )
+{
+   // The CUDA runtime keeps the current device per host thread, and Ice
+   // dispatches requests from any thread of its pool
+   cudaSetDevice( device_ );
+
+   if( request.layer ) applyLayer( request.layer );
+   applyMolecularDetail( request );
+   cudaKernel_->setSceneInfo( request.sceneInfo );
+   cudaKernel_->setPostProcessingInfo( request.postProcessingInfo );
+}
+
+void RenderBackend::getLevelView( const FrameRequest& request, FrameRequest& view ) const
+{
+   int scale  = 1<<request.level;
+   int width  = request.sceneInfo.width.x;
+   int height = request.sceneInfo.height.x;
+   view = request;
+   view.level = 0;
+   view.sceneInfo.width.x  = (width+scale-1)/scale;
+   view.sceneInfo.height.x = (height+scale-1)/scale;
+
+   // The image plane is moved scale times closer to the eye, which makes
+   // pixels scale times larger, and shifted when the size is not a multiple
+   // of the scale, so that pixel (x, y) of the level keeps the ray of pixel
+   // (x*scale, y*scale) of the frame
+   const float4& eye = request.eye;
+   const float4& direction = request.direction;
+   view.direction.x = eye.x+(direction.x-eye.x)/scale+pixelPitch_*(view.sceneInfo.width.x*0.5f-width*0.5f/scale);
+   view.direction.y = eye.y+(direction.y-eye.y)/scale+pixelPitch_*(height*0.5f/scale-view.sceneInfo.height.x*0.5f);
+   view.direction.z = eye.z+(direction.z-eye.z)/scale;
+}
+
+void RenderBackend::sampleLevel(
+   const FrameRequest& request, const ::IceStreamer::bytes& full, ::IceStreamer::bytes& frame )
+{
+   int scale  = 1<<request.level;
+   int width  = request.sceneInfo.width.x;
+   int height = request.sceneInfo.height.x;
+   int levelWidth  = (width+scale-1)/scale;
+   int levelHeight = (height+scale-1)/scale;
+   size_t colorDepth = full.size()/(width*height);
+   frame.resize( levelWidth*levelHeight*colorDepth );
+   for( int y(0); y<levelHeight; ++y )
+   {
+      for( int x(0); x<levelWidth; ++x )
+         memcpy( &frame[(y*levelWidth+x)*colorDepth], &full[(y*scale*width+x*scale)*colorDepth], colorDepth );
+   }
+}
+
+void RenderBackend::renderView( const FrameRequest& request, ::IceStreamer::bytes& frame )
+{
+   int colorDepth;
+   switch( request.sceneInfo.misc.x )
+   {
+   case ::IceStreamer::otOpenGL:
+   case ::IceStreamer::otJPEG:
+      colorDepth = 4;
+   default:
+      colorDepth = 3;
+   }
+   ++nbRenderedFrames_;
+   if( isCulling() && colorDepth == 3 &&
+       request.sceneInfo.supportFor3DVision.x == ::IceStreamer::vtStandard &&
+       request.sceneInfo.misc.w == 0 )
+   {
+      renderCulled( request, frame );
+   }
+   else
+   {
+      size_t imageSize = request.sceneInfo.width.x*request.sceneInfo.height.x*colorDepth;
+      renderKernel( request, imageSize );
+      frame.assign( bitmap_.begin(), bitmap_.begin()+imageSize );
+   }
+   if( PostProcessor::isEnabled(request.postProcessor) ) postProcess( request, frame );
+}
+
+void RenderBackend::renderCulled( const FrameRequest& request, ::IceStreamer::bytes& frame )
+{
+   int width  = request.sceneInfo.width.x;
+   int height = request.sceneInfo.height.x;
+   mask_.compute( snapshot_->getBounds(), request.getCameraModel(pixelPitch_), width, height, cullingTileSize_ );
+
+   const float4& color = request.sceneInfo.backgroundColor;
+   const char background[3] = { toByte(color.x), toByte(color.y), toByte(color.z) };
+   frame.resize( width*height*3 );
+   for( int i(0); i<width*height; ++i ) memcpy( &frame[i*3], background, 3 );
+
+   int x0, y0, x1, y1;
+   if( mask_.getCoveredRect( x0, y0, x1, y1 ) )
+   {
+      renderRect( request, x0, y0, x1, y1 );
+      int rectWidth  = x1-x0;
+      int rectHeight = y1-y0;
+
+      // Covered tiles only, the others stay exactly constant
+      int tileSize = mask_.getTileSize();
+      for( int ty(0); ty<mask_.getHeight(); ++ty )
+      {
+         for( int tx(0); tx<mask_.getWidth(); ++tx )
+         {
+            if( !mask_.isCovered(tx, ty) ) continue;
+            int px0 = tx*tileSize;
+            int px1 = std::min(px0+tileSize, width);
+            int py1 = std::min((ty+1)*tileSize, height);
+            for( int y(ty*tileSize); y<py1; ++y )
+               memcpy( &frame[(y*width+px0)*3], &bitmap_[((y-y0)*rectWidth+px0-x0)*3], (px1-px0)*3 );
+         }
+      }
+      renderedPixels_ += rectWidth*rectHeight;
+   }
+   totalPixels_ += width*height;
+
+   if( ++nbCulledFrames_%LOG_INTERVAL == 0 )
+   {
+      APPL_LOG_INFO("Backend " << index_ << " renders " << 
+         static_cast<int>(100.0*renderedPixels_/totalPixels_) << "% of the pixels");
+      renderedPixels_ = 0.0;
+      totalPixels_    = 0.0;
+   }
+}
+
+void RenderBackend::renderRect( const FrameRequest& request, int& x0, int& y0, int& x1, int& y1 )
+{
+   int width  = request.sceneInfo.width.x;
+   int height = request.sceneInfo.height.x;
+
+   // Even sizes, in case the kernel halves them with integer divisions. A
+   // rectangle spanning a whole odd side stays odd, like the frame.
+   if( (x1-x0)%2 ) { if( x1 < width ) ++x1; else if( x0 > 0 ) --x0; }
+   if( (y1-y0)%2 ) { if( y1 < height ) ++y1; else if( y0 > 0 ) --y0; }
+
+   // The rectangle is rendered as a smaller image, whose image plane is
+   // centered on the rectangle, so that rays are the same as in the full
+   // image
+   int rectWidth  = x1-x0;
+   int rectHeight = y1-y0;
+   FrameRequest view(request);
+   view.sceneInfo.width.x  = rectWidth;
+   view.sceneInfo.height.x = rectHeight;
+   view.direction.x += pixelPitch_*(x0+rectWidth*0.5f-width*0.5f);
+   view.direction.y -= pixelPitch_*(y0+rectHeight*0.5f-height*0.5f);
+   cudaKernel_->setSceneInfo( view.sceneInfo );
+   renderKernel( view, rectWidth*rectHeight*3 );
+   cudaKernel_->setSceneInfo( request.sceneInfo );
+}
+
+bool RenderBackend::validateCulling( const FrameRequest& probe )
+{
+   cullingValidated_ = false;
+   if( cullingTileSize_ <= 0 ) return false;
+
+   // Perspective view of the full frame
+   FrameRequest request(probe);
+   request.level = 0;
+   request.sceneInfo.misc.w = 0;
+   prepare( request );
+   int width  = request.sceneInfo.width.x;
+   int height = request.sceneInfo.height.x;
+   size_t imageSize = width*height*3;
+   renderKernel( request, imageSize );
+   std::vector<char> full( bitmap_.begin(), bitmap_.begin()+imageSize );
+
+   // Off center, so that a different pixel pitch moves the rays
+   int x0 = width/2, y0 = height/4, x1 = width-width/8, y1 = height-height/4;
+   renderRect( request, x0, y0, x1, y1 );
+
+   const float4& color = request.sceneInfo.backgroundColor;
+   const char background[3] = { toByte(color.x), toByte(color.y), toByte(color.z) };
+   int rectWidth = x1-x0;
+   long geometry(0), mismatches(0);
+   for( int y(y0); y<y1; ++y )
+   {
+      for( int x(x0); x<x1; ++x )
+         compareProbePixel( &full[(y*width+x)*3], &bitmap_[((y-y0)*rectWidth+x-x0)*3], background, geometry, mismatches );
+   }
+
+   if( !acceptProbe( "cull", geometry, mismatches, static_cast<long>(rectWidth)*(y1-y0) ) ) return false;
+   cullingValidated_ = true;
+   APPL_LOG_INFO("Backend " << index_ << " culls tiles of " << cullingTileSize_ << " pixels");
+   return true;
+}
+
+bool RenderBackend::validateLevelViews( const FrameRequest& probe )
+{
+   levelViewsValidated_ = false;
+
+   // Perspective view of the full frame, one pixel narrower than the probe
+   // so that the level view is shifted
+   FrameRequest request(probe);
+   request.level = 0;
+   request.sceneInfo.misc.w = 0;
+   request.sceneInfo.width.x -= 1;
+   prepare( request );
+   int width  = request.sceneInfo.width.x;
+   int height = request.sceneInfo.height.x;
+   size_t imageSize = width*height*3;
+   renderKernel( request, imageSize );
+   std::vector<char> full( bitmap_.begin(), bitmap_.begin()+imageSize );
+
+   request.level = PROBE_LEVEL;
+   FrameRequest view;
+   getLevelView( request, view );
+   cudaKernel_->setSceneInfo( view.sceneInfo );
+   int levelWidth  = view.sceneInfo.width.x;
+   int levelHeight = view.sceneInfo.height.x;
+   renderKernel( view, levelWidth*levelHeight*3 );
+   cudaKernel_->setSceneInfo( request.sceneInfo );
+
+   const float4& color = request.sceneInfo.backgroundColor;
+   const char background[3] = { toByte(color.x), toByte(color.y), toByte(color.z) };
+   int scale = 1<<PROBE_LEVEL;
+   long geometry(0), mismatches(0);
+   for( int y(0); y<levelHeight; ++y )
+   {
+      for( int x(0); x<levelWidth; ++x )
+         compareProbePixel( &full[(y*scale*width+x*scale)*3], &bitmap_[(y*levelWidth+x)*3], background, geometry, mismatches );
+   }
+
+   if( !acceptProbe( "render levels as smaller images", geometry, mismatches, static_cast<long>(levelWidth)*levelHeight ) ) return false;
+   levelViewsValidated_ = true;
+   APPL_LOG_INFO("Backend " << index_ << " renders levels as smaller images");
+   return true;
+}
+
+bool RenderBackend::acceptProbe( const char* feature, long geometry, long mismatches, long nbPixels ) const
+{
+   if( geometry == 0 )
+   {
+      APPL_LOG_WARNING("Backend " << index_ << " does not " << feature << ": the probe frame shows no geometry to compare");
+      return false;
+   }
+   if( mismatches > nbPixels*PROBE_MISMATCH_RATIO )
+   {
+      APPL_LOG_WARNING("Backend " << index_ << " does not " << feature << ": " << mismatches << " of " << nbPixels << 
+         " pixels differ, the pixel pitch does not match the kernel");
+      return false;
+   }
+   return true;
+}
+
+void RenderBackend::renderKernel( const FrameRequest& request, size_t imageSize )
+{
+   if( bitmap_.size() < imageSize ) bitmap_.resize(imageSize);
+   cudaKernel_->setCamera( request.eye, request.direction, request.angles );
+   cudaKernel_->render_begin( 0 );
+   cudaKernel_->render_end( &bitmap_[0] );
+}
+
+void RenderBackend::applyMolecularDetail( const FrameRequest& request )
+{
+   const MolecularStorePtr& molecule = snapshot_->getMolecule();
+   if( !molecule ) return;
+
+   // The camera model is perspective only: isometric views keep the finest
+   // level rather than guess the pixel size of the kernel
+   MolecularDetail detail = ( request.sceneInfo.misc.w != 0 ) ?
+      molecule->getFinestDetail() :
+      molecule->selectDetail( request.getCameraModel(pixelPitch_), molecularDetail_ );
+   if( detail > molecularDetail_ && ++coarserRequests_ < DETAIL_SWITCH_REQUESTS ) return;
+   coarserRequests_ = 0;
+   if( detail == molecularDetail_ ) return;
+
+   molecule->uploadDetail( *cudaKernel_, snapshot_->getMoleculePrimitive(), detail );
+   cudaKernel_->compactBoxes( true );
+   molecularDetail_ = detail;
+   APPL_LOG_INFO("Backend " << index_ << " renders " << MolecularStore::getDetailName(detail));
+}
+
+void RenderBackend::postProcess( const FrameRequest& request, ::IceStreamer::bytes& frame )
+{
+   int width  = request.sceneInfo.width.x;
+   int height = request.sceneInfo.height.x;
+   if( frame.size() != static_cast<size_t>(width*height*3) ) return;
+
+   const float* depth(0);
+   if( request.postProcessor.depthOfField )
+   {
+      // Tiles of the estimated depth are spread over their pixels
+      std::vector<unsigned short> tiles;
+      int depthWidth, depthHeight;
+      float maxDistance = request.sceneInfo.viewDistance.x;
+      depthEstimator_.estimate( snapshot_->getBounds(), request.getCameraModel(pixelPitch_),
+         width, height, maxDistance, tiles, depthWidth, depthHeight );
+
+      int tileSize = depthEstimator_.getTileSize();
+      float scale = maxDistance/65534.f;
+      depth_.resize( width*height );
+      for( int y(0); y<height; ++y )
+      {
+         const unsigned short* row = &tiles[(y/tileSize)*depthWidth];
+         for( int x(0); x<width; ++x )
+         {
+            unsigned short d = row[x/tileSize];
+            depth_[y*width+x] = (d == DepthEstimator::BACKGROUND) ? FLT_MAX : d*scale;
+         }
+      }
+      depth = &depth_[0];
+   }
+
+   postProcessor_.process( request.postProcessor,
+      &frame[0], width, height, depth, timings_ );
+
+   if( ++nbPostProcessedFrames_%LOG_INTERVAL == 0 )
+   {
+      std::ostringstream stages;
+      for( int i(0); i<psCount; ++i )
+      {
+         if( timings_.frames[i] == 0 ) continue;
+         stages << " " << PostProcessor::getStageName(i) << "=" << 
+            timings_.milliseconds[i]/timings_.frames[i] << "ms";
+      }
+      APPL_LOG_INFO("Backend " << index_ << " post processing:" << stages.str());
+   }
+}
+
+void RenderBackend::applyLayer( const SceneLayerPtr& layer )
+{
+   if( layer == appliedLayer_ ) return;
+
+   const std::vector<MaterialDescription>& materials = snapshot_->getMaterials();
+   const std::map<int, MaterialDescription>& overrides = layer->getMaterials();
+
+   // Restore the materials overridden by the previous layer only
+   if( appliedLayer_ )
+   {
+      const std::map<int, MaterialDescription>& previous = appliedLayer_->getMaterials();
+      std::map<int, MaterialDescription>::const_iterator it = previous.begin();
+      for( ; it != previous.end(); ++it )
+      {
+         if( overrides.find(it->first) == overrides.end() )
+            SceneSnapshot::applyMaterial( *cudaKernel_, it->first, materials[it->first] );
+      }
+   }
+
+   std::map<int, MaterialDescription>::const_iterator it = overrides.begin();
+   for( ; it != overrides.end(); ++it )
+      SceneSnapshot::applyMaterial( *cudaKernel_, it->first, it->second );
+
+   appliedLayer_ = layer;
+}
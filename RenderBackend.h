@@ -0,0 +1,222 @@
+#pragma once
+
+// Ice
+#include <IceUtil/Mutex.h>
+
+// Project
+#include <Cuda/CudaKernel.h>
+#include "IIceStreamer.h"
+#include "SceneSnapshot.h"
+#include "PostProcessor.h"
+#include "TileMask.h"
+
+/*
+* @brief Everything the kernel needs to produce one frame. A request of level
+* L renders the frame at 1/2^L of its resolution: pixel (x, y) of the level
+* has the ray of pixel (x*2^L, y*2^L) of the frame.
+*/
+struct FrameRequest
+{
+   // Kernel structures are zeroed, lanes that are not set have a known value
+   FrameRequest() : eye(), direction(), angles(), sceneInfo(), postProcessingInfo(), postProcessor(), level(0) {}
+
+   float4 eye;
+   float4 direction;
+   float4 angles;
+   SceneInfo sceneInfo;
+   PostProcessingInfo postProcessingInfo;
+   PostProcessorSettings postProcessor;
+   SceneLayerPtr layer;
+   int level;
+
+   CameraModel getCameraModel( float pixelPitch ) const
+   {
+      CameraVector e = { eye.x, eye.y, eye.z };
+      CameraVector d = { direction.x, direction.y, direction.z };
+      CameraVector a = { angles.x, angles.y, angles.z };
+      return CameraModel( e, d, a, sceneInfo.width.x, sceneInfo.height.x, pixelPitch );
+   }
+};
+
+/*
+* @brief A render backend owns one kernel instance, and therefore its own copy
+* of the scene. The kernel is not thread safe: callers must hold the backend
+* mutex for the whole setSceneInfo/setCamera/render sequence.
+* The backend remembers which session layer is currently applied to its
+* kernel, so that material overrides are only uploaded when switching from a
+* session to another one with different overrides.
+* The level of detail of the molecule follows the distance of the camera,
+* the primitives of the kernel are only updated when the level changes.
+* A backend shared by sessions with near and far cameras would otherwise
+* switch levels at every request: finer levels are applied at once, but a
+* coarser one only after DETAIL_SWITCH_REQUESTS requests in a row asked for
+* it. A frame rendered finer than needed only looks better, so cached frames
+* stay valid whatever backend rendered them. The level is chosen with the
+* camera model, which is perspective only: isometric views are always
+* rendered at the finest level.
+* When culling is enabled, the scene bounds are projected on a mask of
+* screen tiles, and the kernel only renders the rectangle enclosing the
+* tiles that may show geometry. Other tiles are filled with the background
+* color, so that encoders can treat them as constant. Culling relies on the
+* camera model matching the kernel, so it stays disabled until a probe frame
+* shows that it does, and isometric views are never culled.
+* Levels of progressive frames are rendered as smaller images, with the
+* settings and level of detail of the full frame. This relies on the camera
+* model as well: until a probe frame validates it, and for isometric views,
+* levels sample a frame rendered in full.
+* Frames are post processed on the CPU by the backend when the request asks
+* for it, depth of field using the depth estimated from the scene bounds.
+*/
+class RenderBackend
+{
+
+public:
+
+   RenderBackend(
+      int index, int device, CudaKernel* cudaKernel, const SceneSnapshotPtr& snapshot,
+      const DepthEstimator& depthEstimator, float pixelPitch, int cullingTileSize );
+   ~RenderBackend();
+
+public:
+
+   /**
+   * @brief Renders a frame into the given buffer. The caller must hold the
+   * backend mutex.
+   */
+   void render( const FrameRequest& request, ::IceStreamer::bytes& frame );
+
+   /**
+   * @brief Renders the two views of a stereo pair. Both requests must only
+   * differ by their camera: the scene settings and the session layer are
+   * uploaded to the kernel once for both eyes. Views with no buffer are not
+   * rendered. The caller must hold the backend mutex.
+   */
+   void renderStereo(
+      const FrameRequest& left, const FrameRequest& right,
+      ::IceStreamer::bytes* leftFrame, ::IceStreamer::bytes* rightFrame );
+
+public:
+
+   /**
+   * @brief Frame served while no backend is ready: the background, with the
+   * tiles that may show the scene bounds shaded, so that clients see where
+   * the scene will appear. Frames of a level sample the tiles of the full
+   * frame.
+   */
+   static void renderPlaceholder(
+      const FrameRequest& request, const std::vector<BoundingBox>& bounds,
+      float pixelPitch, int tileSize, ::IceStreamer::bytes& frame );
+
+public:
+
+   /**
+   * @brief Renders the probe request in full, then an off center rectangle
+   * of it the way culled frames are rendered, and enables culling when both
+   * agree: the rectangle is only rendered with the rays of the full frame
+   * when the kernel spaces pixels by the pixel pitch of the server. The
+   * probe must show geometry in the right half of the frame. The caller
+   * must hold the backend mutex.
+   */
+   bool validateCulling( const FrameRequest& probe );
+
+   bool isCulling() const { return cullingTileSize_ > 0 && cullingValidated_; }
+
+   /**
+   * @brief Renders the probe request in full, then a level of it as a
+   * smaller image, and enables level views when the pixels of the level
+   * match those of the full frame they sample. The probe must show geometry.
+   * The caller must hold the backend mutex.
+   */
+   bool validateLevelViews( const FrameRequest& probe );
+
+   bool hasLevelViews() const { return levelViewsValidated_; }
+
+   /**
+   * @brief Whether a level of the request is rendered as a smaller image.
+   * Other levels sample a frame rendered in full, which callers may render
+   * themselves and share between the levels of the same camera.
+   */
+   bool rendersLevelView( const FrameRequest& request ) const
+   {
+      return levelViewsValidated_ && request.sceneInfo.misc.w == 0;
+   }
+
+   /**
+   * @brief Level of a frame rendered in full: pixel (x, y) of the level is
+   * pixel (x*2^L, y*2^L) of the full frame
+   */
+   static void sampleLevel( const FrameRequest& request, const ::IceStreamer::bytes& full, ::IceStreamer::bytes& frame );
+
+public:
+
+   int getIndex() const { return index_; }
+   int getDevice() const { return device_; }
+   CudaKernel& getKernel() { return *cudaKernel_; }
+   IceUtil::Mutex& getMutex() { return mutex_; }
+
+   /**
+   * @brief Time spent post processing frames. The caller must hold the
+   * backend mutex.
+   */
+   const PostProcessorTimings& getPostProcessorTimings() const { return timings_; }
+
+   /**
+   * @brief Number of frames rendered by the kernel, levels included. The
+   * caller must hold the backend mutex.
+   */
+   long getNbRenderedFrames() const { return nbRenderedFrames_; }
+
+private:
+
+   void prepare( const FrameRequest& request );
+   void getLevelView( const FrameRequest& request, FrameRequest& view ) const;
+   void renderView( const FrameRequest& request, ::IceStreamer::bytes& frame );
+   void renderCulled( const FrameRequest& request, ::IceStreamer::bytes& frame );
+   // Renders the rectangle [x0,x1[ x [y0,y1[ of the frame in the bitmap,
+   // grown to even sizes when possible
+   void renderRect( const FrameRequest& request, int& x0, int& y0, int& x1, int& y1 );
+   void renderKernel( const FrameRequest& request, size_t imageSize );
+   // Logs why a probe is rejected, feature being what the backend does not do
+   bool acceptProbe( const char* feature, long geometry, long mismatches, long nbPixels ) const;
+   void applyLayer( const SceneLayerPtr& layer );
+   void applyMolecularDetail( const FrameRequest& request );
+   void postProcess( const FrameRequest& request, ::IceStreamer::bytes& frame );
+
+private:
+
+   int index_;
+   int device_;
+   CudaKernel* cudaKernel_;
+   IceUtil::Mutex mutex_;
+
+private:
+
+   SceneSnapshotPtr snapshot_;
+   SceneLayerPtr appliedLayer_;
+   MolecularDetail molecularDetail_;
+   int coarserRequests_;
+
+   std::vector<char> bitmap_;
+   ::IceStreamer::bytes levelFrame_;
+   long nbRenderedFrames_;
+
+private:
+
+   int cullingTileSize_;
+   bool cullingValidated_;
+   bool levelViewsValidated_;
+   TileMask mask_;
+   long nbCulledFrames_;
+   double renderedPixels_;
+   double totalPixels_;
+
+private:
+
+   PostProcessor postProcessor_;
+   PostProcessorTimings timings_;
+   DepthEstimator depthEstimator_;
+   float pixelPitch_;
+   std::vector<float> depth_;
+   long nbPostProcessedFrames_;
+
+};
@@ -0,0 +1,119 @@
+// Project
+#include "Trace.h"
+#include "RenderBackendPool.h"
+
+RenderBackendPool::RenderBackendPool( int migrationThreshold ) :
+   migrationThreshold_(migrationThreshold)
+{
+}
+
+RenderBackendPool::~RenderBackendPool()
+{
+   for( size_t i(0); i<backends_.size(); ++i )
+      delete backends_[i];
+}
+
+void RenderBackendPool::addBackend( RenderBackend* backend )
+{
+   IceUtil::Mutex::Lock lock(mutex_);
+   backends_.push_back(backend);
+   loads_.push_back(0);
+   sessions_.push_back(0);
+}
+
+size_t RenderBackendPool::size()
+{
+   IceUtil::Mutex::Lock lock(mutex_);
+   return backends_.size();
+}
+
+RenderBackend* RenderBackendPool::getBackend( size_t index )
+{
+   IceUtil::Mutex::Lock lock(mutex_);
+   return backends_[index];
+}
+
+bool RenderBackendPool::isCulling()
+{
+   IceUtil::Mutex::Lock lock(mutex_);
+   if( backends_.empty() ) return false;
+   for( size_t i(0); i<backends_.size(); ++i )
+      if( !backends_[i]->isCulling() ) return false;
+   return true;
+}
+
+RenderBackend* RenderBackendPool::acquire( const std::string& sessionId )
+{
+   IceUtil::Mutex::Lock lock(mutex_);
+
+   // Backends are added while the server loads the scene
+   if( backends_.empty() ) return nullptr;
+   size_t leastLoaded = getLeastLoadedBackend();
+   size_t index = leastLoaded;
+
+   std::map<std::string, size_t>::iterator it = affinities_.find(sessionId);
+   if( it == affinities_.end() )
+   {
+      affinities_[sessionId] = index;
+      ++sessions_[index];
+      APPL_LOG_INFO("Session assigned to backend " << index << " (" << affinities_.size() << " sessions)");
+   }
+   else
+   {
+      index = it->second;
+      if( loads_[index] - loads_[leastLoaded] > migrationThreshold_ )
+      {
+         APPL_LOG_INFO("Session migrated from backend " << index << " (load " << loads_[index] <<
+            ") to backend " << leastLoaded << " (load " << loads_[leastLoaded] << ")");
+         --sessions_[index];
+         index = leastLoaded;
+         ++sessions_[index];
+         it->second = index;
+      }
+   }
+   ++loads_[index];
+   return backends_[index];
+}
+
+void RenderBackendPool::release( RenderBackend* backend )
+{
+   if( !backend ) return;
+   IceUtil::Mutex::Lock lock(mutex_);
+   --loads_[backend->getIndex()];
+}
+
+RenderBackend* RenderBackendPool::acquireIdle( const std::string& sessionId )
+{
+   IceUtil::Mutex::Lock lock(mutex_);
+   if( backends_.empty() ) return nullptr;
+   std::map<std::string, size_t>::iterator it = affinities_.find(sessionId);
+   size_t index = (it != affinities_.end()) ? it->second : getLeastLoadedBackend();
+   if( loads_[index] != 0 ) index = getLeastLoadedBackend();
+   if( loads_[index] != 0 ) return nullptr;
+   ++loads_[index];
+   return backends_[index];
+}
+
+void RenderBackendPool::releaseSession( const std::string& sessionId )
+{
+   IceUtil::Mutex::Lock lock(mutex_);
+   std::map<std::string, size_t>::iterator it = affinities_.find(sessionId);
+   if( it != affinities_.end() )
+   {
+      --sessions_[it->second];
+      affinities_.erase(it);
+   }
+}
+
+size_t RenderBackendPool::getLeastLoadedBackend()
+{
+   // Idle backends all have a null load, the number of sessions they serve
+   // breaks the tie
+   size_t index(0);
+   for( size_t i(1); i<loads_.size(); ++i )
+   {
+      if( loads_[i] < loads_[index] || 
+         (loads_[i] == loads_[index] && sessions_[i] < sessions_[index]) ) index = i;
+   }
+   return index;
+}
@@ -0,0 +1,116 @@
+#pragma once
+
+// System
+#include <map>
+#include <string>
+#include <vector>
+
+// Ice
+#include <IceUtil/Mutex.h>
+
+// Project
+#include "RenderBackend.h"
+
+/*
+* @brief Pool of render backends hosted by one server. Client sessions stick to
+* the backend they were assigned to, so that the kernel keeps its coherence
+* from one frame to the next, and are migrated to the least loaded backend
+* when theirs gets overloaded. The load of a backend is the number of requests
+* queued or being rendered on it.
+*/
+class RenderBackendPool
+{
+
+public:
+
+   RenderBackendPool( int migrationThreshold );
+   ~RenderBackendPool();
+
+public:
+
+   // Takes ownership of the backend
+   void addBackend( RenderBackend* backend );
+
+   size_t size();
+   RenderBackend* getBackend( size_t index );
+
+   /**
+   * @brief True when there are backends and all of them cull, so that the
+   * tiles outside of the scene bounds of any rendered frame have the
+   * background color
+   */
+   bool isCulling();
+
+public:
+
+   /**
+   * @brief Returns the backend a session should render on and accounts for
+   * the new request, or null while no backend has been added yet. Every
+   * call must be matched by a call to release().
+   */
+   RenderBackend* acquire( const std::string& sessionId );
+   void release( RenderBackend* backend );
+
+   /**
+   * @brief Returns an idle backend, preferably the one the session is
+   * assigned to, or null when all backends are busy. Used for background
+   * work that must not delay client requests.
+   */
+   RenderBackend* acquireIdle( const std::string& sessionId );
+
+   /**
+   * @brief Forgets the backend affinity of a session
+   */
+   void releaseSession( const std::string& sessionId );
+
+private:
+
+   size_t getLeastLoadedBackend();
+
+private:
+
+   IceUtil::Mutex mutex_;
+   std::vector<RenderBackend*> backends_;
+   std::vector<int> loads_;
+   std::vector<int> sessions_;
+   std::map<std::string, size_t> affinities_;
+   int migrationThreshold_;
+
+};
+
+/*
+* @brief Scoped acquisition of a backend from the pool
+*/
+class ScopedBackend
+{
+
+public:
+
+   ScopedBackend( RenderBackendPool& pool, const std::string& sessionId ) :
+      pool_(pool),
+      backend_(pool.acquire(sessionId))
+   {
+   }
+
+   ~ScopedBackend()
+   {
+      pool_.release(backend_);
+   }
+
+public:
+
+   bool isValid() const { return backend_ != nullptr; }
+   RenderBackend* operator->() const { return backend_; }
+   RenderBackend& operator*() const { return *backend_; }
+
+private:
+
+   ScopedBackend( const ScopedBackend& );
+   ScopedBackend& operator=( const ScopedBackend& );
+
+private:
+
+   RenderBackendPool& pool_;
+   RenderBackend* backend_;
+
+};
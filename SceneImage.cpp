@@ -0,0 +1,251 @@
+// System
+#ifdef WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#endif
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <stdio.h>
+#include <string.h>
+
+// Project
+#include "Trace.h"
+#include "SceneImage.h"
+
+namespace
+{
+   const char MAGIC[8] = { 'S', 'O', 'L', 'R', 'I', 'M', 'G', 0 };
+
+   // To be increased whenever the meaning of a section changes. Changes of
+   // the size of its elements are detected by the section itself.
+   const int FORMAT_VERSION = 2;
+
+   const size_t ALIGNMENT = 16;
+
+   struct ImageHeader
+   {
+      char magic[8];
+      int formatVersion;
+      int reserved;
+      char build[32];
+      char source[256];
+      long long sourceSize;
+      long long sourceTime;
+      int nbSections;
+      int padding;
+   };
+
+   struct SectionEntry
+   {
+      int id;
+      int index;
+      long long offset;
+      long long size;
+      long long elementSize;
+   };
+
+   size_t align( size_t offset )
+   {
+      return (offset+ALIGNMENT-1)/ALIGNMENT*ALIGNMENT;
+   }
+
+   // Images are bound to the build of the server that wrote them
+   void fillHeader( ImageHeader& header, const std::string& source, const std::string& sourceFile )
+   {
+      memset( &header, 0, sizeof(header) );
+      memcpy( header.magic, MAGIC, sizeof(MAGIC) );
+      header.formatVersion = FORMAT_VERSION;
+      strncpy( header.build, __DATE__ " " __TIME__, sizeof(header.build)-1 );
+      strncpy( header.source, source.c_str(), sizeof(header.source)-1 );
+      header.sourceSize = -1;
+      struct stat status;
+      if( stat( sourceFile.c_str(), &status ) == 0 )
+      {
+         header.sourceSize = static_cast<long long>(status.st_size);
+         header.sourceTime = static_cast<long long>(status.st_mtime);
+      }
+   }
+}
+
+SceneImage::SceneImage() :
+   data_(nullptr),
+   size_(0),
+#ifdef WIN32
+   file_(INVALID_HANDLE_VALUE),
+   mapping_(nullptr)
+#else
+   file_(-1)
+#endif
+{
+}
+
+SceneImage::~SceneImage()
+{
+   close();
+}
+
+bool SceneImage::open( const std::string& fileName, const std::string& source, const std::string& sourceFile )
+{
+   close();
+#ifdef WIN32
+   file_ = CreateFileA( fileName.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr );
+   if( file_ == INVALID_HANDLE_VALUE ) return false;
+   LARGE_INTEGER fileSize;
+   if( GetFileSizeEx( file_, &fileSize ) && fileSize.QuadPart > 0 )
+   {
+      mapping_ = CreateFileMappingA( file_, nullptr, PAGE_READONLY, 0, 0, nullptr );
+      if( mapping_ ) data_ = static_cast<const char*>(MapViewOfFile( mapping_, FILE_MAP_READ, 0, 0, 0 ));
+      size_ = static_cast<size_t>(fileSize.QuadPart);
+   }
+#else
+   file_ = ::open( fileName.c_str(), O_RDONLY );
+   if( file_ < 0 ) return false;
+   struct stat status;
+   if( fstat( file_, &status ) == 0 && status.st_size > 0 )
+   {
+      void* data = mmap( nullptr, status.st_size, PROT_READ, MAP_SHARED, file_, 0 );
+      if( data != MAP_FAILED ) data_ = static_cast<const char*>(data);
+      size_ = static_cast<size_t>(status.st_size);
+   }
+#endif
+   if( !data_ )
+   {
+      APPL_LOG_WARNING("Cannot map " << fileName);
+      close();
+      return false;
+   }
+
+   ImageHeader expected;
+   fillHeader( expected, source, sourceFile );
+   const ImageHeader* header = reinterpret_cast<const ImageHeader*>(data_);
+   bool valid = size_ >= sizeof(ImageHeader) &&
+      memcmp( header->magic, expected.magic, sizeof(MAGIC) ) == 0 &&
+      header->formatVersion == expected.formatVersion &&
+      memcmp( header->build, expected.build, sizeof(expected.build) ) == 0 &&
+      memcmp( header->source, expected.source, sizeof(expected.source) ) == 0 &&
+      header->sourceSize == expected.sourceSize &&
+      header->sourceTime == expected.sourceTime &&
+      header->nbSections >= 0 &&
+      sizeof(ImageHeader)+header->nbSections*sizeof(SectionEntry) <= size_;
+
+   // Sections must be inside the file
+   const SectionEntry* entries = reinterpret_cast<const SectionEntry*>(data_+sizeof(ImageHeader));
+   for( int i(0); valid && i<header->nbSections; ++i )
+   {
+      valid = entries[i].offset >= 0 && entries[i].size >= 0 &&
+         static_cast<unsigned long long>(entries[i].offset+entries[i].size) <= size_;
+   }
+   if( !valid )
+   {
+      APPL_LOG_INFO(fileName << " is out of date");
+      close();
+      return false;
+   }
+   APPL_LOG_INFO(fileName << ": " << header->nbSections << " sections, " << size_/1024 << " KB");
+   return true;
+}
+
+void SceneImage::close()
+{
+#ifdef WIN32
+   if( data_ ) UnmapViewOfFile( data_ );
+   if( mapping_ ) CloseHandle( mapping_ );
+   if( file_ != INVALID_HANDLE_VALUE ) CloseHandle( file_ );
+   file_    = INVALID_HANDLE_VALUE;
+   mapping_ = nullptr;
+#else
+   if( data_ ) munmap( const_cast<char*>(data_), size_ );
+   if( file_ >= 0 ) ::close( file_ );
+   file_ = -1;
+#endif
+   data_ = nullptr;
+   size_ = 0;
+}
+
+const void* SceneImage::getSection( int id, int index, size_t elementSize, size_t& size ) const
+{
+   size = 0;
+   if( !data_ ) return nullptr;
+   const ImageHeader* header = reinterpret_cast<const ImageHeader*>(data_);
+   const SectionEntry* entries = reinterpret_cast<const SectionEntry*>(data_+sizeof(ImageHeader));
+   for( int i(0); i<header->nbSections; ++i )
+   {
+      if( entries[i].id != id || entries[i].index != index ) continue;
+      if( entries[i].elementSize != static_cast<long long>(elementSize) )
+      {
+         APPL_LOG_WARNING("Section " << id << "." << index << " of the image has elements of " <<
+            entries[i].elementSize << " bytes, " << elementSize << " expected");
+         return nullptr;
+      }
+      size = static_cast<size_t>(entries[i].size);
+      return data_+entries[i].offset;
+   }
+   return nullptr;
+}
+
+void SceneImageWriter::add( int id, int index, const void* data, size_t size, size_t elementSize )
+{
+   Section section;
+   section.id          = id;
+   section.index       = index;
+   section.elementSize = elementSize;
+   sections_.push_back( section );
+   const char* bytes = static_cast<const char*>(data);
+   if( size > 0 ) sections_.back().data.assign( bytes, bytes+size );
+}
+
+bool SceneImageWriter::write( const std::string& fileName, const std::string& source, const std::string& sourceFile ) const
+{
+   ImageHeader header;
+   fillHeader( header, source, sourceFile );
+   header.nbSections = static_cast<int>(sections_.size());
+
+   std::vector<SectionEntry> entries( sections_.size() );
+   size_t offset = align( sizeof(ImageHeader)+entries.size()*sizeof(SectionEntry) );
+   for( size_t i(0); i<sections_.size(); ++i )
+   {
+      entries[i].id          = sections_[i].id;
+      entries[i].index       = sections_[i].index;
+      entries[i].offset      = static_cast<long long>(offset);
+      entries[i].size        = static_cast<long long>(sections_[i].data.size());
+      entries[i].elementSize = static_cast<long long>(sections_[i].elementSize);
+      offset = align( offset+sections_[i].data.size() );
+   }
+
+   std::string temporary = fileName+".tmp";
+   FILE* file = fopen( temporary.c_str(), "wb" );
+   if( !file )
+   {
+      APPL_LOG_ERROR("Cannot write " << temporary);
+      return false;
+   }
+   const char padding[ALIGNMENT] = { 0 };
+   size_t position = sizeof(ImageHeader)+entries.size()*sizeof(SectionEntry);
+   bool written = fwrite( &header, sizeof(header), 1, file ) == 1 &&
+      (entries.empty() || fwrite( &entries[0], sizeof(SectionEntry), entries.size(), file ) == entries.size());
+   for( size_t i(0); written && i<sections_.size(); ++i )
+   {
+      size_t gap = static_cast<size_t>(entries[i].offset)-position;
+      const std::vector<char>& data = sections_[i].data;
+      written = fwrite( padding, 1, gap, file ) == gap &&
+         (data.empty() || fwrite( &data[0], 1, data.size(), file ) == data.size());
+      position += gap+data.size();
+   }
+   written = (fclose( file ) == 0) && written;
+
+   // The previous image stays in place until the new one is complete
+#ifdef WIN32
+   if( written ) remove( fileName.c_str() );
+#endif
+   if( !written || rename( temporary.c_str(), fileName.c_str() ) != 0 )
+   {
+      APPL_LOG_ERROR("Cannot write " << fileName);
+      remove( temporary.c_str() );
+      return false;
+   }
+   APPL_LOG_INFO(fileName << ": " << sections_.size() << " sections, " << position/1024 << " KB written");
+   return true;
+}
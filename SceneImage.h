@@ -0,0 +1,155 @@
+#pragma once
+
+// System
+#include <string>
+#include <vector>
+
+// Project
+#include <Cuda/CudaKernel.h>
+
+/*
+* @brief Sections of a warm start image. Sections of the impostors are
+* indexed by their level of detail.
+*/
+enum SceneImageSection
+{
+   siDefaults,
+   siMaterials,
+   siBounds,
+   siMolecule,
+   siAtomsX,
+   siAtomsY,
+   siAtomsZ,
+   siAtomRadii,
+   siAtomElements,
+   siAtomMaterials,
+   siImpostorsX,
+   siImpostorsY,
+   siImpostorsZ,
+   siImpostorRadii,
+   siImpostorMaterials
+};
+
+/*
+* @brief Session defaults stored in a warm start image
+*/
+struct SceneDefaults
+{
+   SceneInfo sceneInfo;
+   PostProcessingInfo postProcessingInfo;
+   float4 eye;
+   float4 direction;
+   float4 angles;
+};
+
+/*
+* @brief Warm start image of the server: the scene as it is once built at
+* startup, i.e. session defaults, material table, bounds and molecule with
+* its levels of detail. Sections are raw arrays aligned on 16 bytes, so that
+* the file is mapped in memory and sections are read without any parsing:
+* getSection points into the mapping, getArray and getValue copy the
+* section out of it.
+* Each section records the size of its elements, and is only read as
+* elements of the same size, so that a structure whose layout changed is
+* never read from an older image. An image is also only valid for the build
+* that wrote it, and for the source it was built from: a description of the
+* settings and the size and modification time of the molecule file.
+* The boxes of the kernels are not part of the image: kernels only build
+* them from their primitives, so each start uploads the primitives again.
+*/
+class SceneImage
+{
+
+public:
+
+   SceneImage();
+   ~SceneImage();
+
+public:
+
+   /**
+   * @brief Maps an image. Returns false when the file does not exist, or
+   * was written by another build or from another source.
+   */
+   bool open( const std::string& fileName, const std::string& source, const std::string& sourceFile );
+   void close();
+
+   /**
+   * @brief Returns the section with the given id and index, in place in the
+   * mapped file. Returns null when the image does not have it, or when its
+   * elements are not elementSize bytes large.
+   */
+   const void* getSection( int id, int index, size_t elementSize, size_t& size ) const;
+
+   template<typename T> bool getArray( int id, int index, std::vector<T>& values ) const
+   {
+      size_t size;
+      const T* data = static_cast<const T*>(getSection( id, index, sizeof(T), size ));
+      if( !data || size%sizeof(T) != 0 ) return false;
+      values.assign( data, data+size/sizeof(T) );
+      return true;
+   }
+
+   template<typename T> bool getValue( int id, T& value ) const
+   {
+      size_t size;
+      const T* data = static_cast<const T*>(getSection( id, 0, sizeof(T), size ));
+      if( !data || size != sizeof(T) ) return false;
+      value = *data;
+      return true;
+   }
+
+private:
+
+   SceneImage( const SceneImage& );
+   SceneImage& operator=( const SceneImage& );
+
+private:
+
+   const char* data_;
+   size_t size_;
+#ifdef WIN32
+   void* file_;
+   void* mapping_;
+#else
+   int file_;
+#endif
+
+};
+
+/*
+* @brief Builds a warm start image in memory and writes it at once. The file
+* is written under a temporary name and renamed, so that a server that
+* crashes while writing never leaves a partial image behind.
+*/
+class SceneImageWriter
+{
+
+public:
+
+   void add( int id, int index, const void* data, size_t size, size_t elementSize );
+
+   template<typename T> void addArray( int id, int index, const std::vector<T>& values )
+   {
+      add( id, index, values.empty() ? 0 : &values[0], values.size()*sizeof(T), sizeof(T) );
+   }
+
+   template<typename T> void addValue( int id, const T& value )
+   {
+      add( id, 0, &value, sizeof(T), sizeof(T) );
+   }
+
+   bool write( const std::string& fileName, const std::string& source, const std::string& sourceFile ) const;
+
+private:
+
+   struct Section
+   {
+      int id;
+      int index;
+      size_t elementSize;
+      std::vector<char> data;
+   };
+   std::vector<Section> sections_;
+
+};
@@ -0,0 +1,86 @@
+// Project
+#include "SceneSnapshot.h"
+
+SceneSnapshot::SceneSnapshot(
+   int version,
+   const SceneInfo& sceneInfo,
+   const PostProcessingInfo& postProcessingInfo,
+   const std::vector<MaterialDescription>& materials,
+   const std::vector<BoundingBox>& bounds,
+   const MolecularStorePtr& molecule,
+   int moleculePrimitive ) :
+   version_(version),
+   sceneInfo_(sceneInfo),
+   postProcessingInfo_(postProcessingInfo),
+   materials_(materials),
+   bounds_(bounds),
+   molecule_(molecule),
+   moleculePrimitive_(moleculePrimitive)
+{
+}
+
+void SceneSnapshot::applyMaterials( CudaKernel& cudaKernel, const std::vector<MaterialDescription>& materials )
+{
+   for( size_t i(0); i<materials.size(); ++i )
+   {
+      int index = cudaKernel.addMaterial();
+      applyMaterial( cudaKernel, index, materials[i] );
+   }
+}
+
+void SceneSnapshot::applyMaterial( CudaKernel& cudaKernel, int index, const MaterialDescription& material )
+{
+   cudaKernel.setMaterial(
+      index,
+      material.r, material.g, material.b, material.noise,
+      material.reflection,
+      material.refraction,
+      material.procedural,
+      material.wireframe, material.wireframeDepth,
+      material.transparency,
+      material.textureId,
+      material.specularValue, material.specularPower, material.specularCoef,
+      material.innerIllumination,
+      material.fastTransparency );
+}
+
+SceneLayer::SceneLayer() :
+   hasSceneInfo_(false)
+{
+   // No server side post processing by default
+   postProcessingStages_.denoise      = false;
+   postProcessingStages_.depthOfField = false;
+   postProcessingStages_.toneMapping  = false;
+   postProcessingStages_.antiAliasing = false;
+   postProcessingStages_.exposure     = 1.f;
+   postProcessingStages_.whitePoint   = 1.f;
+}
+
+SceneLayerPtr SceneLayer::withSceneInfo( const ::IceStreamer::SceneInfo& sceneInfo ) const
+{
+   SceneLayerPtr layer = new SceneLayer(*this);
+   layer->hasSceneInfo_ = true;
+   layer->sceneInfo_    = sceneInfo;
+   return layer;
+}
+
+SceneLayerPtr SceneLayer::withMaterial( int index, const MaterialDescription& material ) const
+{
+   SceneLayerPtr layer = new SceneLayer(*this);
+   layer->materials_[index] = material;
+   return layer;
+}
+
+SceneLayerPtr SceneLayer::withoutMaterials() const
+{
+   SceneLayerPtr layer = new SceneLayer(*this);
+   layer->materials_.clear();
+   return layer;
+}
+
+SceneLayerPtr SceneLayer::withPostProcessingStages( const ::IceStreamer::PostProcessingStages& stages ) const
+{
+   SceneLayerPtr layer = new SceneLayer(*this);
+   layer->postProcessingStages_ = stages;
+   return layer;
+}
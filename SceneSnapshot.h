@@ -0,0 +1,131 @@
+#pragma once
+
+// System
+#include <map>
+#include <vector>
+
+// Ice
+#include <IceUtil/Shared.h>
+#include <IceUtil/Handle.h>
+
+// Project
+#include <Cuda/CudaKernel.h>
+#include "IIceStreamer.h"
+#include "DepthEstimator.h"
+#include "MolecularStore.h"
+
+/*
+* @brief All the parameters of CudaKernel::setMaterial
+*/
+struct MaterialDescription
+{
+   float r, g, b;
+   float noise;
+   float reflection;
+   float refraction;
+   bool  procedural;
+   bool  wireframe;
+   int   wireframeDepth;
+   float transparency;
+   int   textureId;
+   float specularValue;
+   float specularPower;
+   float specularCoef;
+   float innerIllumination;
+   bool  fastTransparency;
+};
+
+/*
+* @brief Immutable description of the scene shared by all sessions and render
+* backends: default settings, material table, bounds of the geometry and
+* molecule, if any, with the index of its first primitive in the kernels.
+* A new snapshot, with a new
+* version, is created whenever the scene is edited; snapshots are reference
+* counted so that the previous one stays valid for requests still using it.
+*/
+class SceneSnapshot : public IceUtil::Shared
+{
+
+public:
+
+   SceneSnapshot(
+      int version,
+      const SceneInfo& sceneInfo,
+      const PostProcessingInfo& postProcessingInfo,
+      const std::vector<MaterialDescription>& materials,
+      const std::vector<BoundingBox>& bounds,
+      const MolecularStorePtr& molecule,
+      int moleculePrimitive );
+
+public:
+
+   int getVersion() const { return version_; }
+   const SceneInfo& getSceneInfo() const { return sceneInfo_; }
+   const PostProcessingInfo& getPostProcessingInfo() const { return postProcessingInfo_; }
+   const std::vector<MaterialDescription>& getMaterials() const { return materials_; }
+   const std::vector<BoundingBox>& getBounds() const { return bounds_; }
+   const MolecularStorePtr& getMolecule() const { return molecule_; }
+   int getMoleculePrimitive() const { return moleculePrimitive_; }
+
+public:
+
+   /**
+   * @brief Uploads a material table to a kernel
+   */
+   static void applyMaterials( CudaKernel& cudaKernel, const std::vector<MaterialDescription>& materials );
+
+   static void applyMaterial( CudaKernel& cudaKernel, int index, const MaterialDescription& material );
+
+private:
+
+   int version_;
+   SceneInfo sceneInfo_;
+   PostProcessingInfo postProcessingInfo_;
+   std::vector<MaterialDescription> materials_;
+   std::vector<BoundingBox> bounds_;
+   MolecularStorePtr molecule_;
+   int moleculePrimitive_;
+
+};
+
+typedef IceUtil::Handle<SceneSnapshot> SceneSnapshotPtr;
+
+/*
+* @brief Per-session overrides on top of a scene snapshot. Layers are never
+* modified once published: writers copy the layer, change the copy and swap
+* it in. Sessions that do not customize anything share the same empty layer.
+*/
+class SceneLayer : public IceUtil::Shared
+{
+
+public:
+
+   SceneLayer();
+
+public:
+
+   bool hasSceneInfo() const { return hasSceneInfo_; }
+   const ::IceStreamer::SceneInfo& getSceneInfo() const { return sceneInfo_; }
+   const std::map<int, MaterialDescription>& getMaterials() const { return materials_; }
+   const ::IceStreamer::PostProcessingStages& getPostProcessingStages() const { return postProcessingStages_; }
+
+public:
+
+   /**
+   * @brief Copy-on-write modifiers, returning a new layer
+   */
+   IceUtil::Handle<SceneLayer> withSceneInfo( const ::IceStreamer::SceneInfo& sceneInfo ) const;
+   IceUtil::Handle<SceneLayer> withMaterial( int index, const MaterialDescription& material ) const;
+   IceUtil::Handle<SceneLayer> withoutMaterials() const;
+   IceUtil::Handle<SceneLayer> withPostProcessingStages( const ::IceStreamer::PostProcessingStages& stages ) const;
+
+private:
+
+   bool hasSceneInfo_;
+   ::IceStreamer::SceneInfo sceneInfo_;
+   std::map<int, MaterialDescription> materials_;
+   ::IceStreamer::PostProcessingStages postProcessingStages_;
+
+};
+
+typedef IceUtil::Handle<SceneLayer> SceneLayerPtr;
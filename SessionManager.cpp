@@ -0,0 +1,105 @@
+// Project
+#include "Trace.h"
+#include "SessionManager.h"
+
+Session::Session( const std::string& id, const SceneLayerPtr& layer, int maxInFlight, int targetFrameTime ) :
+   id_(id),
+   layer_(layer),
+   lastAccess_(IceUtil::Time::now(IceUtil::Time::Monotonic)),
+   flowController_(maxInFlight, targetFrameTime)
+{
+}
+
+SceneLayerPtr Session::getLayer()
+{
+   IceUtil::Mutex::Lock lock(mutex_);
+   return layer_;
+}
+
+SceneLayerPtr Session::updateLayer( const LayerUpdate& update )
+{
+   IceUtil::Mutex::Lock lock(mutex_);
+   layer_ = update.apply(layer_);
+   return layer_;
+}
+
+IceUtil::Time Session::getLastAccess()
+{
+   IceUtil::Mutex::Lock lock(mutex_);
+   return lastAccess_;
+}
+
+void Session::touch()
+{
+   IceUtil::Mutex::Lock lock(mutex_);
+   lastAccess_ = IceUtil::Time::now(IceUtil::Time::Monotonic);
+}
+
+bool Session::predict( const FrameRequest& request, FrameRequest& prediction )
+{
+   IceUtil::Mutex::Lock lock(mutex_);
+   predictor_.record(request);
+   return predictor_.predict(prediction);
+}
+
+SessionManager::SessionManager(
+   RenderBackendPool& pool, const SceneSnapshotPtr& snapshot, int timeout,
+   int maxInFlight, int targetFrameTime ) :
+   pool_(pool),
+   snapshot_(snapshot),
+   emptyLayer_(new SceneLayer),
+   timeout_(IceUtil::Time::seconds(timeout)),
+   lastExpiration_(IceUtil::Time::now(IceUtil::Time::Monotonic)),
+   maxInFlight_(maxInFlight),
+   targetFrameTime_(targetFrameTime)
+{
+}
+
+SessionPtr SessionManager::getSession( const std::string& id )
+{
+   IceUtil::Mutex::Lock lock(mutex_);
+   expireSessions();
+
+   SessionPtr& session = sessions_[id];
+   if( !session )
+   {
+      session = new Session(id, emptyLayer_, maxInFlight_, targetFrameTime_);
+      APPL_LOG_INFO("Session opened (" << sessions_.size() << " sessions)");
+   }
+   session->touch();
+   return session;
+}
+
+SceneSnapshotPtr SessionManager::getSnapshot()
+{
+   IceUtil::Mutex::Lock lock(mutex_);
+   return snapshot_;
+}
+
+void SessionManager::setSnapshot( const SceneSnapshotPtr& snapshot )
+{
+   IceUtil::Mutex::Lock lock(mutex_);
+   snapshot_ = snapshot;
+}
+
+void SessionManager::expireSessions()
+{
+   IceUtil::Time now = IceUtil::Time::now(IceUtil::Time::Monotonic);
+   if( now - lastExpiration_ < IceUtil::Time::seconds(1) ) return;
+   lastExpiration_ = now;
+
+   std::map<std::string, SessionPtr>::iterator it = sessions_.begin();
+   while( it != sessions_.end() )
+   {
+      if( now - it->second->getLastAccess() > timeout_ )
+      {
+         pool_.releaseSession(it->first);
+         sessions_.erase(it++);
+         APPL_LOG_INFO("Session expired (" << sessions_.size() << " sessions)");
+      }
+      else
+      {
+         ++it;
+      }
+   }
+}
@@ -0,0 +1,129 @@
+#pragma once
+
+// System
+#include <map>
+#include <string>
+
+// Ice
+#include <IceUtil/Mutex.h>
+#include <IceUtil/Time.h>
+
+// Project
+#include "SceneSnapshot.h"
+#include "RenderBackendPool.h"
+#include "MotionPredictor.h"
+#include "FlowController.h"
+#include "InputChannel.h"
+
+/*
+* @brief Change of the layer of a session, applied under the lock of the
+* session so that concurrent changes are not lost
+*/
+class LayerUpdate
+{
+
+public:
+
+   virtual ~LayerUpdate() {}
+
+   /**
+   * @brief Returns the new layer, or the given one when nothing changes
+   */
+   virtual SceneLayerPtr apply( const SceneLayerPtr& layer ) const = 0;
+
+};
+
+/*
+* @brief State kept by the server for one client connection
+*/
+class Session : public IceUtil::Shared
+{
+
+public:
+
+   Session( const std::string& id, const SceneLayerPtr& layer, int maxInFlight, int targetFrameTime );
+
+public:
+
+   const std::string& getId() const { return id_; }
+
+   SceneLayerPtr getLayer();
+
+   /**
+   * @brief Replaces the layer by the result of the update, and returns it
+   */
+   SceneLayerPtr updateLayer( const LayerUpdate& update );
+
+   IceUtil::Time getLastAccess();
+   void touch();
+
+   /**
+   * @brief Records the camera of a request and returns the request expected
+   * to come next, if the motion is steady
+   */
+   bool predict( const FrameRequest& request, FrameRequest& prediction );
+
+   FlowController& getFlowController() { return flowController_; }
+   InputChannel& getInput() { return input_; }
+
+private:
+
+   std::string id_;
+   IceUtil::Mutex mutex_;
+   SceneLayerPtr layer_;
+   IceUtil::Time lastAccess_;
+   MotionPredictor predictor_;
+   FlowController flowController_;
+   InputChannel input_;
+
+};
+
+typedef IceUtil::Handle<Session> SessionPtr;
+
+/*
+* @brief Keeps track of client sessions and of the scene snapshot they share.
+* Sessions that have been idle for longer than the timeout are dropped, and
+* their backend affinity released. Every session gets its own flow control,
+* with the same limits.
+*/
+class SessionManager
+{
+
+public:
+
+   SessionManager(
+      RenderBackendPool& pool, const SceneSnapshotPtr& snapshot, int timeout,
+      int maxInFlight, int targetFrameTime );
+
+public:
+
+   /**
+   * @brief Returns the session with the given id, creating it if needed
+   */
+   SessionPtr getSession( const std::string& id );
+
+   SceneSnapshotPtr getSnapshot();
+
+   /**
+   * @brief Replaces the snapshot of new requests, e.g. once the scene is
+   * loaded. Requests in progress keep the one they started with.
+   */
+   void setSnapshot( const SceneSnapshotPtr& snapshot );
+
+private:
+
+   void expireSessions();
+
+private:
+
+   RenderBackendPool& pool_;
+   IceUtil::Mutex mutex_;
+   SceneSnapshotPtr snapshot_;
+   SceneLayerPtr emptyLayer_;
+   std::map<std::string, SessionPtr> sessions_;
+   IceUtil::Time timeout_;
+   IceUtil::Time lastExpiration_;
+   int maxInFlight_;
+   int targetFrameTime_;
+
+};
@@ -0,0 +1,93 @@
+// Project
+#include "Trace.h"
+#include "Speculator.h"
+
+namespace
+{
+   // Delay before checking again for an idle backend
+   const int IDLE_POLLING = 5; // ms
+}
+
+Speculator::Speculator( RenderBackendPool& pool, FrameCache& frameCache ) :
+   pool_(pool),
+   frameCache_(frameCache),
+   destroyed_(false),
+   rendered_(0),
+   cancelled_(0)
+{
+}
+
+void Speculator::submit( const std::string& sessionId, const FrameRequest& request, Ice::Long key, int sceneVersion )
+{
+   Lock lock(*this);
+   if( jobs_.find(sessionId) != jobs_.end() ) ++cancelled_;
+   Job& job = jobs_[sessionId];
+   job.request      = request;
+   job.key          = key;
+   job.sceneVersion = sceneVersion;
+   notify();
+}
+
+void Speculator::cancel( const std::string& sessionId )
+{
+   Lock lock(*this);
+   std::map<std::string, Job>::iterator it = jobs_.find(sessionId);
+   if( it != jobs_.end() )
+   {
+      jobs_.erase(it);
+      ++cancelled_;
+   }
+}
+
+void Speculator::destroy()
+{
+   Lock lock(*this);
+   destroyed_ = true;
+   notify();
+}
+
+void Speculator::run()
+{
+   while( true )
+   {
+      std::string sessionId;
+      Job job;
+      RenderBackend* backend(nullptr);
+      {
+         Lock lock(*this);
+         while( !destroyed_ && jobs_.empty() ) wait();
+         if( destroyed_ ) break;
+
+         std::map<std::string, Job>::iterator it = jobs_.begin();
+         backend = pool_.acquireIdle(it->first);
+         if( !backend )
+         {
+            timedWait(IceUtil::Time::milliSeconds(IDLE_POLLING));
+            continue;
+         }
+         sessionId = it->first;
+         job = it->second;
+         jobs_.erase(it);
+      }
+
+      try
+      {
+         ::IceStreamer::bytes frame;
+         {
+            IceUtil::Mutex::Lock lock(backend->getMutex());
+            backend->render( job.request, frame );
+         }
+         frameCache_.insert( job.key, job.sceneVersion, frame, true );
+         ++rendered_;
+         if( rendered_%100 == 0 )
+         {
+            APPL_LOG_INFO("Speculation: " << rendered_ << " frames rendered, " << cancelled_ << " cancelled");
+         }
+      }
+      catch( ... )
+      {
+         APPL_LOG_ERROR("Speculative rendering failed");
+      }
+      pool_.release(backend);
+   }
+}
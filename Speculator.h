@@ -0,0 +1,69 @@
+#pragma once
+
+// System
+#include <map>
+#include <string>
+
+// Ice
+#include <IceUtil/Thread.h>
+#include <IceUtil/Monitor.h>
+
+// Project
+#include "RenderBackendPool.h"
+#include "FrameCache.h"
+
+/*
+* @brief Background thread pre-rendering the frames that sessions are
+* expected to request next. Speculative frames are only rendered on idle
+* backends and are stored in the frame cache, where the actual request finds
+* them if it falls in the same quantization cell as the prediction. Each
+* session has at most one pending speculation: a new prediction, or an
+* actual request of the session, cancels it before any rendering work is
+* done.
+*/
+class Speculator : public IceUtil::Thread, public IceUtil::Monitor<IceUtil::Mutex>
+{
+
+public:
+
+   Speculator( RenderBackendPool& pool, FrameCache& frameCache );
+
+public:
+
+   virtual void run();
+   void destroy();
+
+public:
+
+   /**
+   * @brief Schedules the rendering of a predicted request. The request must
+   * already be quantized.
+   */
+   void submit( const std::string& sessionId, const FrameRequest& request, Ice::Long key, int sceneVersion );
+
+   /**
+   * @brief Drops the pending speculation of a session, if any
+   */
+   void cancel( const std::string& sessionId );
+
+private:
+
+   struct Job
+   {
+      FrameRequest request;
+      Ice::Long key;
+      int sceneVersion;
+   };
+
+   RenderBackendPool& pool_;
+   FrameCache& frameCache_;
+   std::map<std::string, Job> jobs_;
+   bool destroyed_;
+
+   // Statistics
+   Ice::Long rendered_;
+   Ice::Long cancelled_;
+
+};
+
+typedef IceUtil::Handle<Speculator> SpeculatorPtr;
@@ -0,0 +1,720 @@
+/*
+________________________________________________________________________________
+
+Server tests
+
+Unit tests of the server components, linked with the server sources. Each
+test is run by name, one CTest test per name:
+
+Usage: ServerTests --test name
+
+The exit code is 0 when all checks pass, 1 on any failure, and 77 when the
+test cannot run on this machine, e.g. without a CUDA device.
+________________________________________________________________________________
+*/
+
+// System
+#ifdef WIN32
+#include <winsock2.h>
+#else
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+typedef int SOCKET;
+#define INVALID_SOCKET (-1)
+#define closesocket close
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <new>
+#include <string>
+#include <vector>
+
+// Cuda
+#include <cuda_runtime.h>
+
+// Project
+#include "FrameCache.h"
+#include "InputChannel.h"
+#include "HttpViewer.h"
+#include "IIceStreamerImpl.h"
+#include "MolecularStore.h"
+#include "PdbReader.h"
+#include "RenderBackend.h"
+#include "SceneImage.h"
+
+namespace
+{
+   // Process exit code of CTest skipped tests
+   const int SKIPPED = 77;
+
+   int gFailures(0);
+
+#define CHECK(condition) \
+   do { if( !(condition) ) { printf( "FAILED %s:%d: %s\n", __FILE__, __LINE__, #condition ); ++gFailures; } } while( false )
+
+   // --------------------------------------------------------------------------------
+   // Frame cache
+   // --------------------------------------------------------------------------------
+   // Fills a request the way the servant does, only setting the lanes of the
+   // kernel structures that it uses
+   void fillRequest( FrameRequest& request )
+   {
+      float4 eye       = { 10.f, 20.f, -5000.f, 0.f };
+      float4 direction = { 0.f, 0.f, 0.f, 0.f };
+      float4 angles    = { 0.1f, 0.2f, 0.f, 0.f };
+      request.eye       = eye;
+      request.direction = direction;
+      request.angles    = angles;
+      request.sceneInfo.width.x              = 768;
+      request.sceneInfo.height.x             = 512;
+      request.sceneInfo.shadowsEnabled.x     = 1;
+      request.sceneInfo.nbRayIterations.x    = 5;
+      request.sceneInfo.transparentColor.x   = 3.f;
+      request.sceneInfo.viewDistance.x       = 20000.f;
+      request.sceneInfo.shadowIntensity.x    = 0.9f;
+      request.sceneInfo.width3DVision.x      = 20.f;
+      request.sceneInfo.backgroundColor.x    = 1.f;
+      request.sceneInfo.backgroundColor.y    = 1.f;
+      request.sceneInfo.backgroundColor.z    = 1.f;
+      request.sceneInfo.supportFor3DVision.x = 0;
+      request.sceneInfo.renderBoxes.x        = 0;
+      request.sceneInfo.pathTracingIteration.x     = 0;
+      request.sceneInfo.maxPathTracingIterations.x = 1;
+      request.sceneInfo.misc.x = 0;
+      request.sceneInfo.misc.y = 0;
+      request.sceneInfo.misc.z = 1;
+      request.sceneInfo.misc.w = 1;
+      request.postProcessingInfo.type.x   = 0;
+      request.postProcessingInfo.param1.x = -4000.f;
+      request.postProcessingInfo.param2.x = 10.f;
+      request.postProcessingInfo.param3.x = 16;
+      request.layer = new SceneLayer();
+   }
+
+   int testFrameCacheKey()
+   {
+      FrameCache cache(1024*1024, 1.f, 0.001f);
+
+      // Requests built in memory holding different garbage
+      char first[sizeof(FrameRequest)];
+      char second[sizeof(FrameRequest)];
+      memset( first, 0x55, sizeof(first) );
+      memset( second, 0xAA, sizeof(second) );
+      FrameRequest* a = new (first) FrameRequest();
+      FrameRequest* b = new (second) FrameRequest();
+      fillRequest( *a );
+      fillRequest( *b );
+      cache.quantize( *a );
+      cache.quantize( *b );
+      CHECK( cache.computeKey( *a, 1 ) == cache.computeKey( *b, 1 ) );
+
+      // Lanes that requests do not set are not part of the view
+      b->sceneInfo.width.y = 12345;
+      b->postProcessingInfo.param1.w = 3.f;
+      b->eye.w = 7.f;
+      CHECK( cache.computeKey( *a, 1 ) == cache.computeKey( *b, 1 ) );
+
+      // Anything that changes the frame changes the key
+      FrameRequest c = *a;
+      c.eye.x += 10.f;
+      CHECK( cache.computeKey( *a, 1 ) != cache.computeKey( c, 1 ) );
+      c = *a;
+      c.sceneInfo.shadowsEnabled.x = 0;
+      CHECK( cache.computeKey( *a, 1 ) != cache.computeKey( c, 1 ) );
+      c = *a;
+      c.level = 1;
+      CHECK( cache.computeKey( *a, 1 ) != cache.computeKey( c, 1 ) );
+      CHECK( cache.computeKey( *a, 1 ) != cache.computeKey( *a, 2 ) );
+
+      a->~FrameRequest();
+      b->~FrameRequest();
+      return gFailures;
+   }
+
+   // --------------------------------------------------------------------------------
+   // Input channel
+   // --------------------------------------------------------------------------------
+   ::IceStreamer::CameraEvent cameraEvent( Ice::Long sequence, bool absolute, float ez )
+   {
+      ::IceStreamer::CameraEvent event;
+      ::IceStreamer::CameraState camera = { 0.f, 0.f, ez, 0.f, 0.f, 0.f, 0.f, 0.f, 0.f };
+      event.sequence = sequence;
+      event.absolute = absolute;
+      event.camera   = camera;
+      return event;
+   }
+
+   int testInputResync()
+   {
+      ::IceStreamer::CameraState camera;
+      bool hasCamera, hasSettings;
+      ::IceStreamer::SceneInfo sceneInfo;
+      ::IceStreamer::PostProcessingInfo postProcessingInfo;
+
+      // A client that keeps its sequence after its session expired
+      InputChannel input;
+      input.updateCamera( cameraEvent( 500, false, 10.f ) );
+      input.updateCamera( cameraEvent( 501, false, 10.f ) );
+      CHECK( input.getState( camera, hasCamera, hasSettings, sceneInfo, postProcessingInfo ) == 0 );
+      CHECK( !hasCamera );
+
+      // The absolute camera the client sends back resynchronizes the channel
+      input.updateCamera( cameraEvent( 503, true, -5000.f ) );
+      CHECK( input.getState( camera, hasCamera, hasSettings, sceneInfo, postProcessingInfo ) == 503 );
+      CHECK( hasCamera );
+      CHECK( camera.ez == -5000.f );
+
+      // Moves apply again, late events before the resync are ignored
+      input.updateCamera( cameraEvent( 504, false, 100.f ) );
+      input.updateCamera( cameraEvent( 502, false, 1.f ) );
+      CHECK( input.getState( camera, hasCamera, hasSettings, sceneInfo, postProcessingInfo ) == 504 );
+      CHECK( camera.ez == -4900.f );
+
+      // Missing moves are given up at the next absolute event
+      input.updateCamera( cameraEvent( 506, false, 100.f ) );
+      CHECK( input.getState( camera, hasCamera, hasSettings, sceneInfo, postProcessingInfo ) == 504 );
+      input.updateCamera( cameraEvent( 507, true, -3000.f ) );
+      CHECK( input.getState( camera, hasCamera, hasSettings, sceneInfo, postProcessingInfo ) == 507 );
+      CHECK( camera.ez == -3000.f );
+      return gFailures;
+   }
+
+   // --------------------------------------------------------------------------------
+   // HTTP viewer
+   // --------------------------------------------------------------------------------
+   // Sends a GET request and returns the whole response
+   std::string httpGet( int port, const std::string& target )
+   {
+      std::string response;
+      SOCKET s = socket( AF_INET, SOCK_STREAM, 0 );
+      if( s == INVALID_SOCKET ) return response;
+      sockaddr_in address;
+      memset( &address, 0, sizeof(address) );
+      address.sin_family      = AF_INET;
+      address.sin_addr.s_addr = inet_addr("127.0.0.1");
+      address.sin_port        = htons(static_cast<unsigned short>(port));
+      if( connect( s, reinterpret_cast<sockaddr*>(&address), sizeof(address) ) == 0 )
+      {
+         std::string request = "GET "+target+" HTTP/1.1\r\nHost: localhost\r\n\r\n";
+         send( s, request.data(), static_cast<int>(request.size()), 0 );
+         char buffer[4096];
+         int received;
+         while( (received = recv( s, buffer, sizeof(buffer), 0 )) > 0 ) response.append( buffer, received );
+      }
+      closesocket( s );
+      return response;
+   }
+
+   // Size given by the start of frame marker of a JPEG response
+   bool getJpegSize( const std::string& response, int& width, int& height )
+   {
+      const unsigned char* bytes = reinterpret_cast<const unsigned char*>(response.data());
+      for( size_t i(0); i+8<response.size(); ++i )
+      {
+         if( bytes[i] == 0xFF && bytes[i+1] == 0xC0 )
+         {
+            height = (bytes[i+5]<<8)|bytes[i+6];
+            width  = (bytes[i+7]<<8)|bytes[i+8];
+            return true;
+         }
+      }
+      return false;
+   }
+
+   int testHttpViewer()
+   {
+      // No backend: views are served placeholders while the scene loads
+      SceneInfo sceneInfo = SceneInfo();
+      sceneInfo.width.x  = 64;
+      sceneInfo.height.x = 48;
+      sceneInfo.viewDistance.x = 20000.f;
+      sceneInfo.backgroundColor.x = 1.f;
+      std::vector<MaterialDescription> materials;
+      std::vector<BoundingBox> bounds;
+      SceneSnapshotPtr snapshot = new SceneSnapshot(0, sceneInfo, PostProcessingInfo(), materials, bounds, 0, -1);
+      RenderBackendPool pool(2);
+      SessionManager sessions(pool, snapshot, 60, 2, 40);
+      FrameCache frameCache(1024*1024, 1.f, 0.001f);
+      float4 eye = { 0.f, 0.f, -5000.f, 0.f };
+      float4 zero = { 0.f, 0.f, 0.f, 0.f };
+      ViewSettings view = { eye, zero, zero, 64, 48 };
+
+      // First free port of a range
+      HttpViewerPtr viewer;
+      int port(0);
+      for( int p(18080); p<18100 && !viewer; ++p )
+      {
+         viewer = new HttpViewer( p, 4, view, 64, 48, pool, sessions, frameCache, 75, 20, 4.f, 0 );
+         if( viewer->listen() ) port = p;
+         else viewer = 0;
+      }
+      if( !viewer ) return SKIPPED;
+      viewer->start();
+
+      // The query is echoed in the page, but cannot close its attribute or
+      // script string, nor overflow the page
+      std::string page = httpGet( port, "/?eye=0,0,-5000&x=%22%3E\"><script>alert(1)</script>'" );
+      CHECK( page.find("200 OK") != std::string::npos );
+      CHECK( page.find("<script>alert") == std::string::npos );
+      CHECK( page.find("x=%22%3E%22%3E%3Cscript%3Ealert%281%29%3C%2Fscript%3E%27") != std::string::npos );
+      page = httpGet( port, "/websocket?"+std::string(4000, '<') );
+      CHECK( page.find("200 OK") != std::string::npos );
+      CHECK( page.find("<<") == std::string::npos );
+
+      std::string frame = httpGet( port, "/frame.jpg?width=64&height=48" );
+      CHECK( frame.find("200 OK") != std::string::npos );
+      CHECK( frame.find("image/jpeg") != std::string::npos );
+      size_t body = frame.find("\r\n\r\n");
+      CHECK( body != std::string::npos && frame.size() > body+4 && 
+         static_cast<unsigned char>(frame[body+4]) == 0xFF && static_cast<unsigned char>(frame[body+5]) == 0xD8 );
+
+      // Sizes are clamped to the scene of the server, smaller ones are kept
+      int width(0), height(0);
+      CHECK( getJpegSize( httpGet( port, "/frame.jpg?width=4096&height=100000" ), width, height ) );
+      CHECK( width == 64 && height == 48 );
+      CHECK( getJpegSize( httpGet( port, "/frame.jpg?width=32&height=100000" ), width, height ) );
+      CHECK( width == 32 && height == 48 );
+
+      // A static view is not published again
+      ViewStreamPtr stream = viewer->subscribe( view );
+      CHECK( stream );
+      if( stream )
+      {
+         EncodedFramePtr first = stream->waitForFrame( 0, 10000 );
+         CHECK( first );
+         if( first ) CHECK( !stream->waitForFrame( first->sequence, 200 ) );
+         CHECK( !stream->isStopped() );
+         stream->unsubscribe();
+      }
+
+      CHECK( httpGet( port, "/missing" ).find("404") != std::string::npos );
+
+      viewer->destroy();
+      viewer->getThreadControl().join();
+      return gFailures;
+   }
+
+   // --------------------------------------------------------------------------------
+   // Molecules
+   // --------------------------------------------------------------------------------
+   // Writes a small PDB file: element columns for some records only, two
+   // residues far apart, then an ion
+   std::string writePdb()
+   {
+      std::string fileName = "ServerTests.pdb";
+      FILE* file = fopen( fileName.c_str(), "w" );
+      if( !file ) return "";
+      fputs( "ATOM      1  N   DA  A   1       0.000   0.000   0.000  1.00  0.00           N\n", file );
+      fputs( "ATOM      2  CA  DA  A   1       1.500   0.000   0.000  1.00  0.00\n", file );
+      fputs( "ATOM      3  C   DA  A   2      40.000   0.000   0.000  1.00  0.00           C\n", file );
+      fputs( "ATOM      4  O   DA  A   2      41.500   0.000   0.000  1.00  0.00\n", file );
+      fputs( "HETATM    5 FE   HEM A 101      20.000   5.000   0.000  1.00  0.00          FE\n", file );
+      fputs( "HETATM    6 ZN    ZN A 102      20.000  -5.000   0.000  1.00  0.00\n", file );
+      fputs( "HETATM    7 CL    CL A 103      20.000   0.000   5.000  1.00  0.00          CL\n", file );
+      fputs( "HETATM    8 MG    MG A 104      20.000   0.000  -5.000  1.00  0.00\n", file );
+      fputs( "HETATM    9  C1  LIG A 105      20.000   0.000   0.000  1.00  0.00\n", file );
+      fclose( file );
+      return fileName;
+   }
+
+   int testPdbElements()
+   {
+      std::string fileName = writePdb();
+      std::vector<PdbAtom> atoms;
+      CHECK( PdbReader::read( fileName, atoms ) );
+      remove( fileName.c_str() );
+      if( atoms.size() != 9 ) return ++gFailures;
+
+      const char* expected[] = { "N", "C", "C", "O", "Fe", "Zn", "Cl", "Mg", "C" };
+      for( size_t i(0); i<atoms.size(); ++i )
+      {
+         if( strcmp( PdbReader::getSymbol(atoms[i].element), expected[i] ) != 0 )
+            printf( "Atom %d: %s instead of %s\n", static_cast<int>(i+1), PdbReader::getSymbol(atoms[i].element), expected[i] );
+         CHECK( strcmp( PdbReader::getSymbol(atoms[i].element), expected[i] ) == 0 );
+      }
+      CHECK( PdbReader::getRadius(atoms[4].element) != PdbReader::getRadius(0) );
+      return gFailures;
+   }
+
+   // Camera looking at the molecule from the given distance
+   CameraModel moleculeCamera( float distance )
+   {
+      CameraVector eye       = { 0.f, 0.f, -distance };
+      CameraVector direction = { 0.f, 0.f, -distance+1000.f };
+      CameraVector angles    = { 0.f, 0.f, 0.f };
+      return CameraModel( eye, direction, angles, 768, 512, 4.f );
+   }
+
+   int testMolecularDetail()
+   {
+      std::string fileName = writePdb();
+      MolecularStore store( 1.f, mdAtoms );
+      MolecularStore coarse( 1.f, mdResidues );
+      CHECK( store.loadFromFile( fileName, 50.f, 50.f ) );
+      CHECK( coarse.loadFromFile( fileName, 50.f, 50.f ) );
+      remove( fileName.c_str() );
+
+      // Distance at which a backend rendering atoms switches to residues
+      float distance(3000.f);
+      while( distance < 1e7f && store.selectDetail( moleculeCamera(distance), mdAtoms ) == mdAtoms ) distance *= 1.02f;
+      CHECK( distance < 1e7f );
+
+      // Slightly closer, a backend keeps the level it renders
+      CHECK( store.selectDetail( moleculeCamera(distance*0.95f), mdResidues ) == mdResidues );
+      CHECK( store.selectDetail( moleculeCamera(distance*0.95f), mdAtoms ) == mdAtoms );
+      CHECK( store.selectDetail( moleculeCamera(distance*2.f), mdAtoms ) != mdAtoms );
+      CHECK( store.selectDetail( moleculeCamera(distance*0.5f), mdResidues ) == mdAtoms );
+
+      // Nothing finer than the finest level
+      CHECK( coarse.selectDetail( moleculeCamera(3000.f), mdResidues ) == mdResidues );
+      CHECK( coarse.getNbSpheres(mdResidues) < coarse.getNbSpheres(mdAtoms) );
+      return gFailures;
+   }
+
+   int testSceneImage()
+   {
+      std::string fileName = writePdb();
+      std::string imageFile = "ServerTests.image";
+      MolecularStore store( 1.f, mdAtoms );
+      CHECK( store.loadFromFile( fileName, 50.f, 50.f ) );
+
+      std::vector<float> values( 6, 2.f );
+      SceneImageWriter writer;
+      writer.addArray( siBounds, 0, values );
+      store.save( writer );
+      CHECK( writer.write( imageFile, "source", fileName ) );
+
+      // Sections are read as elements of the size they were written with
+      SceneImage image;
+      CHECK( image.open( imageFile, "source", fileName ) );
+      std::vector<float> floats;
+      std::vector<double> doubles;
+      CHECK( image.getArray( siBounds, 0, floats ) && floats == values );
+      CHECK( !image.getArray( siBounds, 0, doubles ) );
+      size_t size;
+      CHECK( image.getSection( siBounds, 0, sizeof(float), size ) && size == values.size()*sizeof(float) );
+      CHECK( !image.getSection( siBounds, 1, sizeof(float), size ) );
+
+      MolecularStore loaded( 1.f, mdAtoms );
+      CHECK( loaded.load( image ) );
+      CHECK( loaded.getNbAtoms() == store.getNbAtoms() );
+      image.close();
+
+      // Another source is another image
+      CHECK( !image.open( imageFile, "other source", fileName ) );
+      remove( imageFile.c_str() );
+      remove( fileName.c_str() );
+      return gFailures;
+   }
+
+   // Frames of the culling test are compared with the tolerance of the probe
+   const int CULLING_TOLERANCE = 8;
+
+   SceneInfo cullingSceneInfo( int width, int height )
+   {
+      SceneInfo sceneInfo = SceneInfo();
+      sceneInfo.width.x                    = width;
+      sceneInfo.height.x                   = height;
+      sceneInfo.nbRayIterations.x          = 1;
+      sceneInfo.viewDistance.x             = 20000.f;
+      sceneInfo.backgroundColor.x          = 0.1f;
+      sceneInfo.backgroundColor.y          = 0.2f;
+      sceneInfo.backgroundColor.z          = 0.3f;
+      sceneInfo.maxPathTracingIterations.x = 1;
+      sceneInfo.misc.x                     = otOpenGL;
+      sceneInfo.misc.z                     = 1;
+      return sceneInfo;
+   }
+
+   // A few spheres off the center of the view, leaving empty tiles around
+   CudaKernel* createCullingKernel( const SceneInfo& sceneInfo, std::vector<BoundingBox>& bounds )
+   {
+      std::vector<MaterialDescription> materials(1);
+      MaterialDescription& material = materials[0];
+      memset( &material, 0, sizeof(material) );
+      material.r = 1.f;
+      material.g = 0.5f;
+      material.textureId = -1;
+
+      CudaKernel* cudaKernel = new CudaKernel(false);
+      cudaKernel->setSceneInfo( sceneInfo );
+      cudaKernel->initBuffers();
+      SceneSnapshot::applyMaterials( *cudaKernel, materials );
+
+      const float spheres[][3] = { { 400.f, 100.f, 0.f }, { 900.f, -300.f, 200.f }, { -700.f, 500.f, -100.f } };
+      const float radius(250.f);
+      bounds.clear();
+      for( int i(0); i<3; ++i )
+      {
+         int primitive = cudaKernel->addPrimitive( ptSphere );
+         cudaKernel->setPrimitive( primitive, spheres[i][0], spheres[i][1], spheres[i][2], radius, 0.f, 0.f, 0, 1, 1 );
+         BoundingBox box = {
+            { spheres[i][0]-radius, spheres[i][1]-radius, spheres[i][2]-radius },
+            { spheres[i][0]+radius, spheres[i][1]+radius, spheres[i][2]+radius } };
+         bounds.push_back( box );
+      }
+      cudaKernel->compactBoxes(true);
+      return cudaKernel;
+   }
+
+   long countMismatches( const ::IceStreamer::bytes& expected, const ::IceStreamer::bytes& actual )
+   {
+      if( expected.size() != actual.size() ) return static_cast<long>(expected.size());
+      long mismatches(0);
+      for( size_t i(0); i<expected.size(); ++i )
+      {
+         if( abs(static_cast<int>(expected[i])-static_cast<int>(actual[i])) > CULLING_TOLERANCE ) ++mismatches;
+      }
+      return mismatches;
+   }
+
+   int testCulling()
+   {
+      int nbDevices(0);
+      if( cudaGetDeviceCount(&nbDevices) != cudaSuccess || nbDevices < 1 ) return SKIPPED;
+      cudaSetDevice(0);
+
+      // Kernel buffers are sized for the largest frame of the test
+      SceneInfo sceneInfo = cullingSceneInfo( 512, 384 );
+      PostProcessingInfo postProcessingInfo = PostProcessingInfo();
+      std::vector<BoundingBox> bounds;
+      CudaKernel* culledKernel   = createCullingKernel( sceneInfo, bounds );
+      CudaKernel* unculledKernel = createCullingKernel( sceneInfo, bounds );
+      SceneSnapshotPtr snapshot = new SceneSnapshot(1, sceneInfo, postProcessingInfo,
+         std::vector<MaterialDescription>(), bounds, 0, -1);
+      const float pixelPitch(4.f);
+      RenderBackend culled( 0, 0, culledKernel, snapshot, DepthEstimator(8), pixelPitch, 32 );
+      RenderBackend unculled( 1, 0, unculledKernel, snapshot, DepthEstimator(8), pixelPitch, 0 );
+
+      FrameRequest request;
+      request.eye.z       = -5000.f;
+      request.direction.z = 3000.f;
+      request.sceneInfo   = sceneInfo;
+      request.postProcessingInfo = postProcessingInfo;
+      CHECK( culled.validateCulling( request ) );
+      CHECK( culled.isCulling() );
+      CHECK( !unculled.isCulling() );
+
+      // Centered, off center with the spheres at the edge, and an odd size
+      // where the culled rectangle cannot grow to an even size
+      struct View { float x, y; int width, height; };
+      const View views[] = { { 0.f, 0.f, 512, 384 }, { 1500.f, 600.f, 512, 384 }, { -900.f, -200.f, 301, 203 } };
+      for( int v(0); v<3; ++v )
+      {
+         FrameRequest view(request);
+         view.eye.x = view.direction.x = views[v].x;
+         view.eye.y = view.direction.y = views[v].y;
+         view.sceneInfo.width.x  = views[v].width;
+         view.sceneInfo.height.x = views[v].height;
+         ::IceStreamer::bytes culledFrame, unculledFrame;
+         {
+            IceUtil::Mutex::Lock lock(culled.getMutex());
+            culled.render( view, culledFrame );
+         }
+         {
+            IceUtil::Mutex::Lock lock(unculled.getMutex());
+            unculled.render( view, unculledFrame );
+         }
+         CHECK( culledFrame.size() == static_cast<size_t>(views[v].width*views[v].height*3) );
+         CHECK( countMismatches( unculledFrame, culledFrame ) <= static_cast<long>(culledFrame.size()/100) );
+      }
+      return gFailures;
+   }
+
+   int testLevelViews()
+   {
+      int nbDevices(0);
+      if( cudaGetDeviceCount(&nbDevices) != cudaSuccess || nbDevices < 1 ) return SKIPPED;
+      cudaSetDevice(0);
+
+      SceneInfo sceneInfo = cullingSceneInfo( 512, 384 );
+      PostProcessingInfo postProcessingInfo = PostProcessingInfo();
+      std::vector<BoundingBox> bounds;
+      CudaKernel* levelKernel  = createCullingKernel( sceneInfo, bounds );
+      CudaKernel* sampleKernel = createCullingKernel( sceneInfo, bounds );
+      SceneSnapshotPtr snapshot = new SceneSnapshot(1, sceneInfo, postProcessingInfo,
+         std::vector<MaterialDescription>(), bounds, 0, -1);
+      const float pixelPitch(4.f);
+      RenderBackend levels( 0, 0, levelKernel, snapshot, DepthEstimator(8), pixelPitch, 0 );
+      RenderBackend samples( 1, 0, sampleKernel, snapshot, DepthEstimator(8), pixelPitch, 0 );
+
+      FrameRequest request;
+      request.eye.z       = -5000.f;
+      request.direction.z = 3000.f;
+      request.sceneInfo   = sceneInfo;
+      request.postProcessingInfo = postProcessingInfo;
+      CHECK( levels.validateLevelViews( request ) );
+      CHECK( levels.hasLevelViews() );
+      CHECK( !samples.hasLevelViews() );
+
+      // Levels rendered as smaller images match those sampling the full
+      // frame, also when the size is not a multiple of the scale
+      const int sizes[][2] = { { 512, 384 }, { 301, 203 } };
+      for( int s(0); s<2; ++s )
+      {
+         for( int level(1); level<=3; ++level )
+         {
+            FrameRequest view(request);
+            view.eye.x = view.direction.x = 300.f;
+            view.sceneInfo.width.x  = sizes[s][0];
+            view.sceneInfo.height.x = sizes[s][1];
+            view.level = level;
+            ::IceStreamer::bytes levelFrame, sampledFrame;
+            {
+               IceUtil::Mutex::Lock lock(levels.getMutex());
+               levels.render( view, levelFrame );
+            }
+            {
+               IceUtil::Mutex::Lock lock(samples.getMutex());
+               samples.render( view, sampledFrame );
+            }
+            int scale = 1<<level;
+            size_t size = ((sizes[s][0]+scale-1)/scale)*((sizes[s][1]+scale-1)/scale)*3;
+            CHECK( levelFrame.size() == size );
+            CHECK( countMismatches( sampledFrame, levelFrame ) <= static_cast<long>(size/100) );
+         }
+      }
+      return gFailures;
+   }
+
+   int testLevelProgression()
+   {
+      int nbDevices(0);
+      if( cudaGetDeviceCount(&nbDevices) != cudaSuccess || nbDevices < 1 ) return SKIPPED;
+      cudaSetDevice(0);
+
+      // A backend that samples levels from full frames, serving the
+      // isometric default view
+      SceneInfo sceneInfo = cullingSceneInfo( 256, 192 );
+      sceneInfo.misc.w = 1;
+      PostProcessingInfo postProcessingInfo = PostProcessingInfo();
+      std::vector<BoundingBox> bounds;
+      CudaKernel* cudaKernel = createCullingKernel( sceneInfo, bounds );
+      SceneSnapshotPtr snapshot = new SceneSnapshot(1, sceneInfo, postProcessingInfo,
+         std::vector<MaterialDescription>(), bounds, 0, -1);
+      RenderBackend* backend = new RenderBackend( 0, 0, cudaKernel, snapshot, DepthEstimator(8), 4.f, 0 );
+      RenderBackendPool pool(2);
+      pool.addBackend( backend );
+      SessionManager sessions(pool, snapshot, 60, 2, 40);
+      FrameCache frameCache(16*1024*1024, 1.f, 0.001f);
+      BroadcastManager broadcasts(pool, 1, 40, 1000);
+      IIceStreamerImpl servant( pool, sessions, frameCache, 0, 4.f, DepthEstimator(8), broadcasts );
+
+      ::IceStreamer::SceneInfo scInfo = ::IceStreamer::SceneInfo();
+      scInfo.width                    = sceneInfo.width.x;
+      scInfo.height                   = sceneInfo.height.x;
+      scInfo.nbRayIterations          = sceneInfo.nbRayIterations.x;
+      scInfo.viewDistance             = sceneInfo.viewDistance.x;
+      scInfo.backgroundColorR         = sceneInfo.backgroundColor.x;
+      scInfo.backgroundColorG         = sceneInfo.backgroundColor.y;
+      scInfo.backgroundColorB         = sceneInfo.backgroundColor.z;
+      scInfo.maxPathTracingIterations = sceneInfo.maxPathTracingIterations.x;
+      scInfo.outputType               = sceneInfo.misc.x;
+      scInfo.fog                      = sceneInfo.misc.z;
+      scInfo.isometric3D              = sceneInfo.misc.w;
+      ::IceStreamer::PostProcessingInfo ppInfo = ::IceStreamer::PostProcessingInfo();
+
+      // The coarsest level renders the full frame once, the next levels and
+      // the full frame itself are served from it
+      long rendered;
+      {
+         IceUtil::Mutex::Lock lock(backend->getMutex());
+         rendered = backend->getNbRenderedFrames();
+      }
+      ::Ice::Current current;
+      std::vector< ::IceStreamer::FrameLevel> levels;
+      for( int level(3); level>=0; --level )
+      {
+         levels.push_back( servant.getFrameLevel( 0.f, 0.f, -5000.f, 0.f, 0.f, 3000.f, 0.f, 0.f, 0.f,
+            scInfo, ppInfo, level, false, false, current ) );
+         const ::IceStreamer::FrameLevel& frameLevel = levels.back();
+         CHECK( frameLevel.level == level );
+         CHECK( frameLevel.frame.color.size() == static_cast<size_t>(frameLevel.width*frameLevel.height*3) );
+      }
+      {
+         IceUtil::Mutex::Lock lock(backend->getMutex());
+         CHECK( backend->getNbRenderedFrames() == rendered+1 );
+      }
+
+      // Levels are exactly those of the full frame
+      const ::IceStreamer::bytes& full = levels.back().frame.color;
+      for( size_t i(0); i+1<levels.size(); ++i )
+      {
+         FrameRequest request;
+         request.sceneInfo = sceneInfo;
+         request.level = levels[i].level;
+         ::IceStreamer::bytes sampled;
+         RenderBackend::sampleLevel( request, full, sampled );
+         CHECK( sampled == levels[i].frame.color );
+      }
+      return gFailures;
+   }
+
+   struct Test
+   {
+      const char* name;
+      int (*run)();
+   };
+
+   const Test TESTS[] =
+   {
+      { "frameCacheKey", testFrameCacheKey },
+      { "inputResync",   testInputResync },
+      { "httpViewer",    testHttpViewer },
+      { "pdbElements",   testPdbElements },
+      { "molecularDetail", testMolecularDetail },
+      { "sceneImage",    testSceneImage },
+      { "culling",       testCulling },
+      { "levelViews",    testLevelViews },
+      { "levelProgression", testLevelProgression }
+   };
+   const int NB_TESTS = sizeof(TESTS)/sizeof(TESTS[0]);
+}
+
+int main( int argc, char* argv[] )
+{
+   std::string name;
+   for( int i(1); i<argc; ++i )
+   {
+      if( std::string(argv[i]) == "--test" && i+1 < argc ) name = argv[++i];
+      else
+      {
+         printf( "Unknown option %s\n", argv[i] );
+         return 1;
+      }
+   }
+
+   int passed(0), failed(0), skipped(0);
+   for( int t(0); t<NB_TESTS; ++t )
+   {
+      if( !name.empty() && name != TESTS[t].name ) continue;
+      gFailures = 0;
+      int failures = TESTS[t].run();
+      if( failures == SKIPPED )
+      {
+         printf( "SKIPPED %s\n", TESTS[t].name );
+         ++skipped;
+      }
+      else if( failures > 0 )
+      {
+         printf( "FAILED %s: %d check(s)\n", TESTS[t].name, failures );
+         ++failed;
+      }
+      else
+      {
+         printf( "%s passed\n", TESTS[t].name );
+         ++passed;
+      }
+   }
+   if( passed+failed+skipped == 0 )
+   {
+      printf( "No test %s\n", name.c_str() );
+      return 1;
+   }
+   if( failed > 0 ) return 1;
+   return passed > 0 ? 0 : SKIPPED;
+}
@@ -0,0 +1,111 @@
+// System
+#include <algorithm>
+
+// Project
+#include "TileMask.h"
+
+TileMask::TileMask() :
+   width_(0),
+   height_(0),
+   tileSize_(1),
+   tilesX_(0),
+   tilesY_(0)
+{
+}
+
+void TileMask::compute(
+   const std::vector<BoundingBox>& boxes,
+   const CameraModel& camera,
+   int width, int height, int tileSize )
+{
+   width_    = width;
+   height_   = height;
+   tileSize_ = tileSize;
+   tilesX_   = (width+tileSize-1)/tileSize;
+   tilesY_   = (height+tileSize-1)/tileSize;
+   tiles_.assign( tilesX_*tilesY_, 0 );
+
+   for( size_t i(0); i<boxes.size(); ++i )
+   {
+      const BoundingBox& box = boxes[i];
+      float minX( 1e30f), minY( 1e30f);
+      float maxX(-1e30f), maxY(-1e30f);
+      int behind(0);
+      for( int corner(0); corner<8; ++corner )
+      {
+         CameraVector point = {
+            (corner&1) ? box.maximum.x : box.minimum.x,
+            (corner&2) ? box.maximum.y : box.minimum.y,
+            (corner&4) ? box.maximum.z : box.minimum.z };
+         float x, y, distance;
+         if( !camera.project( point, x, y, distance ) )
+         {
+            ++behind;
+            continue;
+         }
+         minX = std::min(minX, x); maxX = std::max(maxX, x);
+         minY = std::min(minY, y); maxY = std::max(maxY, y);
+      }
+
+      // Out of sight, or crossing the plane of the eye
+      if( behind == 8 ) continue;
+      if( behind > 0 )
+      {
+         tiles_.assign( tilesX_*tilesY_, 1 );
+         return;
+      }
+
+      // One pixel margin for the rounding of the kernel rays
+      int x0 = std::max(0, static_cast<int>(minX)-1);
+      int y0 = std::max(0, static_cast<int>(minY)-1);
+      int x1 = std::min(width-1, static_cast<int>(maxX)+1);
+      int y1 = std::min(height-1, static_cast<int>(maxY)+1);
+      if( maxX < -1.f || maxY < -1.f || x0 > x1 || y0 > y1 ) continue;
+      for( int ty(y0/tileSize); ty<=y1/tileSize; ++ty )
+         for( int tx(x0/tileSize); tx<=x1/tileSize; ++tx )
+            tiles_[ty*tilesX_+tx] = 1;
+   }
+}
+
+bool TileMask::isEmpty( int x0, int y0, int x1, int y1 ) const
+{
+   x0 = std::max(x0, 0); y0 = std::max(y0, 0);
+   x1 = std::min(x1, width_); y1 = std::min(y1, height_);
+   if( x0 >= x1 || y0 >= y1 ) return true;
+   for( int ty(y0/tileSize_); ty<=(y1-1)/tileSize_; ++ty )
+      for( int tx(x0/tileSize_); tx<=(x1-1)/tileSize_; ++tx )
+         if( tiles_[ty*tilesX_+tx] ) return false;
+   return true;
+}
+
+bool TileMask::getCoveredRect( int& x0, int& y0, int& x1, int& y1 ) const
+{
+   int minX(tilesX_), minY(tilesY_), maxX(-1), maxY(-1);
+   for( int ty(0); ty<tilesY_; ++ty )
+   {
+      for( int tx(0); tx<tilesX_; ++tx )
+      {
+         if( !tiles_[ty*tilesX_+tx] ) continue;
+         minX = std::min(minX, tx); maxX = std::max(maxX, tx);
+         minY = std::min(minY, ty); maxY = std::max(maxY, ty);
+      }
+   }
+   if( maxX < 0 ) return false;
+   x0 = minX*tileSize_;
+   y0 = minY*tileSize_;
+   x1 = std::min(width_, (maxX+1)*tileSize_);
+   y1 = std::min(height_, (maxY+1)*tileSize_);
+   return true;
+}
+
+size_t TileMask::getCoveredPixels() const
+{
+   size_t pixels(0);
+   for( int ty(0); ty<tilesY_; ++ty )
+   {
+      int tileHeight = std::min(tileSize_, height_-ty*tileSize_);
+      for( int tx(0); tx<tilesX_; ++tx )
+         if( tiles_[ty*tilesX_+tx] ) pixels += tileHeight*std::min(tileSize_, width_-tx*tileSize_);
+   }
+   return pixels;
+}
@@ -0,0 +1,62 @@
+#pragma once
+
+// System
+#include <vector>
+
+// Project
+#include "CameraModel.h"
+#include "DepthEstimator.h"
+
+/*
+* @brief Tiles of an image that may show scene geometry. Each bounding box of
+* the scene is projected on the image, and the tiles overlapping the
+* projection are covered. The mask is conservative: a tile that is not
+* covered can only show the background. Boxes partly behind the eye cover
+* the whole image.
+*/
+class TileMask
+{
+
+public:
+
+   TileMask();
+
+public:
+
+   void compute(
+      const std::vector<BoundingBox>& boxes,
+      const CameraModel& camera,
+      int width, int height, int tileSize );
+
+   int getTileSize() const { return tileSize_; }
+   int getWidth() const { return tilesX_; }
+   int getHeight() const { return tilesY_; }
+   bool isCovered( int x, int y ) const { return tiles_[y*tilesX_+x] != 0; }
+
+   /**
+   * @brief True when none of the pixels of the rectangle [x0,x1[ x [y0,y1[
+   * is covered
+   */
+   bool isEmpty( int x0, int y0, int x1, int y1 ) const;
+
+   /**
+   * @brief Smallest pixel rectangle [x0,x1[ x [y0,y1[ enclosing the covered
+   * tiles. Returns false when no tile is covered.
+   */
+   bool getCoveredRect( int& x0, int& y0, int& x1, int& y1 ) const;
+
+   /**
+   * @brief Number of covered pixels
+   */
+   size_t getCoveredPixels() const;
+
+private:
+
+   int width_;
+   int height_;
+   int tileSize_;
+   int tilesX_;
+   int tilesY_;
+   std::vector<unsigned char> tiles_;
+
+};
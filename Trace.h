@@ -1,33 +1,60 @@
 #pragma once
 
 // System
+#ifdef WIN32
 #include <windows.h>
+#else
+#include <stdio.h>
+#include <time.h>
+#include <sys/time.h>
+#include <pthread.h>
+#endif
 #include <iostream>
+#include <string>
 
 inline std::string getTimestamp()
 {
-   char tmp[20];
+   // Room for four integers of any value, so that nothing is truncated
+   char tmp[48];
+#ifdef WIN32
    SYSTEMTIME time;
    GetSystemTime(&time);
    WORD millis = (time.wSecond * 1000) + time.wMilliseconds;
    sprintf_s(tmp, "%02d:%02d:%02d.%03d", time.wHour+2, time.wMinute, time.wSecond, millis/100);
+#else
+   struct timeval now;
+   gettimeofday(&now, 0);
+   struct tm time;
+   gmtime_r(&now.tv_sec, &time);
+   int millis = (time.tm_sec * 1000) + static_cast<int>(now.tv_usec/1000);
+   snprintf(tmp, sizeof(tmp), "%02d:%02d:%02d.%03d", (time.tm_hour+2)%24, time.tm_min, time.tm_sec, millis/100);
+#endif
    return std::string(tmp);
 }
 
+inline unsigned long getThreadId()
+{
+#ifdef WIN32
+   return GetCurrentThreadId();
+#else
+   return static_cast<unsigned long>(pthread_self());
+#endif
+}
+
 #define APPL_LOG_CONSOLE(__msg) \
-   std::cout << getTimestamp() << " [" << GetCurrentThreadId() << "] " << __msg << std::endl;
+   std::cout << getTimestamp() << " [" << getThreadId() << "] " << __msg << std::endl;
 
 #define APPL_LOG_DEBUG(__msg) \
-   std::cout << getTimestamp() << " [" << GetCurrentThreadId() << "] " << __msg << std::endl;
+   std::cout << getTimestamp() << " [" << getThreadId() << "] " << __msg << std::endl;
 
 #define APPL_LOG_INFO(__msg) \
-   std::cout << getTimestamp() << " [" << GetCurrentThreadId() << "] " << __msg << std::endl;
+   std::cout << getTimestamp() << " [" << getThreadId() << "] " << __msg << std::endl;
 
 #define APPL_LOG_WARNING(__msg) \
-   std::cout << getTimestamp() << " [" << GetCurrentThreadId() << "] " << __msg << std::endl;
+   std::cout << getTimestamp() << " [" << getThreadId() << "] " << __msg << std::endl;
 
 #define APPL_LOG_ERROR(__msg) \
-   std::cout << getTimestamp() << " [" << GetCurrentThreadId() << "] " << __msg << std::endl;
+   std::cout << getTimestamp() << " [" << getThreadId() << "] " << __msg << std::endl;
 
 #define APPL_ASSERT( stmt ) \
    if( !(stmt) ) throw cms::CMSException( "Invalid assertion: " #stmt );
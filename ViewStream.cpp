@@ -0,0 +1,204 @@
+// System
+#include <string.h>
+#include <algorithm>
+
+// Project
+#include "Trace.h"
+#include "ViewStream.h"
+
+ViewStream::ViewStream(
+   const std::string& id, const ViewSettings& view,
+   RenderBackendPool& pool, SessionManager& sessions, FrameCache& frameCache,
+   int quality, int frameTime,
+   float pixelPitch, int cullingTileSize ) :
+   id_(id),
+   view_(view),
+   pool_(pool),
+   sessions_(sessions),
+   frameCache_(frameCache),
+   quality_(quality),
+   frameTime_(frameTime),
+   pixelPitch_(pixelPitch),
+   cullingTileSize_(cullingTileSize),
+   layer_(new SceneLayer()),
+   lastConstantMacroblocks_(0),
+   viewers_(0),
+   stopped_(false)
+{
+}
+
+bool ViewStream::subscribe()
+{
+   Lock lock(*this);
+   if( stopped_ ) return false;
+   ++viewers_;
+   return true;
+}
+
+void ViewStream::unsubscribe()
+{
+   Lock lock(*this);
+   --viewers_;
+   notifyAll();
+}
+
+void ViewStream::destroy()
+{
+   Lock lock(*this);
+   stopped_ = true;
+   notifyAll();
+}
+
+bool ViewStream::isStopped()
+{
+   Lock lock(*this);
+   return stopped_;
+}
+
+EncodedFramePtr ViewStream::waitForFrame( Ice::Long after, int timeout )
+{
+   Lock lock(*this);
+   IceUtil::Time deadline = IceUtil::Time::now(IceUtil::Time::Monotonic)+IceUtil::Time::milliSeconds(timeout);
+   while( !stopped_ && (!frame_ || frame_->sequence <= after) )
+   {
+      IceUtil::Time now = IceUtil::Time::now(IceUtil::Time::Monotonic);
+      if( now >= deadline ) return 0;
+      timedWait(deadline-now);
+   }
+   if( stopped_ ) return 0;
+   return frame_;
+}
+
+void ViewStream::run()
+{
+   APPL_LOG_INFO("View " << id_ << " started");
+   Ice::Long sequence(0);
+   Ice::Long lastKey(0);
+   int lastSceneVersion(-1);
+   bool lastComplete(false);
+   ::IceStreamer::bytes frame;
+   std::vector<unsigned char> image;
+   while( true )
+   {
+      IceUtil::Time start = IceUtil::Time::now(IceUtil::Time::Monotonic);
+      {
+         Lock lock(*this);
+         if( !stopped_ && viewers_ <= 0 ) stopped_ = true;
+         if( stopped_ )
+         {
+            notifyAll();
+            break;
+         }
+      }
+
+      try
+      {
+         // The latest frame stays valid until the scene changes, unless it
+         // is a placeholder
+         SceneSnapshotPtr snapshot = sessions_.getSnapshot();
+         Ice::Long key(lastKey);
+         bool complete(lastComplete);
+         if( snapshot->getVersion() != lastSceneVersion || !lastComplete )
+            complete = renderFrame( snapshot, frame, key );
+
+         size_t nbPixels = view_.width*view_.height;
+         if( (key != lastKey || complete != lastComplete) && frame.size() == nbPixels*3 )
+         {
+            // Kernel frames start with the bottom right pixel
+            image.resize( frame.size() );
+            for( size_t i(0); i<nbPixels; ++i )
+               memcpy( &image[i*3], &frame[(nbPixels-1-i)*3], 3 );
+
+            EncodedFramePtr encoded = new EncodedFrame();
+            encoded->sequence = ++sequence;
+            encoder_.encode( &image[0], view_.width, view_.height, quality_, encoded->jpeg, lastConstantMacroblocks_ );
+            lastKey          = key;
+            lastSceneVersion = snapshot->getVersion();
+            lastComplete     = complete;
+
+            Lock lock(*this);
+            frame_ = encoded;
+            notifyAll();
+         }
+      }
+      catch( ... )
+      {
+         APPL_LOG_ERROR("View " << id_ << " failed to render");
+      }
+
+      // Next frame, unless the stream is stopped in the meantime
+      Lock lock(*this);
+      IceUtil::Time next = start+IceUtil::Time::milliSeconds(frameTime_);
+      IceUtil::Time now = IceUtil::Time::now(IceUtil::Time::Monotonic);
+      while( !stopped_ && viewers_ > 0 && now < next )
+      {
+         timedWait(next-now);
+         now = IceUtil::Time::now(IceUtil::Time::Monotonic);
+      }
+   }
+   pool_.releaseSession( id_ );
+   APPL_LOG_INFO("View " << id_ << " stopped after " << sequence << " frames");
+}
+
+bool ViewStream::renderFrame( const SceneSnapshotPtr& snapshot, ::IceStreamer::bytes& frame, Ice::Long& key )
+{
+   // Scene defaults with the camera and size of the view
+   FrameRequest request;
+   request.eye                  = view_.eye;
+   request.direction            = view_.direction;
+   request.angles               = view_.angles;
+   request.sceneInfo            = snapshot->getSceneInfo();
+   request.sceneInfo.width.x    = view_.width;
+   request.sceneInfo.height.x   = view_.height;
+   request.postProcessingInfo   = snapshot->getPostProcessingInfo();
+   memset( &request.postProcessor, 0, sizeof(request.postProcessor) );
+   request.layer = layer_;
+
+   int sceneVersion = snapshot->getVersion();
+   frameCache_.quantize( request );
+   key = frameCache_.computeKey( request, sceneVersion );
+   lastConstantMacroblocks_ = computeConstantMacroblocks( request, snapshot );
+   if( frameCache_.find( key, sceneVersion, frame ) ) return true;
+   {
+      ScopedBackend backend(pool_, id_);
+      if( !backend.isValid() )
+      {
+         // The scene is still loading. With culling, shaded tiles are the
+         // ones whose macroblocks are not constant.
+         int tileSize = (cullingTileSize_ > 0) ? cullingTileSize_ : 16;
+         RenderBackend::renderPlaceholder( request, snapshot->getBounds(), pixelPitch_, tileSize, frame );
+         return false;
+      }
+      IceUtil::Mutex::Lock lock(backend->getMutex());
+      backend->render( request, frame );
+   }
+   frameCache_.insert( key, sceneVersion, frame );
+   return true;
+}
+
+const unsigned char* ViewStream::computeConstantMacroblocks( const FrameRequest& request, const SceneSnapshotPtr& snapshot )
+{
+   // Backends fill the tiles that are not covered with the background, with
+   // the same mask as this one, when they cull
+   if( cullingTileSize_ <= 0 || !pool_.isCulling() ||
+       request.sceneInfo.supportFor3DVision.x != ::IceStreamer::vtStandard ||
+       request.sceneInfo.misc.w != 0 ) return 0;
+   int width  = view_.width;
+   int height = view_.height;
+   mask_.compute( snapshot->getBounds(), request.getCameraModel(pixelPitch_), width, height, cullingTileSize_ );
+
+   // Encoded images are rotated by 180 degrees
+   int macroblocksX = (width+15)/16;
+   int macroblocksY = (height+15)/16;
+   constantMacroblocks_.resize( macroblocksX*macroblocksY );
+   for( int y(0); y<macroblocksY; ++y )
+   {
+      for( int x(0); x<macroblocksX; ++x )
+      {
+         int x0 = width-std::min(x*16+16, width);
+         int y0 = height-std::min(y*16+16, height);
+         constantMacroblocks_[y*macroblocksX+x] = mask_.isEmpty( x0, y0, width-x*16, height-y*16 ) ? 1 : 0;
+      }
+   }
+   return &constantMacroblocks_[0];
+}
@@ -0,0 +1,121 @@
+#pragma once
+
+// System
+#include <string>
+#include <vector>
+
+// Ice
+#include <IceUtil/Thread.h>
+#include <IceUtil/Monitor.h>
+#include <IceUtil/Shared.h>
+
+// Project
+#include "RenderBackendPool.h"
+#include "SessionManager.h"
+#include "FrameCache.h"
+#include "JpegEncoder.h"
+#include "TileMask.h"
+
+/*
+* @brief Camera and image size of a view watched from a browser
+*/
+struct ViewSettings
+{
+   float4 eye;
+   float4 direction;
+   float4 angles;
+   int    width;
+   int    height;
+};
+
+/*
+* @brief JPEG frame shared by all the viewers of a view. Frames are never
+* modified once published, so viewers send them without holding any lock.
+*/
+class EncodedFrame : public IceUtil::Shared
+{
+
+public:
+
+   Ice::Long sequence;
+   std::vector<unsigned char> jpeg;
+
+};
+
+typedef IceUtil::Handle<EncodedFrame> EncodedFramePtr;
+
+/*
+* @brief Renders and encodes a view for all its viewers. Frames go through
+* the frame cache like client requests, are encoded once, and the latest one
+* is handed out to every viewer: a viewer slower than the stream skips the
+* frames it had no time to send. The view only changes with the scene, so a
+* frame is only rendered again for a new scene version, or while backends
+* are not ready and placeholders are shown. When the backends cull empty tiles,
+* the macroblocks of the frame that only cover such tiles are encoded as
+* constant.
+* The stream stops when its last viewer leaves.
+*/
+class ViewStream : public IceUtil::Thread, public IceUtil::Monitor<IceUtil::Mutex>
+{
+
+public:
+
+   ViewStream(
+      const std::string& id, const ViewSettings& view,
+      RenderBackendPool& pool, SessionManager& sessions, FrameCache& frameCache,
+      int quality, int frameTime,
+      float pixelPitch, int cullingTileSize );
+
+public:
+
+   virtual void run();
+   void destroy();
+
+public:
+
+   /**
+   * @brief Registers a viewer. Returns false when the stream has stopped,
+   * in which case a new one must be started.
+   */
+   bool subscribe();
+   void unsubscribe();
+
+   /**
+   * @brief Returns the latest frame when it is more recent than the given
+   * sequence, waiting at most timeout ms for it. Returns null on timeout or
+   * when the stream stops.
+   */
+   EncodedFramePtr waitForFrame( Ice::Long after, int timeout );
+
+   bool isStopped();
+
+private:
+
+   // Returns false when a placeholder was rendered instead of the frame
+   bool renderFrame( const SceneSnapshotPtr& snapshot, ::IceStreamer::bytes& frame, Ice::Long& key );
+   const unsigned char* computeConstantMacroblocks( const FrameRequest& request, const SceneSnapshotPtr& snapshot );
+
+private:
+
+   std::string id_;
+   ViewSettings view_;
+   RenderBackendPool& pool_;
+   SessionManager& sessions_;
+   FrameCache& frameCache_;
+   int quality_;
+   int frameTime_;
+   float pixelPitch_;
+   int cullingTileSize_;
+   SceneLayerPtr layer_; // views have no session override
+   JpegEncoder encoder_;
+   TileMask mask_;
+   std::vector<unsigned char> constantMacroblocks_;
+   const unsigned char* lastConstantMacroblocks_;
+
+   int viewers_;
+   bool stopped_;
+   EncodedFramePtr frame_;
+
+};
+
+typedef IceUtil::Handle<ViewStream> ViewStreamPtr;